@@ -27,23 +27,49 @@ using namespace std;
 using namespace fmt;
 //}}}
 
+//{{{
+struct sTuner {
+  int mAdapter;
+  int mFrequency;
+  int mCore; // -1 leaves the thread unpinned
+  };
+//}}}
+
 // cAppWindow
 class cApp : public cGlWindow {
 public:
   //{{{
   void run (const string& title, int width, int height,
-            bool gui, bool consoleStats, bool multicast, int frequency) {
+            bool gui, bool consoleStats, bool multicast, const vector <sTuner>& tuners) {
+  // each tuner gets its own capture/demux thread and loop
+
+    // sized once, the textBoxes keep references to the strings
+    mStrings.resize (tuners.size());
 
     if (gui) {
       initialiseGui (title, width, height, (unsigned char*)droidSansMono, sizeof(droidSansMono));
-      add (new cTextBox (mString, 0.f));
+      for (auto& str : mStrings)
+        add (new cTextBox (str, 0.f));
 
-      thread ([=](){ dvblast (frequency, multicast, false); } ).detach();
+      for (size_t i = 0; i < tuners.size(); i++)
+        thread ([=](){ dvblast (tuners[i], i, multicast, false); } ).detach();
 
       runGui (true);
       }
-    else // run in this main thread
-      dvblast (frequency, multicast, consoleStats);
+
+    else {
+      if (consoleStats)
+        cLog::clearScreen();
+
+      // first tuner runs in this main thread
+      vector <thread> threads;
+      for (size_t i = 1; i < tuners.size(); i++)
+        threads.push_back (thread ([=](){ dvblast (tuners[i], i, multicast, consoleStats); }));
+      dvblast (tuners[0], 0, multicast, consoleStats);
+
+      for (auto& t : threads)
+        t.join();
+      }
 
     cLog::log (LOGINFO, "exit");
     }
@@ -94,7 +120,36 @@ protected:
   //}}}
 private:
   //{{{
-  void dvblast (int frequency, bool multicast, bool consoleStats) {
+  void selectOutputs (cDvbRtp& dvbRtp, int frequency, bool multicast, int tunerIndex) {
+  // tuner n multicasts to 239.255.n+1.x, or unicasts to ports from 5002 + n*100
+
+    vector <int> sids;
+    if (frequency == 626000000)
+      sids = { 17540, 17472, 17662, 17664, 17728 };
+    else if (frequency == 650000000)
+      sids = { 8277,   // itv
+               8384,   // c4
+               8500,   // c5
+               8385,   // film4
+               8442,   // more4
+               8325,   // itv2
+               8330 }; // itv4
+    else if (frequency == 674000000)
+      sids = { 4162,   // bbcsw
+               4287,   // bbc2
+               4544,   // bbc4
+               4352,   // bbc news
+               4736,   // bbc parl
+               6848 }; // r3
+
+    for (size_t i = 0; i < sids.size(); i++)
+      dvbRtp.selectOutput (multicast ? format ("239.255.{}.{}:5002", tunerIndex + 1, i + 1)
+                                     : format ("192.168.1.109:{}", 5002 + (tunerIndex * 100) + (i * 2)),
+                           sids[i]);
+    }
+  //}}}
+  //{{{
+  void dvblast (const sTuner& tuner, int tunerIndex, bool multicast, bool consoleStats) {
 
   // set thread realtime priority
     struct sched_param param;
@@ -102,50 +157,39 @@ private:
     if (pthread_setschedparam (pthread_self(), SCHED_RR, &param))
       cLog::log (LOGERROR, "pthread_setschedparam failed");
 
-    // init blockPool
+    // pin thread to its core
+    if (tuner.mCore >= 0) {
+      cpu_set_t cpuSet;
+      CPU_ZERO (&cpuSet);
+      CPU_SET (tuner.mCore, &cpuSet);
+      if (pthread_setaffinity_np (pthread_self(), sizeof(cpu_set_t), &cpuSet))
+        cLog::log (LOGERROR, format ("adapter {} pthread_setaffinity_np core {} failed",
+                                     tuner.mAdapter, tuner.mCore));
+      }
+
+    // init blockPool, cTsBlockPool has no locking, so one per tuner thread
     cTsBlockPool blockPool (100);
 
     // init dvb
-    cDvb dvb (frequency, 0);
+    cDvb dvb (tuner.mFrequency, tuner.mAdapter);
 
     // init dvbRtp
     cDvbRtp dvbRtp (&dvb, &blockPool);
-    if (frequency == 626000000) {
-      dvbRtp.selectOutput (multicast ? "239.255.1.1:5002" : "192.168.1.109:5002", 17540);
-      dvbRtp.selectOutput (multicast ? "239.255.1.2:5002" : "192.168.1.109:5004", 17472);
-      dvbRtp.selectOutput (multicast ? "239.255.1.3:5002" : "192.168.1.109:5006", 17662);
-      dvbRtp.selectOutput (multicast ? "239.255.1.4:5002" : "192.168.1.109:5008", 17664);
-      dvbRtp.selectOutput (multicast ? "239.255.1.5:5002" : "192.168.1.109:5010", 17728);
-      }
-    else if (frequency == 650000000) {
-      dvbRtp.selectOutput (multicast ? "239.255.1.1:5002" : "192.168.1.109:5002", 8277); // itv
-      dvbRtp.selectOutput (multicast ? "239.255.1.2:5002" : "192.168.1.109:5004", 8384); // c4
-      dvbRtp.selectOutput (multicast ? "239.255.1.3:5002" : "192.168.1.109:5006", 8500); // c5
-      dvbRtp.selectOutput (multicast ? "239.255.1.4:5002" : "192.168.1.109:5008", 8385); // film4
-      dvbRtp.selectOutput (multicast ? "239.255.1.5:5002" : "192.168.1.109:5010", 8442); // more4
-      dvbRtp.selectOutput (multicast ? "239.255.1.6:5002" : "192.168.1.109:5012", 8325); // itv2
-      dvbRtp.selectOutput (multicast ? "239.255.1.7:5002" : "192.168.1.109:5014", 8330); // itv4
-      }
-    else if (frequency == 674000000) {
-      dvbRtp.selectOutput (multicast ? "239.255.1.1:5002" : "192.168.1.109:5002", 4162); // bbcsw
-      dvbRtp.selectOutput (multicast ? "239.255.1.2:5002" : "192.168.1.109:5004", 4287); // bbc2
-      dvbRtp.selectOutput (multicast ? "239.255.1.3:5002" : "192.168.1.109:5006", 4544); // bbc4
-      dvbRtp.selectOutput (multicast ? "239.255.1.4:5002" : "192.168.1.109:5008", 4352); // bbc news
-      dvbRtp.selectOutput (multicast ? "239.255.1.5:5002" : "192.168.1.109:5010", 4736); // bbc parl
-      dvbRtp.selectOutput (multicast ? "239.255.1.6:5002" : "192.168.1.109:5012", 6848); // r3
-      }
+    selectOutputs (dvbRtp, tuner.mFrequency, multicast, tunerIndex);
+
+    // console rows of this tuner
+    int row = tunerIndex * kTunerRows;
 
+    int blocks = 0;
     string timeString;
     string statusString;
     vector <string> statsStrings;
-    if (consoleStats) {
-      cLog::clearScreen();
+    if (consoleStats)
       for (int i = 0; i < dvbRtp.getNumOutputs(); i++)
         statsStrings.push_back ("");
-      }
 
     while (!mExit) {
-      mBlocks++;
+      blocks++;
       dvbRtp.demuxBlockList (dvb.getBlocks (&blockPool));
 
       if (consoleStats) {
@@ -154,18 +198,18 @@ private:
         if (nowTimeString != timeString) {
           // time ticked, update status
           timeString = nowTimeString;
-          mString = format ("{} blocks {} packets {} errors:{}:{}:{} {}",
-                            nowTimeString, mBlocks, dvbRtp.getNumPackets(),
-                            dvbRtp.getNumInvalids(), dvbRtp.getNumDiscontinuities(), dvbRtp.getNumErrors(),
-                            blockPool.getInfoString());
-          cLog::status (0, 0, mString);
+          mStrings[tunerIndex] = format ("{} adapter {} blocks {} packets {} errors:{}:{}:{} {}",
+                                         nowTimeString, tuner.mAdapter, blocks, dvbRtp.getNumPackets(),
+                                         dvbRtp.getNumInvalids(), dvbRtp.getNumDiscontinuities(), dvbRtp.getNumErrors(),
+                                         blockPool.getInfoString());
+          cLog::status (row, 0, mStrings[tunerIndex]);
           }
         //}}}
         //{{{  update status
         string nowStatusString = dvb.getStatusString();
         if (nowStatusString != statusString) {
           statusString = nowStatusString;
-          cLog::status (1, 6, nowStatusString);
+          cLog::status (row + 1, 6, nowStatusString);
           }
         //}}}
         //{{{  update outputs
@@ -174,7 +218,7 @@ private:
           if (info != statsStrings[i]) {
             // info changed, update info
             statsStrings[i] = info;
-            cLog::status (i+2, i+1, info);
+            cLog::status (row + i + 2, i+1, info);
             }
           }
         //}}}
@@ -183,13 +227,46 @@ private:
     }
   //}}}
   //{{{  vars
+  static constexpr int kTunerRows = 10;
+
   bool mExit = false;
 
-  int mBlocks = 0;
-  string mString = "hello";
+  vector <string> mStrings; // status line per tuner
   //}}}
   };
 
+//{{{
+vector <string> split (const string& str) {
+
+  vector <string> strings;
+  size_t start = 0;
+  while (start <= str.size()) {
+    size_t end = str.find (',', start);
+    if (end == string::npos)
+      end = str.size();
+    if (end > start)
+      strings.push_back (str.substr (start, end - start));
+    start = end + 1;
+    }
+
+  return strings;
+  }
+//}}}
+//{{{
+int getFrequency (const string& name) {
+// 0 if unknown multiplex
+
+  if (name == "itv")
+    return 650000000;
+  else if (name == "bbc")
+    return 674000000;
+  else if (name == "hd")
+    return 626000000;
+  else
+    return 0;
+  }
+//}}}
+
 // main
 int main (int numArgs, char* args[]) {
   //{{{  args to params vector<string>
@@ -203,6 +280,8 @@ int main (int numArgs, char* args[]) {
   bool multicast = false;
   bool consoleStats = false;
   int frequency = 626000000;
+  vector <string> tunerNames;
+  vector <string> coreNames;
   eLogLevel logLevel = LOGINFO;
   //{{{  parse params to options
   for (size_t i = 0; i < params.size(); i++) {
@@ -215,14 +294,44 @@ int main (int numArgs, char* args[]) {
     else if (params[i] == "log1") logLevel = LOGINFO1;
     else if (params[i] == "log2") logLevel = LOGINFO2;
     else if (params[i] == "log3") logLevel = LOGINFO3;
+    else if (params[i].find ("tuners=") == 0) tunerNames = split (params[i].substr (7));
+    else if (params[i].find ("cores=") == 0) coreNames = split (params[i].substr (6));
     }
   //}}}
 
   cLog::init (logLevel);
   cLog::log (LOGNOTICE, "dvblast");
 
+  //{{{  options to tuners
+  // - tuners=hd,bbc,itv opens adapters 0,1,2 on those multiplexes
+  // - cores=2,3,4 pins their threads
+  vector <int> cores;
+  for (auto& coreName : coreNames) {
+    char* end;
+    long core = strtol (coreName.c_str(), &end, 10);
+    if ((end == coreName.c_str()) || *end || (core < 0) || (core >= CPU_SETSIZE)) {
+      cLog::log (LOGERROR, format ("cores= invalid core {}", coreName));
+      return 1;
+      }
+    cores.push_back ((int)core);
+    }
+
+  vector <sTuner> tuners;
+  if (tunerNames.empty())
+    tuners.push_back ({ 0, frequency, cores.empty() ? -1 : cores[0] });
+  else
+    for (size_t i = 0; i < tunerNames.size(); i++) {
+      int tunerFrequency = getFrequency (tunerNames[i]);
+      if (!tunerFrequency) {
+        cLog::log (LOGERROR, format ("tuners= unknown multiplex {}, use hd, bbc or itv", tunerNames[i]));
+        return 1;
+        }
+      tuners.push_back ({ (int)i, tunerFrequency, i < cores.size() ? cores[i] : -1 });
+      }
+  //}}}
+
   cApp app;
-  app.run ("dvblast", 790, 450, gui, consoleStats, multicast, frequency);
+  app.run ("dvblast", 790, 450, gui, consoleStats, multicast, tuners);
 
   return 0;
   }
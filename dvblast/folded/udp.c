@@ -1,5 +1,6 @@
 // udp.c
 //{{{  includes
+#define _GNU_SOURCE // recvmmsg
 #include <net/if.h>
 #include <fcntl.h>
 #include <sys/uio.h>
@@ -18,6 +19,7 @@
 //{{{  defines
 #define UDP_LOCK_TIMEOUT 5000000 /* 5 s */
 #define PRINT_REFRACTORY_PERIOD 1000000 /* 1 s */
+#define MAX_RECV_BATCH 64 // datagrams per recvmmsg
 
 #define IS_OPTION(option) (!strncasecmp (psz_string, option, strlen(option)))
 #define ARG_OPTION(option) (psz_string + strlen(option))
@@ -29,6 +31,11 @@ static struct ev_timer muteWatcher;
 
 static bool b_udp = false;
 static int i_block_cnt;
+static int i_recv_batch = 1;
+static struct mmsghdr* p_recv_msgs = NULL;
+static struct iovec* p_recv_iov;
+static uint8_t (*pp_recv_rtp_hdr)[RTP_HEADER_SIZE];
+static block_t** pp_recv_blocks;
 static uint8_t pi_ssrc[4] = { 0, 0, 0, 0 };
 static uint16_t i_seqnum = 0;
 static bool b_sync = false;
@@ -36,6 +43,113 @@ static bool b_sync = false;
 static mtime_t i_last_print = 0;
 static struct sockaddr_storage last_addr;
 
+//{{{
+static void udpCheckRtp (const uint8_t* p_rtp_hdr) {
+
+  uint8_t pi_new_ssrc[4];
+
+  if (!rtp_check_hdr (p_rtp_hdr) )
+    msg_Warn (NULL, "invalid RTP packet received");
+  if (rtp_get_type (p_rtp_hdr) != RTP_TYPE_TS)
+    msg_Warn (NULL, "non-TS RTP packet received");
+  rtp_get_ssrc (p_rtp_hdr, pi_new_ssrc);
+  if (!memcmp (pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t))) {
+    if (rtp_get_seqnum (p_rtp_hdr) != i_seqnum)
+      msg_Warn (NULL, "RTP discontinuity");
+    }
+  else {
+    struct in_addr addr;
+    memcpy (&addr.s_addr, pi_new_ssrc, 4 * sizeof(uint8_t));
+    msg_Dbg (NULL, "new RTP source: %s", inet_ntoa(addr));
+    memcpy (pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t));
+    }
+  i_seqnum = rtp_get_seqnum (p_rtp_hdr) + 1;
+  }
+//}}}
+//{{{
+static void udpLock (struct ev_loop* loop) {
+
+  if (!b_sync) {
+    msg_Info (NULL, "frontend has acquired lock");
+    b_sync = true;
+    }
+
+  ev_timer_again (loop, &muteWatcher);
+  }
+//}}}
+//{{{
+static void udpReadBatch (struct ev_loop* loop) {
+// drain up to i_recv_batch datagrams with one recvmmsg, demux them as one chain
+// - slots armed once, only the ones recvmmsg filled are re-armed
+
+  int i_iov_cnt = i_block_cnt + (b_udp ? 0 : 1);
+
+  if (!p_recv_msgs) {
+    p_recv_msgs = calloc (i_recv_batch, sizeof(struct mmsghdr));
+    p_recv_iov = malloc (i_recv_batch * i_iov_cnt * sizeof(struct iovec));
+    pp_recv_rtp_hdr = malloc (i_recv_batch * RTP_HEADER_SIZE);
+    pp_recv_blocks = malloc (i_recv_batch * i_block_cnt * sizeof(block_t*));
+
+    for (int i_msg = 0; i_msg < i_recv_batch; i_msg++) {
+      struct iovec* p_msg_iov = &p_recv_iov[i_msg * i_iov_cnt];
+      int i_iov = 0;
+      if (!b_udp) {
+        // FIXME : this is wrong if RTP header > 12 bytes */
+        p_msg_iov[0].iov_base = pp_recv_rtp_hdr[i_msg];
+        p_msg_iov[0].iov_len = RTP_HEADER_SIZE;
+        i_iov = 1;
+        }
+
+      for (int i_block = 0; i_block < i_block_cnt; i_block++) {
+        block_t* p_block = blockNew();
+        pp_recv_blocks[i_msg * i_block_cnt + i_block] = p_block;
+        p_msg_iov[i_iov].iov_base = p_block->p_ts;
+        p_msg_iov[i_iov].iov_len = TS_SIZE;
+        i_iov++;
+        }
+
+      p_recv_msgs[i_msg].msg_hdr.msg_iov = p_msg_iov;
+      p_recv_msgs[i_msg].msg_hdr.msg_iovlen = i_iov;
+      }
+    }
+
+  int i_nb_msgs = recvmmsg (i_handle, p_recv_msgs, i_recv_batch, MSG_DONTWAIT, NULL);
+  if (i_nb_msgs < 0) {
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+      msg_Err (NULL, "couldn't read from network (%s)", strerror(errno));
+    i_nb_msgs = 0;
+    }
+
+  block_t* p_ts = NULL;
+  block_t** pp_current = &p_ts;
+  bool b_lock = false;
+  for (int i_msg = 0; i_msg < i_nb_msgs; i_msg++) {
+    struct iovec* p_msg_iov = &p_recv_iov[i_msg * i_iov_cnt + (b_udp ? 0 : 1)];
+    block_t** pp_slots = &pp_recv_blocks[i_msg * i_block_cnt];
+    ssize_t i_len = p_recv_msgs[i_msg].msg_len;
+    if (!b_udp) {
+      udpCheckRtp (pp_recv_rtp_hdr[i_msg]);
+      i_len -= RTP_HEADER_SIZE;
+      }
+    i_len /= TS_SIZE;
+
+    for (int i_block = 0; (i_block < i_len) && (i_block < i_block_cnt); i_block++) {
+      *pp_current = pp_slots[i_block];
+      pp_current = &pp_slots[i_block]->p_next;
+      b_lock = true;
+
+      pp_slots[i_block] = blockNew();
+      p_msg_iov[i_block].iov_base = pp_slots[i_block]->p_ts;
+      }
+    }
+  *pp_current = NULL;
+
+  if (b_lock)
+    udpLock (loop);
+
+  demuxRun (p_ts);
+  }
+//}}}
 //{{{
 static void udpRead (struct ev_loop* loop, struct ev_io* w, int revents) {
 
@@ -66,6 +180,11 @@ static void udpRead (struct ev_loop* loop, struct ev_io* w, int revents) {
       }
     }
 
+  if (i_recv_batch > 1) {
+    udpReadBatch (loop);
+    return;
+    }
+
   struct iovec p_iov[i_block_cnt + 1];
   block_t* p_ts, **pp_current = &p_ts;
   int i_iov, i_block;
@@ -96,36 +215,13 @@ static void udpRead (struct ev_loop* loop, struct ev_io* w, int revents) {
     }
 
   if (!b_udp) {
-    uint8_t pi_new_ssrc[4];
-
-    if (!rtp_check_hdr (p_rtp_hdr) )
-      msg_Warn (NULL, "invalid RTP packet received");
-    if (rtp_get_type (p_rtp_hdr) != RTP_TYPE_TS)
-      msg_Warn (NULL, "non-TS RTP packet received");
-    rtp_get_ssrc (p_rtp_hdr, pi_new_ssrc);
-    if (!memcmp (pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t))) {
-      if (rtp_get_seqnum (p_rtp_hdr) != i_seqnum)
-        msg_Warn (NULL, "RTP discontinuity");
-      }
-    else {
-      struct in_addr addr;
-      memcpy (&addr.s_addr, pi_new_ssrc, 4 * sizeof(uint8_t));
-      msg_Dbg (NULL, "new RTP source: %s", inet_ntoa(addr));
-      memcpy (pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t));
-      }
-    i_seqnum = rtp_get_seqnum (p_rtp_hdr) + 1;
+    udpCheckRtp (p_rtp_hdr);
     i_len -= RTP_HEADER_SIZE;
     }
 
   i_len /= TS_SIZE;
-  if (i_len) {
-    if (!b_sync) {
-      msg_Info (NULL, "frontend has acquired lock");
-      b_sync = true;
-      }
-
-    ev_timer_again (loop, &muteWatcher);
-    }
+  if (i_len > 0)
+    udpLock (loop);
 
   while (i_len && *pp_current) {
     pp_current = &(*pp_current)->p_next;
@@ -188,8 +284,15 @@ void udpOpen() {
       i_mtu = strtol( ARG_OPTION("mtu="), NULL, 0 );
     else if (IS_OPTION("ifindex=") )
      i_if_index = strtol( ARG_OPTION("ifindex="), NULL, 0 );
+    else if (IS_OPTION("batch="))
+      i_recv_batch = strtol (ARG_OPTION("batch="), NULL, 0);
     }
 
+  if (i_recv_batch > MAX_RECV_BATCH)
+    i_recv_batch = MAX_RECV_BATCH;
+  else if (i_recv_batch < 1)
+    i_recv_batch = 1;
+
   if (!i_mtu)
     i_mtu = i_family == AF_INET6 ? DEFAULT_IPV6_MTU : DEFAULT_IPV4_MTU;
   i_block_cnt = (i_mtu - (b_udp ? 0 : RTP_HEADER_SIZE)) / TS_SIZE;
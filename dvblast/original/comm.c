@@ -31,6 +31,7 @@
 #include "dvblast.h"
 #include "en50221.h"
 #include "comm.h"
+#include "metrics.h"
 
 /*****************************************************************************
  * Local declarations
@@ -266,6 +267,33 @@ static void comm_Read(struct ev_loop *loop, struct ev_io *w, int revents)
         break;
     }
 
+    case CMD_GET_PSI_CACHE:
+    {
+        i_answer = RET_PSI_CACHE;
+        i_answer_size = sizeof(psi_cache_info_t);
+        demux_get_PSI_cache_info( p_output );
+        break;
+    }
+
+    case CMD_GET_METRICS:
+    {
+        i_answer = RET_METRICS;
+        i_answer_size = sizeof(metrics_snapshot_t);
+        demux_get_metrics( p_output );
+        break;
+    }
+
+    case CMD_GET_OUTPUT_LATENCY:
+    {
+        size_t i_latency_size;
+
+        i_answer = RET_OUTPUT_LATENCY;
+        outputs_GetLatency( p_output, COMM_BUFFER_SIZE - COMM_HEADER_SIZE,
+                            &i_latency_size );
+        i_answer_size = i_latency_size;
+        break;
+    }
+
     case CMD_GET_PID:
     {
         if ( i_size < COMM_HEADER_SIZE + 2 )
@@ -49,6 +49,9 @@ typedef enum {
     CMD_MMI_SEND_CHOICE     = 18, /* arg: slot, en50221_mmi_object_t */
     CMD_GET_EIT_PF          = 19, /* arg: service_id (uint16_t) */
     CMD_GET_EIT_SCHEDULE    = 20, /* arg: service_id (uint16_t) */
+    CMD_GET_PSI_CACHE       = 21,
+    CMD_GET_METRICS         = 22,
+    CMD_GET_OUTPUT_LATENCY  = 23,
 } ctl_cmd_t;
 
 typedef enum {
@@ -69,6 +72,9 @@ typedef enum {
     RET_PID                 = 14,
     RET_EIT_PF              = 15,
     RET_EIT_SCHEDULE        = 16,
+    RET_PSI_CACHE           = 17,
+    RET_METRICS             = 18,
+    RET_OUTPUT_LATENCY      = 19,
     RET_HUH                 = 255,
 } ctl_cmd_answer_t;
 
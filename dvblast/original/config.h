@@ -29,6 +29,8 @@
 #define HAVE_DVB_SUPPORT
 #define HAVE_ASI_SUPPORT
 #define HAVE_CLOCK_NANOSLEEP
+#define HAVE_SENDMMSG
+#define HAVE_RECVMMSG
 #endif
 
 #define HAVE_ICONV
@@ -49,6 +51,9 @@
 #define DEFAULT_MAX_RETENTION 40000 /* 40 ms */
 #define MAX_EIT_RETENTION 500000 /* 500 ms */
 #define DEFAULT_FRONTEND_TIMEOUT 30000000 /* 30 s */
+#define DVR_RING_SIZE 256 /* reads queued between capture and demux threads */
+#define DEFAULT_SHM_SLOTS 32768 /* packets in a shared memory output ring */
+#define DEFAULT_SEGMENT_DURATION 60000000 /* 60 s, recorder outputs */
 #define EXIT_STATUS_FRONTEND_TIMEOUT 100
 
 // Compatability defines
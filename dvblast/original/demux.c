@@ -28,6 +28,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
+#include <float.h>
 #include <stdarg.h>
 #include <inttypes.h>
 #include <sys/socket.h>
@@ -38,6 +39,8 @@
 #include "dvblast.h"
 #include "en50221.h"
 #include "mrtg-cnt.h"
+#include "ts-batch.h"
+#include "metrics.h"
 
 #ifdef HAVE_ICONV
 #include <iconv.h>
@@ -55,6 +58,14 @@
  *****************************************************************************/
 #define MIN_SECTION_FRAGMENT    PSI_HEADER_SIZE_SYNTAX1
 
+#define PCR_WRAP            ((UINT64_C(1) << 33) * 300)
+#define PCR_CLOCK_SAMPLES   64      /* buckets in the regression window */
+#define PCR_CLOCK_BUCKET    1000000 /* us of PCR per bucket */
+#define PCR_CLOCK_MIN_SPAN  4000000 /* us of PCR before the drift is fitted */
+#define PCR_CLOCK_MAX_DRIFT 0.0005  /* 500 ppm, steeper fits are clamped */
+#define PCR_CLOCK_MAX_GAP   1000000 /* larger steps are discontinuities */
+#define PCR_CLOCK_SLEW      100     /* us the clock may move back per PCR */
+
 typedef struct ts_pid_t
 {
     int i_refcount;
@@ -75,8 +86,9 @@ typedef struct ts_pid_t
     uint8_t *p_psi_buffer;
     uint16_t i_psi_buffer_used;
 
+    /* outputs wanting this PID, without holes */
     output_t **pp_outputs;
-    int i_nb_outputs;
+    int i_nb_outputs, i_max_outputs;
 
     int i_pes_status; /* pes + unscrambled */
     struct ev_timer timeout_watcher;
@@ -97,7 +109,28 @@ typedef struct sid_t
     struct eit_sections eit_table[MAX_EIT_TABLES];
 } sid_t;
 
+/* maps the PCRs of the reference PID to local time; x is the PCR in us
+ * since the lock and y the arrival time in us since i_base. Each bucket
+ * keeps its latest arrival relative to the PCR, as the input delay only
+ * ever adds to the send time. */
+typedef struct pcr_clock_t
+{
+    bool b_locked;
+    uint64_t i_last_pcr;            /* 27 MHz, as received */
+    uint64_t i_packet, i_last_packet;
+    double f_ticks_per_packet;      /* 27 MHz ticks between two packets */
+    mtime_t i_base;
+    double f_last_x;
+    double pf_x[PCR_CLOCK_SAMPLES], pf_y[PCR_CLOCK_SAMPLES];
+    int i_first, i_nb_samples;      /* the last bucket is still open */
+    double f_x, f_y, f_slope;       /* the line goes through (f_x, f_y) */
+    double f_jitter;                /* spread of the arrivals around it */
+    mtime_t i_last_stamp;
+    uint64_t i_resets;
+} pcr_clock_t;
+
 mtime_t i_wallclock = 0;
+int i_pcr_clock_pid = -1;
 
 static ts_pid_t p_pids[MAX_PIDS];
 static sid_t **pp_sids = NULL;
@@ -113,14 +146,15 @@ static PSI_TABLE_DECLARE(pp_current_sdt_sections);
 static PSI_TABLE_DECLARE(pp_next_sdt_sections);
 static mtime_t i_last_dts = -1;
 static int i_demux_fd;
-static uint64_t i_nb_packets = 0;
-static uint64_t i_nb_invalids = 0;
-static uint64_t i_nb_discontinuities = 0;
-static uint64_t i_nb_errors = 0;
+static uint64_t pi_print_metrics[METRIC_COUNT];
 static int i_tuner_errors = 0;
 static mtime_t i_last_error = 0;
 static mtime_t i_last_reset = 0;
 static struct ev_timer print_watcher;
+static ts_batch_t batch;
+static output_t **pp_passthrough = NULL;
+static int i_nb_passthrough = 0;
+static pcr_clock_t pcr_clock;
 
 #ifdef HAVE_ICONV
 static iconv_t iconv_handle = (iconv_t)-1;
@@ -129,13 +163,16 @@ static iconv_t iconv_handle = (iconv_t)-1;
 /*****************************************************************************
  * Local prototypes
  *****************************************************************************/
-static void demux_Handle( block_t *p_ts );
-static void SetDTS( block_t *p_list );
+static void demux_Handle( block_t *p_ts, uint16_t i_pid, uint8_t i_cc,
+                          uint8_t i_flags );
+static void SetDTS( block_t *p_list, mtime_t i_end );
+static void PCRClockStamp( const ts_batch_t *p_batch );
 static void SetPID( uint16_t i_pid );
 static void SetPID_EMM( uint16_t i_pid );
 static void UnsetPID( uint16_t i_pid );
 static void StartPID( output_t *p_output, uint16_t i_pid );
 static void StopPID( output_t *p_output, uint16_t i_pid );
+static void SetPassthrough( output_t *p_output, bool b_passthrough );
 static void SelectPID( uint16_t i_sid, uint16_t i_pid, bool b_pcr );
 static void UnselectPID( uint16_t i_sid, uint16_t i_pid );
 static void SelectPMT( uint16_t i_sid, uint16_t i_pid );
@@ -269,7 +306,24 @@ static inline sid_t *FindSID( uint16_t i_sid )
  *****************************************************************************/
 static void PrintCb( struct ev_loop *loop, struct ev_timer *w, int revents )
 {
-    uint64_t i_bitrate = i_nb_packets * TS_SIZE * 8 * 1000000 / i_print_period;
+    uint64_t pi_metrics[METRIC_COUNT];
+    uint64_t i_nb_packets, i_nb_invalids, i_nb_discontinuities, i_nb_errors;
+    uint64_t i_bitrate;
+    unsigned int i_blocks_used, i_blocks_max_used, i_blocks_total;
+
+    /* the registry counts since startup, print what changed in the period */
+    metrics_ReadCounters( pi_metrics );
+    i_nb_packets = pi_metrics[METRIC_TS_PACKETS]
+                    - pi_print_metrics[METRIC_TS_PACKETS];
+    i_nb_invalids = pi_metrics[METRIC_TS_INVALIDS]
+                     - pi_print_metrics[METRIC_TS_INVALIDS];
+    i_nb_discontinuities = pi_metrics[METRIC_TS_DISCONTINUITIES]
+                            - pi_print_metrics[METRIC_TS_DISCONTINUITIES];
+    i_nb_errors = pi_metrics[METRIC_TS_ERRORS]
+                   - pi_print_metrics[METRIC_TS_ERRORS];
+    memcpy( pi_print_metrics, pi_metrics, sizeof(pi_metrics) );
+
+    i_bitrate = i_nb_packets * TS_SIZE * 8 * 1000000 / i_print_period;
     switch (i_print_type)
     {
         case PRINT_XML:
@@ -283,7 +337,6 @@ static void PrintCb( struct ev_loop *loop, struct ev_timer *w, int revents )
         default:
             break;
     }
-    i_nb_packets = 0;
 
     if ( i_nb_invalids )
     {
@@ -300,7 +353,6 @@ static void PrintCb( struct ev_loop *loop, struct ev_timer *w, int revents )
             default:
                 break;
         }
-        i_nb_invalids = 0;
     }
 
     if ( i_nb_discontinuities )
@@ -319,7 +371,6 @@ static void PrintCb( struct ev_loop *loop, struct ev_timer *w, int revents )
             default:
                 break;
         }
-        i_nb_discontinuities = 0;
     }
 
     if ( i_nb_errors )
@@ -337,7 +388,44 @@ static void PrintCb( struct ev_loop *loop, struct ev_timer *w, int revents )
             default:
                 break;
         }
-        i_nb_errors = 0;
+    }
+
+    if ( i_pcr_clock_pid != -1 )
+    {
+        int i_drift = pcr_clock.b_locked ?
+                      (pcr_clock.f_slope - 1.) * 1000000. : 0;
+        switch (i_print_type)
+        {
+            case PRINT_XML:
+                fprintf(print_fh,
+                        "<STATUS type=\"pcr_clock\" pid=\"%d\" locked=\"%d\" drift_ppm=\"%d\" jitter=\"%d\" resets=\"%"PRIu64"\" />\n",
+                        i_pcr_clock_pid, pcr_clock.b_locked ? 1 : 0, i_drift,
+                        (int)pcr_clock.f_jitter, pcr_clock.i_resets);
+                break;
+            case PRINT_TEXT:
+                fprintf(print_fh, "pcr clock pid: %d locked: %d drift: %d ppm jitter: %d us resets: %"PRIu64"\n",
+                        i_pcr_clock_pid, pcr_clock.b_locked ? 1 : 0, i_drift,
+                        (int)pcr_clock.f_jitter, pcr_clock.i_resets);
+                break;
+            default:
+                break;
+        }
+    }
+
+    block_GetStats( &i_blocks_used, &i_blocks_max_used, &i_blocks_total );
+    switch (i_print_type)
+    {
+        case PRINT_XML:
+            fprintf(print_fh,
+                    "<STATUS type=\"blocks\" used=\"%u\" max_used=\"%u\" total=\"%u\" />\n",
+                    i_blocks_used, i_blocks_max_used, i_blocks_total);
+            break;
+        case PRINT_TEXT:
+            fprintf(print_fh, "blocks used: %u max_used: %u total: %u\n",
+                    i_blocks_used, i_blocks_max_used, i_blocks_total);
+            break;
+        default:
+            break;
     }
 }
 
@@ -394,6 +482,7 @@ void demux_Open( void )
     memset( p_pids, 0, sizeof(p_pids) );
 
     pf_Open();
+    tsbatch_Init();
 
     for ( i = 0; i < MAX_PIDS; i++ )
     {
@@ -435,6 +524,9 @@ void demux_Open( void )
 
     SetPID(TDT_PID);
 
+    if ( i_pcr_clock_pid != -1 )
+        SetPID(i_pcr_clock_pid);
+
     if ( i_print_period )
     {
         ev_timer_init( &print_watcher, PrintCb,
@@ -465,6 +557,7 @@ void demux_Close( void )
         free( p_pids[i].p_psi_buffer );
         free( p_pids[i].pp_outputs );
     }
+    free( pp_passthrough );
 
     for ( i = 0; i < i_nb_sids; i++ )
     {
@@ -493,41 +586,59 @@ void demux_Close( void )
  *****************************************************************************/
 void demux_Run( block_t *p_ts )
 {
+    demux_RunCaptured( p_ts, -1 );
+}
+
+/*****************************************************************************
+ * demux_RunCaptured: i_capture is when the chain was read, -1 for now
+ *****************************************************************************/
+void demux_RunCaptured( block_t *p_ts, mtime_t i_capture )
+{
+    unsigned int i_nb_packets = 0;
+
     i_wallclock = mdate();
-    mrtgAnalyse( p_ts );
-    SetDTS( p_ts );
+    SetDTS( p_ts, i_capture != -1 ? i_capture : i_wallclock );
 
     while ( p_ts != NULL )
     {
-        block_t *p_next = p_ts->p_next;
-        p_ts->p_next = NULL;
-        demux_Handle( p_ts );
-        p_ts = p_next;
+        unsigned int i;
+
+        p_ts = tsbatch_Fill( &batch, p_ts );
+        tsbatch_Parse( &batch );
+        mrtgAnalyse( &batch );
+        if ( i_pcr_clock_pid != -1 )
+            PCRClockStamp( &batch );
+        i_nb_packets += batch.i_size;
+
+        for ( i = 0; i < batch.i_size; i++ )
+            demux_Handle( batch.pp_blocks[i], batch.pi_pid[i],
+                          batch.pi_cc[i], batch.pi_flags[i] );
     }
+
+    metrics_Add( METRIC_TS_PACKETS, i_nb_packets );
+    metrics_Observe( HISTOGRAM_INPUT_BATCH, i_nb_packets );
 }
 
 /*****************************************************************************
  * demux_Handle
  *****************************************************************************/
-static void demux_Handle( block_t *p_ts )
+static void demux_Handle( block_t *p_ts, uint16_t i_pid, uint8_t i_cc,
+                          uint8_t i_flags )
 {
-    uint16_t i_pid = ts_get_pid( p_ts->p_ts );
     ts_pid_t *p_pid = &p_pids[i_pid];
-    uint8_t i_cc = ts_get_cc( p_ts->p_ts );
+    bool b_pcr;
     int i;
 
-    i_nb_packets++;
-
-    if ( !ts_validate( p_ts->p_ts ) )
+    if ( i_flags & TS_BATCH_INVALID )
     {
         msg_Warn( NULL, "lost TS sync" );
         block_Delete( p_ts );
-        i_nb_invalids++;
+        metrics_Add( METRIC_TS_INVALIDS, 1 );
         return;
     }
 
     if ( i_pid != PADDING_PID )
-        p_pid->info.i_scrambling = ts_get_scrambling( p_ts->p_ts );
+        p_pid->info.i_scrambling = (i_flags & TS_BATCH_SCRAMBLING) >> 6;
 
     p_pid->info.i_last_packet_ts = i_wallclock;
     p_pid->info.i_packets++;
@@ -553,13 +664,13 @@ static void demux_Handle( block_t *p_ts )
         const char *pid_desc = get_pid_desc(i_pid, &i_sid);
 
         p_pid->info.i_cc_errors++;
-        i_nb_discontinuities++;
+        metrics_Add( METRIC_TS_DISCONTINUITIES, 1 );
 
         msg_Warn( NULL, "TS discontinuity on pid %4hu expected_cc %2u got %2u (%s, sid %d)",
                 i_pid, expected_cc, i_cc, pid_desc, i_sid );
     }
 
-    if ( ts_get_transporterror( p_ts->p_ts ) )
+    if ( i_flags & TS_BATCH_TEI )
     {
         uint16_t i_sid = 0;
         const char *pid_desc = get_pid_desc(i_pid, &i_sid);
@@ -569,7 +680,7 @@ static void demux_Handle( block_t *p_ts )
         msg_Warn( NULL, "transport_error_indicator on pid %hu (%s, sid %u)",
                    i_pid, pid_desc, i_sid );
 
-        i_nb_errors++;
+        metrics_Add( METRIC_TS_ERRORS, 1 );
         i_tuner_errors++;
         i_last_error = i_wallclock;
     }
@@ -597,9 +708,9 @@ static void demux_Handle( block_t *p_ts )
     if ( i_es_timeout )
     {
         int i_pes_status = -1;
-        if ( ts_get_scrambling( p_ts->p_ts ) )
+        if ( i_flags & TS_BATCH_SCRAMBLING )
             i_pes_status = 0;
-        else if ( ts_get_unitstart( p_ts->p_ts ) )
+        else if ( i_flags & TS_BATCH_UNITSTART )
         {
             uint8_t *p_payload = ts_payload( p_ts->p_ts );
             if ( p_payload + 3 < p_ts->p_ts + TS_SIZE )
@@ -639,7 +750,7 @@ static void demux_Handle( block_t *p_ts )
         }
     }
 
-    if ( !ts_get_transporterror( p_ts->p_ts ) )
+    if ( !(i_flags & TS_BATCH_TEI) )
     {
         /* PSI parsing */
         if ( i_pid == TDT_PID || i_pid == RST_PID )
@@ -654,79 +765,74 @@ static void demux_Handle( block_t *p_ts )
     p_pid->i_last_cc = i_cc;
 
     /* Output */
+    b_pcr = p_pid->i_nb_outputs && ts_has_adaptation( p_ts->p_ts )
+             && ts_get_adaptation( p_ts->p_ts ) && tsaf_has_pcr( p_ts->p_ts );
+
     for ( i = 0; i < p_pid->i_nb_outputs; i++ )
     {
         output_t *p_output = p_pid->pp_outputs[i];
-        if ( p_output != NULL )
+
+        if ( i_ca_handle && (p_output->config.i_config & OUTPUT_WATCH) &&
+             (i_flags & TS_BATCH_UNITSTART) )
         {
-            if ( i_ca_handle && (p_output->config.i_config & OUTPUT_WATCH) &&
-                 ts_get_unitstart( p_ts->p_ts ) )
-            {
-                uint8_t *p_payload;
+            uint8_t *p_payload;
 
-                if ( ts_get_scrambling( p_ts->p_ts ) ||
-                     ( p_pid->b_pes
-                        && (p_payload = ts_payload( p_ts->p_ts )) + 3
-                             < p_ts->p_ts + TS_SIZE
-                          && !pes_validate(p_payload) ) )
+            if ( (i_flags & TS_BATCH_SCRAMBLING) ||
+                 ( p_pid->b_pes
+                    && (p_payload = ts_payload( p_ts->p_ts )) + 3
+                         < p_ts->p_ts + TS_SIZE
+                      && !pes_validate(p_payload) ) )
+            {
+                if ( i_wallclock >
+                        i_last_reset + WATCHDOG_REFRACTORY_PERIOD )
                 {
-                    if ( i_wallclock >
-                            i_last_reset + WATCHDOG_REFRACTORY_PERIOD )
-                    {
-                        p_output->i_nb_errors++;
-                        p_output->i_last_error = i_wallclock;
-                    }
+                    p_output->i_nb_errors++;
+                    p_output->i_last_error = i_wallclock;
                 }
-                else if ( i_wallclock > p_output->i_last_error + WATCHDOG_WAIT )
-                    p_output->i_nb_errors = 0;
+            }
+            else if ( i_wallclock > p_output->i_last_error + WATCHDOG_WAIT )
+                p_output->i_nb_errors = 0;
 
-                if ( p_output->i_nb_errors > MAX_ERRORS )
-                {
-                    int j;
-                    for ( j = 0; j < i_nb_outputs; j++ )
-                        pp_outputs[j]->i_nb_errors = 0;
+            if ( p_output->i_nb_errors > MAX_ERRORS )
+            {
+                int j;
+                for ( j = 0; j < i_nb_outputs; j++ )
+                    pp_outputs[j]->i_nb_errors = 0;
 
-                    msg_Warn( NULL,
-                             "too many errors for stream %s, resetting",
-                             p_output->config.psz_displayname );
-
-                    switch (i_print_type) {
-                    case PRINT_XML:
-                        fprintf(print_fh, "<EVENT type=\"reset\" cause=\"scrambling\" />\n");
-                        break;
-                    case PRINT_TEXT:
-                        fprintf(print_fh, "reset cause: scrambling");
-                        break;
-                    default:
-                        break;
-                    }
-                    i_last_reset = i_wallclock;
-                    en50221_Reset();
+                msg_Warn( NULL,
+                         "too many errors for stream %s, resetting",
+                         p_output->config.psz_displayname );
+
+                switch (i_print_type) {
+                case PRINT_XML:
+                    fprintf(print_fh, "<EVENT type=\"reset\" cause=\"scrambling\" />\n");
+                    break;
+                case PRINT_TEXT:
+                    fprintf(print_fh, "reset cause: scrambling");
+                    break;
+                default:
+                    break;
                 }
+                i_last_reset = i_wallclock;
+                en50221_Reset();
             }
+        }
 
-            if ( p_output->i_pcr_pid != i_pid
-                  || (ts_has_adaptation(p_ts->p_ts)
-                       && ts_get_adaptation(p_ts->p_ts)
-                       && tsaf_has_pcr(p_ts->p_ts)) )
-                output_Put( p_output, p_ts );
+        if ( p_output->i_pcr_pid != i_pid || b_pcr )
+            output_Put( p_output, p_ts );
 
-            if ( p_output->p_eit_ts_buffer != NULL
-                  && p_ts->i_dts > p_output->p_eit_ts_buffer->i_dts
-                                    + MAX_EIT_RETENTION )
-                FlushEIT( p_output, p_ts->i_dts );
-        }
+        if ( p_output->p_eit_ts_buffer != NULL
+              && p_ts->i_dts > p_output->p_eit_ts_buffer->i_dts
+                                + MAX_EIT_RETENTION )
+            FlushEIT( p_output, p_ts->i_dts );
     }
 
-    for ( i = 0; i < i_nb_outputs; i++ )
+    for ( i = 0; i < i_nb_passthrough; i++ )
     {
-        output_t *p_output = pp_outputs[i];
+        output_t *p_output = pp_passthrough[i];
 
-        if ( !(p_output->config.i_config & OUTPUT_VALID) ||
-             !p_output->config.b_passthrough )
-            continue;
-
-        output_Put( p_output, p_ts );
+        if ( p_output->config.i_config & OUTPUT_VALID )
+            output_Put( p_output, p_ts );
     }
 
     if ( output_dup.config.i_config & OUTPUT_VALID )
@@ -905,6 +1011,8 @@ void demux_Change( output_t *p_output, const output_config_t *p_config )
             en50221_UpdatePMT( p_sid->p_current_pmt );
     }
 
+    if ( p_output->config.b_passthrough != p_config->b_passthrough )
+        SetPassthrough( p_output, p_config->b_passthrough );
     p_output->config.b_passthrough = p_config->b_passthrough;
     p_output->config.i_sid = i_sid;
     free( p_output->config.pi_pids );
@@ -960,7 +1068,7 @@ out_change:
 /*****************************************************************************
  * SetDTS
  *****************************************************************************/
-static void SetDTS( block_t *p_list )
+static void SetDTS( block_t *p_list, mtime_t i_end )
 {
     int i_nb_ts = 0, i;
     mtime_t i_duration;
@@ -977,18 +1085,220 @@ static void SetDTS( block_t *p_list )
     if ( i_last_dts == -1 )
         i_duration = 0;
     else
-        i_duration = i_wallclock - i_last_dts;
+        i_duration = i_end - i_last_dts;
 
     p_ts = p_list;
     i = i_nb_ts - 1;
     while ( p_ts != NULL )
     {
-        p_ts->i_dts = i_wallclock - i_duration * i / i_nb_ts;
+        p_ts->i_dts = i_end - i_duration * i / i_nb_ts;
         i--;
         p_ts = p_ts->p_next;
     }
 
-    i_last_dts = i_wallclock;
+    i_last_dts = i_end;
+}
+
+/*****************************************************************************
+ * PCRClockReset: back to the arrival time until the next PCR
+ *****************************************************************************/
+static void PCRClockReset( void )
+{
+    if ( pcr_clock.b_locked )
+    {
+        msg_Dbg( NULL, "PCR clock on pid %d unlocked", i_pcr_clock_pid );
+        pcr_clock.i_resets++;
+    }
+    pcr_clock.b_locked = false;
+    pcr_clock.i_last_stamp = 0;
+}
+
+/*****************************************************************************
+ * PCRClockFit: least squares slope over the buckets, clamped to a sane
+ * drift, then the line is moved up to the latest arrival so that packets
+ * are never stamped before they were received. It only moves back slowly,
+ * otherwise a late burst leaving the window would make the outputs burst.
+ *****************************************************************************/
+static void PCRClockFit( void )
+{
+    double f_mx = 0, f_my = 0, f_sxx = 0, f_sxy = 0;
+    double f_x = pcr_clock.f_last_x, f_y, f_span;
+    double f_max = -DBL_MAX, f_min = DBL_MAX;
+    int i, i_last = (pcr_clock.i_first + pcr_clock.i_nb_samples - 1)
+                     % PCR_CLOCK_SAMPLES;
+
+    for ( i = 0; i < pcr_clock.i_nb_samples; i++ )
+    {
+        int j = (pcr_clock.i_first + i) % PCR_CLOCK_SAMPLES;
+        f_mx += pcr_clock.pf_x[j];
+        f_my += pcr_clock.pf_y[j];
+    }
+    f_mx /= pcr_clock.i_nb_samples;
+    f_my /= pcr_clock.i_nb_samples;
+
+    for ( i = 0; i < pcr_clock.i_nb_samples; i++ )
+    {
+        int j = (pcr_clock.i_first + i) % PCR_CLOCK_SAMPLES;
+        f_sxx += (pcr_clock.pf_x[j] - f_mx) * (pcr_clock.pf_x[j] - f_mx);
+        f_sxy += (pcr_clock.pf_x[j] - f_mx) * (pcr_clock.pf_y[j] - f_my);
+    }
+
+    f_span = pcr_clock.pf_x[i_last] - pcr_clock.pf_x[pcr_clock.i_first];
+    if ( f_span >= PCR_CLOCK_MIN_SPAN && f_sxx > 0 )
+    {
+        pcr_clock.f_slope = f_sxy / f_sxx;
+        if ( pcr_clock.f_slope > 1. + PCR_CLOCK_MAX_DRIFT )
+            pcr_clock.f_slope = 1. + PCR_CLOCK_MAX_DRIFT;
+        else if ( pcr_clock.f_slope < 1. - PCR_CLOCK_MAX_DRIFT )
+            pcr_clock.f_slope = 1. - PCR_CLOCK_MAX_DRIFT;
+    }
+
+    for ( i = 0; i < pcr_clock.i_nb_samples; i++ )
+    {
+        int j = (pcr_clock.i_first + i) % PCR_CLOCK_SAMPLES;
+        double f_late = pcr_clock.pf_y[j]
+                         - pcr_clock.f_slope * (pcr_clock.pf_x[j] - f_x);
+        if ( f_late > f_max )
+            f_max = f_late;
+        if ( f_late < f_min )
+            f_min = f_late;
+    }
+    pcr_clock.f_jitter = f_max - f_min;
+
+    /* where the previous line stands at the latest PCR */
+    f_y = pcr_clock.f_y + pcr_clock.f_slope * (f_x - pcr_clock.f_x);
+    if ( f_max < f_y - PCR_CLOCK_SLEW && pcr_clock.i_nb_samples > 1 )
+        f_y -= PCR_CLOCK_SLEW;
+    else
+        f_y = f_max;
+
+    pcr_clock.f_x = f_x;
+    pcr_clock.f_y = f_y;
+}
+
+/*****************************************************************************
+ * PCRClockSample: i_arrival is the interpolated arrival time of the packet
+ *****************************************************************************/
+static void PCRClockSample( uint64_t i_pcr, mtime_t i_arrival )
+{
+    int i_last = (pcr_clock.i_first + pcr_clock.i_nb_samples - 1)
+                  % PCR_CLOCK_SAMPLES;
+    uint64_t i_delta, i_packets;
+    double f_x, f_y, f_late;
+
+    if ( !pcr_clock.b_locked )
+    {
+        pcr_clock.b_locked = true;
+        pcr_clock.i_base = i_arrival;
+        pcr_clock.i_first = 0;
+        pcr_clock.i_nb_samples = 1;
+        pcr_clock.pf_x[0] = pcr_clock.pf_y[0] = 0;
+        pcr_clock.f_last_x = pcr_clock.f_x = pcr_clock.f_y = 0;
+        pcr_clock.f_slope = 1.;
+        pcr_clock.f_jitter = 0;
+        pcr_clock.f_ticks_per_packet = 0;
+        pcr_clock.i_last_pcr = i_pcr;
+        pcr_clock.i_last_packet = pcr_clock.i_packet;
+        return;
+    }
+
+    i_delta = (i_pcr + PCR_WRAP - pcr_clock.i_last_pcr) % PCR_WRAP;
+    i_packets = pcr_clock.i_packet - pcr_clock.i_last_packet;
+    f_x = pcr_clock.f_last_x + i_delta / 27.;
+    f_y = i_arrival - pcr_clock.i_base;
+
+    /* PCR jump, or the input stalled */
+    f_late = f_y - pcr_clock.f_y - pcr_clock.f_slope * (f_x - pcr_clock.f_x);
+    if ( i_delta > (uint64_t)PCR_CLOCK_MAX_GAP * 27 || !i_packets
+          || f_late > PCR_CLOCK_MAX_GAP || f_late < -PCR_CLOCK_MAX_GAP )
+    {
+        PCRClockReset();
+        PCRClockSample( i_pcr, i_arrival );
+        return;
+    }
+
+    if ( pcr_clock.f_ticks_per_packet )
+        pcr_clock.f_ticks_per_packet +=
+            ((double)i_delta / i_packets - pcr_clock.f_ticks_per_packet) / 8;
+    else
+        pcr_clock.f_ticks_per_packet = (double)i_delta / i_packets;
+
+    if ( f_x - pcr_clock.pf_x[i_last] >= PCR_CLOCK_BUCKET )
+    {
+        /* open a new bucket */
+        if ( pcr_clock.i_nb_samples == PCR_CLOCK_SAMPLES )
+        {
+            pcr_clock.i_first = (pcr_clock.i_first + 1) % PCR_CLOCK_SAMPLES;
+            pcr_clock.i_nb_samples--;
+        }
+        i_last = (pcr_clock.i_first + pcr_clock.i_nb_samples)
+                  % PCR_CLOCK_SAMPLES;
+        pcr_clock.pf_x[i_last] = f_x;
+        pcr_clock.pf_y[i_last] = f_y;
+        pcr_clock.i_nb_samples++;
+    }
+    else if ( f_y - f_x > pcr_clock.pf_y[i_last] - pcr_clock.pf_x[i_last] )
+    {
+        pcr_clock.pf_x[i_last] = f_x;
+        pcr_clock.pf_y[i_last] = f_y;
+    }
+
+    pcr_clock.f_last_x = f_x;
+    pcr_clock.i_last_pcr = i_pcr;
+    pcr_clock.i_last_packet = pcr_clock.i_packet;
+
+    PCRClockFit();
+}
+
+/*****************************************************************************
+ * PCRClockStamp: replaces the interpolated arrival times with the PCR of
+ * each packet, extrapolated from the last PCR at the measured packet rate,
+ * mapped to local time; the headers were decoded by tsbatch_Parse(), only
+ * the adaptation fields of the PCR PID are read
+ *****************************************************************************/
+static void PCRClockStamp( const ts_batch_t *p_batch )
+{
+    unsigned int i;
+
+    for ( i = 0; i < p_batch->i_size; i++ )
+    {
+        block_t *p_ts = p_batch->pp_blocks[i];
+        uint8_t *p = p_ts->p_ts;
+        mtime_t i_dts;
+        double f_x;
+
+        pcr_clock.i_packet++;
+
+        if ( p_batch->pi_pid[i] == i_pcr_clock_pid
+              && (p_batch->pi_flags[i]
+                   & (TS_BATCH_INVALID | TS_BATCH_ADAPTATION))
+                  == TS_BATCH_ADAPTATION
+              && ts_get_adaptation( p ) && tsaf_has_pcr( p ) )
+            PCRClockSample( tsaf_get_pcr( p ) * 300 + tsaf_get_pcrext( p ),
+                            p_ts->i_dts );
+
+        /* keep the arrival time until the packet rate is known */
+        if ( !pcr_clock.b_locked || !pcr_clock.f_ticks_per_packet )
+            continue;
+
+        f_x = pcr_clock.f_last_x
+               + (pcr_clock.i_packet - pcr_clock.i_last_packet)
+                  * pcr_clock.f_ticks_per_packet / 27.;
+        i_dts = pcr_clock.i_base + pcr_clock.f_y
+                 + pcr_clock.f_slope * (f_x - pcr_clock.f_x);
+
+        if ( i_dts > i_wallclock + PCR_CLOCK_MAX_GAP
+              || i_dts < i_wallclock - PCR_CLOCK_MAX_GAP )
+        {
+            /* extrapolated too far, the PID probably went away */
+            PCRClockReset();
+            continue;
+        }
+
+        if ( i_dts < pcr_clock.i_last_stamp )
+            i_dts = pcr_clock.i_last_stamp;
+        p_ts->i_dts = pcr_clock.i_last_stamp = i_dts;
+    }
 }
 
 /*****************************************************************************
@@ -1027,49 +1337,63 @@ static void UnsetPID( uint16_t i_pid )
  *****************************************************************************/
 static void StartPID( output_t *p_output, uint16_t i_pid )
 {
+    ts_pid_t *p_pid = &p_pids[i_pid];
     int j;
 
-    for ( j = 0; j < p_pids[i_pid].i_nb_outputs; j++ )
-        if ( p_pids[i_pid].pp_outputs[j] == p_output )
-            break;
+    for ( j = 0; j < p_pid->i_nb_outputs; j++ )
+        if ( p_pid->pp_outputs[j] == p_output )
+            return;
 
-    if ( j == p_pids[i_pid].i_nb_outputs )
+    if ( p_pid->i_nb_outputs == p_pid->i_max_outputs )
     {
-        for ( j = 0; j < p_pids[i_pid].i_nb_outputs; j++ )
-            if ( p_pids[i_pid].pp_outputs[j] == NULL )
-                break;
-
-        if ( j == p_pids[i_pid].i_nb_outputs )
-        {
-            p_pids[i_pid].i_nb_outputs++;
-            p_pids[i_pid].pp_outputs = realloc( p_pids[i_pid].pp_outputs,
-                                                sizeof(output_t *)
-                                                * p_pids[i_pid].i_nb_outputs );
-        }
-
-        p_pids[i_pid].pp_outputs[j] = p_output;
-        SetPID( i_pid );
+        p_pid->i_max_outputs = p_pid->i_max_outputs ?
+                               p_pid->i_max_outputs * 2 : 4;
+        p_pid->pp_outputs = realloc( p_pid->pp_outputs,
+                                     sizeof(output_t *)
+                                     * p_pid->i_max_outputs );
     }
+
+    p_pid->pp_outputs[p_pid->i_nb_outputs++] = p_output;
+    SetPID( i_pid );
 }
 
 static void StopPID( output_t *p_output, uint16_t i_pid )
 {
+    ts_pid_t *p_pid = &p_pids[i_pid];
     int j;
 
-    for ( j = 0; j < p_pids[i_pid].i_nb_outputs; j++ )
+    for ( j = 0; j < p_pid->i_nb_outputs; j++ )
+        if ( p_pid->pp_outputs[j] == p_output )
+            break;
+
+    if ( j != p_pid->i_nb_outputs )
     {
-        if ( p_pids[i_pid].pp_outputs[j] != NULL )
-        {
-            if ( p_pids[i_pid].pp_outputs[j] == p_output )
-                break;
-        }
+        /* the order of the outputs does not matter, fill the hole with
+         * the last one */
+        p_pid->pp_outputs[j] = p_pid->pp_outputs[--p_pid->i_nb_outputs];
+        UnsetPID( i_pid );
     }
+}
+
+/*****************************************************************************
+ * SetPassthrough: maintains the list of outputs receiving all packets
+ *****************************************************************************/
+static void SetPassthrough( output_t *p_output, bool b_passthrough )
+{
+    int j;
 
-    if ( j != p_pids[i_pid].i_nb_outputs )
+    for ( j = 0; j < i_nb_passthrough; j++ )
+        if ( pp_passthrough[j] == p_output )
+            break;
+
+    if ( b_passthrough && j == i_nb_passthrough )
     {
-        p_pids[i_pid].pp_outputs[j] = NULL;
-        UnsetPID( i_pid );
+        pp_passthrough = realloc( pp_passthrough,
+                                  sizeof(output_t *) * ++i_nb_passthrough );
+        pp_passthrough[j] = p_output;
     }
+    else if ( !b_passthrough && j != i_nb_passthrough )
+        pp_passthrough[j] = pp_passthrough[--i_nb_passthrough];
 }
 
 /*****************************************************************************
@@ -3071,6 +3395,123 @@ out_eit:
         free( p_eit );
 }
 
+/*****************************************************************************
+ * FindCurrentSection: section of the current tables that p_section would
+ * replace, if any
+ *****************************************************************************/
+static uint8_t *FindCurrentSection( uint16_t i_pid, const uint8_t *p_section )
+{
+    uint8_t i_table_id = psi_get_tableid( p_section );
+    uint8_t i_section = psi_get_section( p_section );
+    sid_t *p_sid;
+
+    switch ( i_table_id )
+    {
+    case PAT_TABLE_ID:
+        return i_pid == PAT_PID ? pp_current_pat_sections[i_section] : NULL;
+
+    case CAT_TABLE_ID:
+        return i_pid == CAT_PID && b_enable_emm ?
+               pp_current_cat_sections[i_section] : NULL;
+
+    case PMT_TABLE_ID:
+        p_sid = FindSID( psi_get_tableidext( p_section ) );
+        return p_sid != NULL && p_sid->i_pmt_pid == i_pid ?
+               p_sid->p_current_pmt : NULL;
+
+    case NIT_TABLE_ID_ACTUAL:
+        return i_pid == NIT_PID ? pp_current_nit_sections[i_section] : NULL;
+
+    case SDT_TABLE_ID_ACTUAL:
+        return i_pid == SDT_PID ? pp_current_sdt_sections[i_section] : NULL;
+
+    default:
+        if ( i_pid != EIT_PID || !handle_epg( i_table_id )
+              || i_table_id - EIT_TABLE_ID_PF_ACTUAL >= MAX_EIT_TABLES )
+            return NULL;
+        p_sid = FindSID( psi_get_tableidext( p_section ) );
+        return p_sid != NULL ?
+          p_sid->eit_table[i_table_id - EIT_TABLE_ID_PF_ACTUAL].data[i_section]
+          : NULL;
+    }
+}
+
+/*****************************************************************************
+ * HandleRepeatedSection: the tables only ever hold validated sections, so a
+ * section whose header (table_id, extension, version, section numbers and
+ * length) and CRC match the one already stored is a repetition of it, and
+ * only has to trigger the same output as the shortcuts of the Handle*
+ * functions. Returns false if p_section must go through the full path.
+ *****************************************************************************/
+static bool HandleRepeatedSection( uint16_t i_pid, uint8_t *p_section,
+                                   mtime_t i_dts )
+{
+    uint8_t *p_current;
+    uint16_t i_crc_offset;
+
+    if ( !psi_get_syntax( p_section )
+          || psi_get_length( p_section ) < PSI_HEADER_SIZE_SYNTAX1
+                                            - PSI_HEADER_SIZE + PSI_CRC_SIZE )
+        return false;
+
+    p_current = FindCurrentSection( i_pid, p_section );
+    i_crc_offset = psi_get_length( p_section ) + PSI_HEADER_SIZE
+                    - PSI_CRC_SIZE;
+    if ( p_current == NULL
+          || memcmp( p_current, p_section, PSI_HEADER_SIZE_SYNTAX1 )
+          || memcmp( p_current + i_crc_offset, p_section + i_crc_offset,
+                     PSI_CRC_SIZE ) )
+    {
+        metrics_Add( METRIC_PSI_CACHE_MISSES, 1 );
+        return false;
+    }
+
+    metrics_Add( METRIC_PSI_CACHE_HITS, 1 );
+    free( p_section );
+
+    switch ( psi_get_tableid( p_current ) )
+    {
+    case PAT_TABLE_ID:
+        if ( psi_get_section( p_current ) == psi_get_lastsection( p_current ) )
+            SendPAT( i_dts );
+        break;
+
+    case CAT_TABLE_ID:
+        break;
+
+    case PMT_TABLE_ID:
+        SendPMT( FindSID( pmt_get_program( p_current ) ), i_dts );
+        break;
+
+    case NIT_TABLE_ID_ACTUAL:
+        SendNIT( i_dts );
+        break;
+
+    case SDT_TABLE_ID_ACTUAL:
+        if ( psi_get_section( p_current ) == psi_get_lastsection( p_current ) )
+            SendSDT( i_dts );
+        break;
+
+    default:
+        SendEIT( FindSID( eit_get_sid( p_current ) ), i_dts, p_current );
+        break;
+    }
+    return true;
+}
+
+/*****************************************************************************
+ * ValidateSection: same checks as psi_validate(), plus the CRC
+ *****************************************************************************/
+static bool ValidateSection( const uint8_t *p_section )
+{
+    if ( !psi_validate( p_section ) )
+        return false;
+
+    return !psi_get_syntax( p_section )
+        || !mpeg_crc32( p_section, psi_get_length( p_section )
+                                    + PSI_HEADER_SIZE );
+}
+
 /*****************************************************************************
  * HandleSection
  *****************************************************************************/
@@ -3078,7 +3519,10 @@ static void HandleSection( uint16_t i_pid, uint8_t *p_section, mtime_t i_dts )
 {
     uint8_t i_table_id = psi_get_tableid( p_section );
 
-    if ( !psi_validate( p_section ) )
+    if ( HandleRepeatedSection( i_pid, p_section, i_dts ) )
+        return;
+
+    if ( !ValidateSection( p_section ) )
     {
         msg_Warn( NULL, "invalid section on PID %hu", i_pid );
         switch (i_print_type) {
@@ -3436,3 +3880,16 @@ inline void demux_get_PIDS_info( uint8_t *p_data ) {
     for (i_pid = 0; i_pid < MAX_PIDS; i_pid++ )
         demux_get_PID_info( i_pid, p_data + ( i_pid * sizeof(ts_pid_info_t) ) );
 }
+
+void demux_get_PSI_cache_info( uint8_t *p_data ) {
+    psi_cache_info_t *p_info = (psi_cache_info_t *)p_data;
+    uint64_t pi_metrics[METRIC_COUNT];
+
+    metrics_ReadCounters( pi_metrics );
+    p_info->i_hits = pi_metrics[METRIC_PSI_CACHE_HITS];
+    p_info->i_misses = pi_metrics[METRIC_PSI_CACHE_MISSES];
+}
+
+void demux_get_metrics( uint8_t *p_data ) {
+    metrics_Snapshot( (metrics_snapshot_t *)p_data );
+}
@@ -40,6 +40,7 @@
 #include <arpa/inet.h>
 #include <poll.h>
 #include <errno.h>
+#include <pthread.h>
 
 /* DVB Card Drivers */
 #include <linux/dvb/version.h>
@@ -60,6 +61,7 @@
 #include "dvblast.h"
 #include "en50221.h"
 #include "comm.h"
+#include "ring.h"
 
 #include <bitstream/common.h>
 
@@ -69,19 +71,35 @@
 #define DVR_READ_TIMEOUT 30000000 /* 30 s */
 #define MAX_READ_ONCE 50
 #define DVR_BUFFER_SIZE 40*188*1024 /* bytes */
+#define DVR_POLL_TIMEOUT 100 /* ms */
+#define DVR_STARVED_WAIT 1000 /* us */
 
 int i_dvr_buffer_size = DVR_BUFFER_SIZE;
+bool b_dvr_thread = false;
+int i_dvr_ring_size = DVR_RING_SIZE;
 
 static int i_frontend, i_dvr;
 static struct ev_io frontend_watcher, dvr_watcher;
 static struct ev_timer lock_watcher, mute_watcher, print_watcher;
 static fe_status_t i_last_status;
 static block_t *p_freelist = NULL;
+static atomic_uint_fast64_t i_dvr_kernel_overflows;
+
+/* Threaded ingest: chains of filled blocks go from the capture thread to
+ * the demux through dvr_ring, empty blocks come back through free_ring. */
+static pthread_t dvr_thread;
+static ring_t dvr_ring, free_ring;
+static struct ev_async dvr_async;
+static atomic_uint_fast64_t i_dvr_starved;
+static atomic_bool b_dvr_stop;
 
 /*****************************************************************************
  * Local prototypes
  *****************************************************************************/
 static void DVRRead(struct ev_loop *loop, struct ev_io *w, int revents);
+static void DVRAsyncCb(struct ev_loop *loop, struct ev_async *w, int revents);
+static void *DVRThread( void *_unused );
+static void DVRRefill( void );
 static void DVRMuteCb(struct ev_loop *loop, struct ev_timer *w, int revents);
 static void FrontendRead(struct ev_loop *loop, struct ev_io *w, int revents);
 static void FrontendLockCb(struct ev_loop *loop, struct ev_timer *w, int revents);
@@ -128,8 +146,38 @@ void dvb_Open( void )
                  strerror(errno) );
     }
 
-    ev_io_init(&dvr_watcher, DVRRead, i_dvr, EV_READ);
-    ev_io_start(event_loop, &dvr_watcher);
+    if ( b_dvr_thread )
+    {
+        int i_error;
+
+        if ( !ring_Init( &dvr_ring, i_dvr_ring_size )
+              || !ring_Init( &free_ring,
+                             ring_Size( &dvr_ring ) * MAX_READ_ONCE ) )
+        {
+            msg_Err( NULL, "couldn't allocate DVR ring" );
+            exit(1);
+        }
+        DVRRefill();
+        atomic_init( &b_dvr_stop, false );
+
+        ev_async_init(&dvr_async, DVRAsyncCb);
+        ev_async_start(event_loop, &dvr_async);
+
+        if ( (i_error = pthread_create( &dvr_thread, NULL, DVRThread,
+                                        NULL )) )
+        {
+            msg_Err( NULL, "couldn't create DVR thread (%s)",
+                     strerror(i_error) );
+            exit(1);
+        }
+        msg_Dbg( NULL, "threaded DVR ingest, ring of %u reads",
+                 ring_Size( &dvr_ring ) );
+    }
+    else
+    {
+        ev_io_init(&dvr_watcher, DVRRead, i_dvr, EV_READ);
+        ev_io_start(event_loop, &dvr_watcher);
+    }
 
     if ( i_frontend != -1 )
     {
@@ -147,6 +195,31 @@ void dvb_Open( void )
     en50221_Init();
 }
 
+/*****************************************************************************
+ * dvb_Close: stop the capture thread before the blocks it reads into go away
+ *****************************************************************************/
+void dvb_Close( void )
+{
+    block_t *p_ts;
+    void *p_local;
+
+    if ( !b_dvr_thread )
+        return;
+
+    /* DVRThread notices within DVR_POLL_TIMEOUT */
+    atomic_store( &b_dvr_stop, true );
+    pthread_join( dvr_thread, &p_local );
+    block_DeleteChain( p_local );
+    ev_async_stop( event_loop, &dvr_async );
+
+    while ( (p_ts = ring_Pop( &dvr_ring )) != NULL )
+        block_DeleteChain( p_ts );
+    while ( (p_ts = ring_Pop( &free_ring )) != NULL )
+        block_Delete( p_ts );
+    ring_Clean( &dvr_ring );
+    ring_Clean( &free_ring );
+}
+
 /*****************************************************************************
  * dvb_Reset
  *****************************************************************************/
@@ -175,6 +248,8 @@ static void DVRRead(struct ev_loop *loop, struct ev_io *w, int revents)
 
     if ( (i_len = readv(i_dvr, p_iov, MAX_READ_ONCE)) < 0 )
     {
+        if ( errno == EOVERFLOW )
+            atomic_fetch_add( &i_dvr_kernel_overflows, 1 );
         msg_Err( NULL, "couldn't read from DVR device (%s)",
                  strerror(errno) );
         i_len = 0;
@@ -197,6 +272,121 @@ static void DVRRead(struct ev_loop *loop, struct ev_io *w, int revents)
     demux_Run( p_ts );
 }
 
+/*****************************************************************************
+ * DVRThread: capture side of the threaded mode, only reads and queues. Each
+ * chain carries the time it was read in the i_dts of its head block. The
+ * blocks the thread still holds are returned to dvb_Close.
+ *****************************************************************************/
+static void *DVRThread( void *_unused )
+{
+    struct pollfd pfd = { .fd = i_dvr, .events = POLLIN };
+    block_t *p_local = NULL;
+
+    while ( !atomic_load( &b_dvr_stop ) )
+    {
+        int i, i_len;
+        mtime_t i_capture;
+        block_t *p_ts, **pp_current = &p_local;
+        struct iovec p_iov[MAX_READ_ONCE];
+
+        if ( poll( &pfd, 1, DVR_POLL_TIMEOUT ) <= 0 )
+            continue;
+
+        for ( i = 0; i < MAX_READ_ONCE; i++ )
+        {
+            if ( *pp_current == NULL )
+            {
+                if ( (*pp_current = ring_Pop( &free_ring )) == NULL )
+                    break;
+                (*pp_current)->p_next = NULL;
+            }
+            p_iov[i].iov_base = (*pp_current)->p_ts;
+            p_iov[i].iov_len = TS_SIZE;
+            pp_current = &(*pp_current)->p_next;
+        }
+
+        if ( !i )
+        {
+            /* the demux hasn't given us any block back yet */
+            atomic_fetch_add( &i_dvr_starved, 1 );
+            msleep( DVR_STARVED_WAIT );
+            continue;
+        }
+
+        if ( (i_len = readv(i_dvr, p_iov, i)) < 0 )
+        {
+            if ( errno == EOVERFLOW )
+                atomic_fetch_add( &i_dvr_kernel_overflows, 1 );
+            else if ( errno != EAGAIN && errno != EINTR )
+                msg_Err( NULL, "couldn't read from DVR device (%s)",
+                         strerror(errno) );
+            continue;
+        }
+        i_capture = mdate();
+        i_len /= TS_SIZE;
+        if ( !i_len )
+            continue;
+
+        p_ts = p_local;
+        pp_current = &p_ts;
+        while ( i_len && *pp_current )
+        {
+            pp_current = &(*pp_current)->p_next;
+            i_len--;
+        }
+        p_local = *pp_current;
+        *pp_current = NULL;
+        p_ts->i_dts = i_capture;
+
+        if ( !ring_Push( &dvr_ring, p_ts ) )
+        {
+            /* demux is too late, drop this read (counted by the ring) */
+            *pp_current = p_local;
+            p_local = p_ts;
+            continue;
+        }
+
+        ev_async_send( event_loop, &dvr_async );
+    }
+
+    return p_local;
+}
+
+/*****************************************************************************
+ * DVRRefill: give empty blocks back to the capture thread
+ *****************************************************************************/
+static void DVRRefill( void )
+{
+    unsigned int i_missing = ring_Size( &free_ring ) - ring_Count( &free_ring );
+
+    while ( i_missing-- )
+    {
+        block_t *p_block = block_New();
+        if ( !ring_Push( &free_ring, p_block ) )
+        {
+            block_Delete( p_block );
+            break;
+        }
+    }
+}
+
+/*****************************************************************************
+ * DVRAsyncCb: demux side of the threaded mode, a backlog keeps the spacing
+ * it was captured with
+ *****************************************************************************/
+static void DVRAsyncCb(struct ev_loop *loop, struct ev_async *w, int revents)
+{
+    block_t *p_ts;
+
+    while ( (p_ts = ring_Pop( &dvr_ring )) != NULL )
+    {
+        ev_timer_again(loop, &mute_watcher);
+        demux_RunCaptured( p_ts, p_ts->i_dts );
+    }
+
+    DVRRefill();
+}
+
 static void DVRMuteCb(struct ev_loop *loop, struct ev_timer *w, int revents)
 {
     msg_Warn( NULL, "no DVR output, resetting" );
@@ -279,6 +469,56 @@ void dvb_UnsetFilter( int i_fd, uint16_t i_pid )
 /*****************************************************************************
  * Print info
  *****************************************************************************/
+static void PrintDVR( void )
+{
+    uint64_t i_kernel_overflows = atomic_load( &i_dvr_kernel_overflows );
+
+    if ( !b_dvr_thread )
+    {
+        if ( !i_kernel_overflows )
+            return;
+
+        switch (i_print_type)
+        {
+            case PRINT_XML:
+                fprintf(print_fh,
+                        "<STATUS type=\"dvr\" kernel_overflows=\"%"PRIu64"\" />\n",
+                        i_kernel_overflows);
+                break;
+            case PRINT_TEXT:
+                fprintf(print_fh, "dvr kernel_overflows: %"PRIu64"\n",
+                        i_kernel_overflows);
+                break;
+            default:
+                break;
+        }
+        return;
+    }
+
+    switch (i_print_type)
+    {
+        case PRINT_XML:
+            fprintf(print_fh,
+                    "<STATUS type=\"dvr\" depth=\"%u\" max_depth=\"%u\" size=\"%u\" overflows=\"%"PRIu64"\" starved=\"%"PRIu64"\" kernel_overflows=\"%"PRIu64"\" />\n",
+                    ring_Count( &dvr_ring ), dvr_ring.i_max_depth,
+                    ring_Size( &dvr_ring ),
+                    (uint64_t)atomic_load( &dvr_ring.i_overflows ),
+                    (uint64_t)atomic_load( &i_dvr_starved ),
+                    i_kernel_overflows);
+            break;
+        case PRINT_TEXT:
+            fprintf(print_fh, "dvr depth: %u max_depth: %u size: %u overflows: %"PRIu64" starved: %"PRIu64" kernel_overflows: %"PRIu64"\n",
+                    ring_Count( &dvr_ring ), dvr_ring.i_max_depth,
+                    ring_Size( &dvr_ring ),
+                    (uint64_t)atomic_load( &dvr_ring.i_overflows ),
+                    (uint64_t)atomic_load( &i_dvr_starved ),
+                    i_kernel_overflows);
+            break;
+        default:
+            break;
+    }
+}
+
 static void PrintCb( struct ev_loop *loop, struct ev_timer *w, int revents )
 {
     uint32_t i_ber = 0;
@@ -304,6 +544,8 @@ static void PrintCb( struct ev_loop *loop, struct ev_timer *w, int revents )
         default:
             break;
     }
+
+    PrintDVR();
 }
 
 /*****************************************************************************
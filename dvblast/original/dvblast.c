@@ -32,6 +32,7 @@
 #include <pthread.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
@@ -96,6 +97,8 @@ int b_any_type = 0;
 int b_select_pmts = 0;
 int b_random_tsid = 0;
 char *psz_udp_src = NULL;
+char *psz_file_src = NULL;
+bool b_cputime = false;
 int i_asi_adapter = 0;
 const char *psz_native_charset = "UTF-8//IGNORE";
 print_type_t i_print_type = PRINT_TEXT;
@@ -117,7 +120,9 @@ static bool b_dvb_global = false;
 static bool b_epg_global = false;
 static mtime_t i_latency_global = DEFAULT_OUTPUT_LATENCY;
 static mtime_t i_retention_global = DEFAULT_MAX_RETENTION;
+static int i_pacing_global = 0;
 static int i_ttl_global = 64;
+static const char *psz_record_dir = ".";
 
 static const char *psz_dvb_charset = "UTF-8//IGNORE";
 static iconv_t conf_iconv = (iconv_t)-1;
@@ -133,6 +138,7 @@ bool b_do_remap = false;
 uint16_t pi_newpids[ N_MAP_PIDS ];  /* pmt, audio, video, spu */
 
 void (*pf_Open)( void ) = NULL;
+void (*pf_Close)( void ) = NULL;
 void (*pf_Reset)( void ) = NULL;
 int (*pf_SetFilter)( uint16_t i_pid ) = NULL;
 void (*pf_UnsetFilter)( int i_fd, uint16_t i_pid ) = NULL;
@@ -185,8 +191,10 @@ static void config_Defaults( output_config_t *p_config )
                          (b_epg_global ? OUTPUT_EPG : 0);
     p_config->i_max_retention = i_retention_global;
     p_config->i_output_latency = i_latency_global;
+    p_config->i_pacing_burst = i_pacing_global;
     p_config->i_tsid = -1;
     p_config->i_ttl = i_ttl_global;
+    p_config->i_segment_duration = DEFAULT_SEGMENT_DURATION;
     memcpy( p_config->pi_ssrc, pi_ssrc_global, 4 * sizeof(uint8_t) );
     dvb_string_copy(&p_config->network_name, &network_name);
     dvb_string_copy(&p_config->provider_name, &provider_name);
@@ -283,6 +291,41 @@ static bool config_ParseHost( output_config_t *p_config, char *psz_string )
 
     p_config->psz_displayname = strdup( psz_string );
 
+    if ( !strncasecmp( psz_string, "shm:", 4 ) )
+    {
+        /* the ring name is kept as a local address */
+        struct sockaddr_un *p_addr =
+            (struct sockaddr_un *)&p_config->connect_addr;
+        size_t i_len = strcspn( psz_string + 4, "/" );
+
+        if ( !i_len || i_len >= sizeof(p_addr->sun_path) ) return false;
+        p_addr->sun_family = AF_UNIX;
+        memcpy( p_addr->sun_path, psz_string + 4, i_len );
+        p_addr->sun_path[i_len] = '\0';
+        p_config->i_family = AF_UNIX;
+        p_config->i_config |= OUTPUT_SHM | OUTPUT_UDP;
+        psz_string += 4 + i_len;
+        goto options;
+    }
+
+    if ( !strncasecmp( psz_string, "rec:", 4 ) )
+    {
+        /* so is the directory of the segments */
+        struct sockaddr_un *p_addr =
+            (struct sockaddr_un *)&p_config->connect_addr;
+        size_t i_len = strcspn( psz_string + 4, "/" );
+
+        if ( !i_len || strlen( psz_record_dir ) + 1 + i_len
+                        >= sizeof(p_addr->sun_path) ) return false;
+        p_addr->sun_family = AF_UNIX;
+        sprintf( p_addr->sun_path, "%s/%.*s", psz_record_dir, (int)i_len,
+                 psz_string + 4 );
+        p_config->i_family = AF_UNIX;
+        p_config->i_config |= OUTPUT_FILE | OUTPUT_UDP;
+        psz_string += 4 + i_len;
+        goto options;
+    }
+
     p_ai = ParseNodeService( psz_string, &psz_string, DEFAULT_PORT );
     if ( p_ai == NULL ) return false;
     memcpy( &p_config->connect_addr, p_ai->ai_addr, p_ai->ai_addrlen );
@@ -291,6 +334,7 @@ static bool config_ParseHost( output_config_t *p_config, char *psz_string )
     p_config->i_family = p_config->connect_addr.ss_family;
     if ( p_config->i_family == AF_UNSPEC ) return false;
 
+options:
     if ( psz_string == NULL || !*psz_string ) goto end;
 
     if ( *psz_string == '@' )
@@ -336,6 +380,23 @@ static bool config_ParseHost( output_config_t *p_config, char *psz_string )
             p_config->i_tos = strtol( ARG_OPTION("tos="), NULL, 0 );
         else if ( IS_OPTION("mtu=") )
             p_config->i_mtu = strtol( ARG_OPTION("mtu="), NULL, 0 );
+        else if ( IS_OPTION("pacing=") )
+            p_config->i_pacing_burst = strtol( ARG_OPTION("pacing="), NULL, 0 );
+        else if ( IS_OPTION("segment=") )
+            p_config->i_segment_duration = strtoll( ARG_OPTION("segment="),
+                                                    NULL, 0 ) * 1000;
+        else if ( IS_OPTION("segsize=") )
+            p_config->i_segment_size = strtoull( ARG_OPTION("segsize="),
+                                                 NULL, 0 ) * 1024 * 1024;
+        else if ( IS_OPTION("fec=") )
+        {
+            if ( sscanf( ARG_OPTION("fec="), "%dx%d", &p_config->i_fec_columns,
+                         &p_config->i_fec_rows ) != 2 )
+            {
+                msg_Warn( NULL, "invalid FEC matrix %s", ARG_OPTION("fec=") );
+                p_config->i_fec_columns = p_config->i_fec_rows = 0;
+            }
+        }
         else if ( IS_OPTION("ifindex=") )
             p_config->i_if_index_v6 = strtol( ARG_OPTION("ifindex="), NULL, 0 );
         else if ( IS_OPTION("networkid=") )
@@ -438,11 +499,151 @@ static void config_Print( output_config_t *p_config )
              p_config->i_sid, p_config->i_nb_pids );
 }
 
+/*****************************************************************************
+ * Config reload: the file is parsed at once, then applied in slices of at
+ * most RELOAD_SLICE from a check watcher, so that a reload with many outputs
+ * doesn't hold the event loop (and the packets behind it) for long.
+ *****************************************************************************/
+#define RELOAD_SLICE 200 /* us */
+
+static output_config_t *p_reload_configs = NULL;
+static int i_nb_reload_configs = 0;
+static int i_reload_config = 0; /* next config to apply */
+static int i_reload_output = 0; /* next output to check for removal */
+static struct ev_check reload_watcher;
+static struct ev_idle reload_idle_watcher;
+
+static bool config_Equal( const output_config_t *p_old,
+                          const output_config_t *p_new )
+{
+    /* the source address of raw outputs isn't kept, always reapply */
+    if ( (p_old->i_config & OUTPUT_RAW) || (p_new->i_config & OUTPUT_RAW) )
+        return false;
+
+    if ( (p_old->i_config & ~OUTPUT_STILL_PRESENT)
+           != (p_new->i_config | OUTPUT_VALID)
+          || p_old->b_passthrough != p_new->b_passthrough
+          || p_old->i_sid != p_new->i_sid
+          || p_old->i_nb_pids != p_new->i_nb_pids
+          || (p_new->i_nb_pids && memcmp( p_old->pi_pids, p_new->pi_pids,
+                                 p_new->i_nb_pids * sizeof(uint16_t) ))
+          || p_old->i_tsid != p_new->i_tsid
+          || p_old->i_network_id != p_new->i_network_id
+          || p_old->i_new_sid != p_new->i_new_sid
+          || p_old->i_onid != p_new->i_onid
+          || p_old->b_do_remap != p_new->b_do_remap
+          || memcmp( p_old->pi_confpids, p_new->pi_confpids,
+                     sizeof(p_new->pi_confpids) )
+          || memcmp( p_old->pi_ssrc, p_new->pi_ssrc, sizeof(p_new->pi_ssrc) )
+          || p_old->i_output_latency != p_new->i_output_latency
+          || p_old->i_max_retention != p_new->i_max_retention
+          || p_old->i_pacing_burst != p_new->i_pacing_burst
+          || p_old->i_ttl != p_new->i_ttl
+          || p_old->i_tos != p_new->i_tos
+          || p_old->i_mtu != p_new->i_mtu
+          || p_old->i_segment_duration != p_new->i_segment_duration
+          || p_old->i_segment_size != p_new->i_segment_size
+          || p_old->i_fec_columns != p_new->i_fec_columns
+          || p_old->i_fec_rows != p_new->i_fec_rows
+          || dvb_string_cmp( &p_old->network_name, &p_new->network_name )
+          || dvb_string_cmp( &p_old->service_name, &p_new->service_name )
+          || dvb_string_cmp( &p_old->provider_name, &p_new->provider_name ) )
+        return false;
+
+    if ( p_new->psz_displayname != NULL
+          && (p_old->psz_displayname == NULL
+               || strcmp( p_old->psz_displayname, p_new->psz_displayname )) )
+        return false;
+
+    return true;
+}
+
+static void config_Apply( output_config_t *p_config )
+{
+    output_t *p_output = output_Find( p_config );
+
+    if ( p_output != NULL && config_Equal( &p_output->config, p_config ) )
+    {
+        /* unchanged, don't touch the demux or the output thread */
+        p_output->config.i_config |= OUTPUT_STILL_PRESENT;
+        return;
+    }
+
+    config_Print( p_config );
+
+    if ( p_output == NULL )
+        p_output = output_Create( p_config );
+
+    if ( p_output != NULL )
+    {
+        p_config->i_config |= OUTPUT_VALID | OUTPUT_STILL_PRESENT;
+        output_Change( p_output, p_config );
+        demux_Change( p_output, p_config );
+    }
+}
+
+/* returns true once the whole reload is applied */
+static bool config_ReloadStep( mtime_t i_deadline )
+{
+    while ( i_reload_config < i_nb_reload_configs )
+    {
+        output_config_t *p_config = &p_reload_configs[i_reload_config++];
+
+        config_Apply( p_config );
+        config_Free( p_config );
+        if ( mdate() >= i_deadline )
+            return false;
+    }
+
+    while ( i_reload_output < i_nb_outputs )
+    {
+        output_t *p_output = pp_outputs[i_reload_output++];
+
+        if ( (p_output->config.i_config & OUTPUT_VALID) &&
+             !(p_output->config.i_config & OUTPUT_STILL_PRESENT) )
+        {
+            output_config_t config;
+
+            config_Init( &config );
+            msg_Dbg( NULL, "closing %s", p_output->config.psz_displayname );
+            demux_Change( p_output, &config );
+            output_Close( p_output );
+            config_Free( &config );
+        }
+
+        p_output->config.i_config &= ~OUTPUT_STILL_PRESENT;
+        if ( mdate() >= i_deadline )
+            return false;
+    }
+
+    free( p_reload_configs );
+    p_reload_configs = NULL;
+    i_nb_reload_configs = i_reload_config = i_reload_output = 0;
+    ev_check_stop( event_loop, &reload_watcher );
+    ev_idle_stop( event_loop, &reload_idle_watcher );
+    return true;
+}
+
+static void config_ReloadCb( struct ev_loop *loop, struct ev_check *w,
+                             int revents )
+{
+    if ( !config_ReloadStep( mdate() + RELOAD_SLICE ) )
+        msg_Dbg( NULL, "reload: %d/%d outputs applied", i_reload_config,
+                 i_nb_reload_configs );
+}
+
+/* only keeps the loop from blocking while a reload is pending */
+static void config_ReloadIdleCb( struct ev_loop *loop, struct ev_idle *w,
+                                 int revents )
+{
+}
+
 void config_ReadFile(void)
 {
     FILE *p_file;
     char psz_line[2048];
-    int i;
+    output_config_t *p_configs = NULL;
+    int i, i_nb_configs = 0;
 
     if ( psz_conf_file == NULL )
     {
@@ -459,7 +660,6 @@ void config_ReadFile(void)
     while ( fgets( psz_line, sizeof(psz_line), p_file ) != NULL )
     {
         output_config_t config;
-        output_t *p_output;
         char *psz_token, *psz_parser;
 
         psz_parser = strchr( psz_line, '#' );
@@ -522,45 +722,31 @@ void config_ReadFile(void)
             }
         }
 
-        config_Print( &config );
-
-        p_output = output_Find( &config );
-
-        if ( p_output == NULL )
-            p_output = output_Create( &config );
-
-        if ( p_output != NULL )
-        {
-            free( p_output->config.psz_displayname );
-            p_output->config.psz_displayname = strdup( config.psz_displayname );
-
-            config.i_config |= OUTPUT_VALID | OUTPUT_STILL_PRESENT;
-            output_Change( p_output, &config );
-            demux_Change( p_output, &config );
-        }
-
-        config_Free( &config );
+        p_configs = realloc( p_configs,
+                             (i_nb_configs + 1) * sizeof(output_config_t) );
+        p_configs[i_nb_configs++] = config;
     }
 
     fclose( p_file );
 
+    /* a reload still in progress is superseded by this one */
+    for ( i = i_reload_config; i < i_nb_reload_configs; i++ )
+        config_Free( &p_reload_configs[i] );
+    free( p_reload_configs );
+
     for ( i = 0; i < i_nb_outputs; i++ )
-    {
-        output_t *p_output = pp_outputs[i];
-        output_config_t config;
+        pp_outputs[i]->config.i_config &= ~OUTPUT_STILL_PRESENT;
 
-        config_Init( &config );
+    p_reload_configs = p_configs;
+    i_nb_reload_configs = i_nb_configs;
+    i_reload_config = i_reload_output = 0;
 
-        if ( (p_output->config.i_config & OUTPUT_VALID) &&
-             !(p_output->config.i_config & OUTPUT_STILL_PRESENT) )
-        {
-            msg_Dbg( NULL, "closing %s", p_output->config.psz_displayname );
-            demux_Change( p_output, &config );
-            output_Close( p_output );
-        }
-
-        p_output->config.i_config &= ~OUTPUT_STILL_PRESENT;
-        config_Free( &config );
+    if ( !ev_is_active( &reload_watcher ) )
+    {
+        ev_check_init( &reload_watcher, config_ReloadCb );
+        ev_check_start( event_loop, &reload_watcher );
+        ev_idle_init( &reload_idle_watcher, config_ReloadIdleCb );
+        ev_idle_start( event_loop, &reload_idle_watcher );
     }
 }
 
@@ -645,6 +831,7 @@ void usage()
     msg_Raw( NULL, "  -b --bandwidth        frontend bandwidth" );
 #endif
     msg_Raw( NULL, "  -D --rtp-input        read packets from a multicast address instead of a DVB card" );
+    msg_Raw( NULL, "     --file-input <file>[/fast][/port=<port>] replay a TS file or a pcap of UDP/RTP, paced or as fast as possible (combine with -L 0)" );
 #ifdef HAVE_DVB_SUPPORT
     msg_Raw( NULL, "  -5 --delsys           delivery system" );
     msg_Raw( NULL, "    DVBS|DVBS2|DVBC_ANNEX_A|DVBT|DVBT2|ATSC|ISDBT|DVBC_ANNEX_B(ATSC-C/QAMB) (default guessed)");
@@ -682,6 +869,7 @@ void usage()
     msg_Raw( NULL, "  -O --lock-timeout     timeout for the lock operation (in ms)" );
     msg_Raw( NULL, "  -y --ca-number <ca_device_number>" );
     msg_Raw( NULL, "  -2 --dvr-buf-size <size> set the size of the DVR TS buffer in bytes (default: %d)", i_dvr_buffer_size);
+    msg_Raw( NULL, "     --dvr-thread[=<reads>] read the DVR from a dedicated thread, queueing up to <reads> reads for the demux (default: %d)", i_dvr_ring_size);
 #endif
 
     msg_Raw( NULL, "Output:" );
@@ -703,6 +891,13 @@ void usage()
     msg_Raw( NULL, "  -U --udp              use raw UDP rather than RTP (required by some IPTV set top boxes)" );
     msg_Raw( NULL, "  -z --any-type         pass through all ESs from the PMT, of any type" );
     msg_Raw( NULL, "  -0 --pidmap <pmt_pid,audio_pid,video_pid,spu_pid>");
+    msg_Raw( NULL, "     --output-threads <n> send the outputs from <n> threads instead of the demux thread" );
+    msg_Raw( NULL, "     --pacing <burst>   space the datagrams at the stream bitrate, at most <burst> back to back" );
+    msg_Raw( NULL, "  an output host of shm:<name> writes to the shared memory ring /dvblast-<name> (see shm-reader.h)" );
+    msg_Raw( NULL, "  an output host of rec:<name> records to segments in <record-dir>/<name>, cut every /segment=<ms> or /segsize=<MiB>" );
+    msg_Raw( NULL, "     --record-dir <dir> directory of the rec:<name> outputs (default: .)" );
+    msg_Raw( NULL, "  the /fec=<L>x<D> output option sends SMPTE 2022-1 column and row FEC to the RTP port + 2 and + 4" );
+    msg_Raw( NULL, "     --pcr-clock <pid>  pace the outputs on the PCRs of <pid> rather than on the arrival times, allowing a lower --latency" );
 
     msg_Raw( NULL, "Misc:" );
     msg_Raw( NULL, "  -h --help             display this full help" );
@@ -718,6 +913,7 @@ void usage()
     msg_Raw( NULL, "  -7 --es-timeout       time of inactivy before which a PID is reported down (in ms)" );
     msg_Raw( NULL, "  -r --remote-socket <remote socket>" );
     msg_Raw( NULL, "  -Z --mrtg-file <file> Log input packets and errors into mrtg-file" );
+    msg_Raw( NULL, "     --block-hugepages  allocate packet buffers from huge pages" );
     msg_Raw( NULL, "  -V --version          only display the version" );
     exit(1);
 }
@@ -809,6 +1005,13 @@ int main( int i_argc, char **pp_argv )
         { "ca-number",       required_argument, NULL, 'y' },
         { "pidmap",          required_argument, NULL, '0' },
         { "dvr-buf-size",    required_argument, NULL, '2' },
+        { "dvr-thread",      optional_argument, NULL, 0x100004 },
+        { "block-hugepages", no_argument,       NULL, 0x100005 },
+        { "file-input",      required_argument, NULL, 0x100006 },
+        { "output-threads",  required_argument, NULL, 0x100007 },
+        { "pcr-clock",       required_argument, NULL, 0x100008 },
+        { "pacing",          required_argument, NULL, 0x100009 },
+        { "record-dir",      required_argument, NULL, 0x10000A },
         { 0, 0, 0, 0 }
     };
 
@@ -895,6 +1098,7 @@ int main( int i_argc, char **pp_argv )
                 usage();
 #ifdef HAVE_DVB_SUPPORT
             pf_Open = dvb_Open;
+            pf_Close = dvb_Close;
             pf_Reset = dvb_Reset;
             pf_SetFilter = dvb_SetFilter;
             pf_UnsetFilter = dvb_UnsetFilter;
@@ -1194,7 +1398,53 @@ int main( int i_argc, char **pp_argv )
             i_dvr_buffer_size /= TS_SIZE;
             i_dvr_buffer_size *= TS_SIZE;
             break;
+
+        case 0x100004: // --dvr-thread
+            b_dvr_thread = true;
+            if ( optarg )
+            {
+                i_dvr_ring_size = strtol( optarg, NULL, 0 );
+                if ( i_dvr_ring_size <= 0 )
+                    usage();
+            }
+            break;
 #endif
+        case 0x100005: // --block-hugepages
+            b_block_hugepages = true;
+            break;
+
+        case 0x100006: // --file-input
+            psz_file_src = optarg;
+            if ( pf_Open != NULL )
+                usage();
+            pf_Open = file_Open;
+            pf_Reset = file_Reset;
+            pf_SetFilter = file_SetFilter;
+            pf_UnsetFilter = file_UnsetFilter;
+            break;
+
+        case 0x100007: // --output-threads
+            i_output_threads = strtol( optarg, NULL, 0 );
+            if ( i_output_threads < 0 )
+                usage();
+            break;
+
+        case 0x100008: // --pcr-clock
+            i_pcr_clock_pid = strtol( optarg, NULL, 0 );
+            if ( i_pcr_clock_pid < 0 || i_pcr_clock_pid >= PADDING_PID )
+                usage();
+            break;
+
+        case 0x100009: // --pacing
+            i_pacing_global = strtol( optarg, NULL, 0 );
+            if ( i_pacing_global < 0 )
+                usage();
+            break;
+
+        case 0x10000A: // --record-dir
+            psz_record_dir = optarg;
+            break;
+
         case 'h':
         default:
             usage();
@@ -1245,6 +1495,8 @@ int main( int i_argc, char **pp_argv )
         exit(EXIT_FAILURE);
     }
 
+    outputs_Init();
+
     memset( &output_dup, 0, sizeof(output_dup) );
     if ( psz_dup_config != NULL )
     {
@@ -1255,8 +1507,8 @@ int main( int i_argc, char **pp_argv )
             msg_Err( NULL, "Invalid target address for -d switch" );
         else
         {
-            output_Init( &output_dup, &config );
-            output_Change( &output_dup, &config );
+            if ( output_Init( &output_dup, &config ) == 0 )
+                output_Change( &output_dup, &config );
         }
 
         config_Free( &config );
@@ -1310,6 +1562,8 @@ int main( int i_argc, char **pp_argv )
     }
 
     config_ReadFile();
+    /* nothing to hold up yet, apply the whole configuration now */
+    config_ReloadStep( INT64_MAX );
 
     if ( psz_srv_socket != NULL )
         comm_Open();
@@ -1321,11 +1575,11 @@ int main( int i_argc, char **pp_argv )
         ev_timer_start(event_loop, &quit_watcher);
     }
 
-    outputs_Init();
-
     ev_run(event_loop, 0);
 
     mrtgClose();
+    if ( pf_Close != NULL )
+        pf_Close();
     outputs_Close( i_nb_outputs );
     demux_Close();
     dvb_string_clean( &network_name );
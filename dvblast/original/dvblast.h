@@ -29,6 +29,7 @@
 #include <netinet/ip.h>
 
 #include "config.h"
+#include "metrics.h"
 
 #ifndef container_of
 #   define container_of(ptr, type, member) ({                               \
@@ -85,10 +86,11 @@ struct udprawpkt {
  * Bit  1 : Set output still present
  * Bit  2 : Set if output is valid (replaces m_addr != 0 tests)
  * Bit  3 : Set for UDP, otherwise use RTP if a network stream
- * Bit  4 : Set for file / FIFO output, unset for network (future use)
+ * Bit  4 : Set for segment recorder output, unset for network
  * Bit  5 : Set if DVB conformance tables are inserted
  * Bit  6 : Set if DVB EIT schedule tables are forwarded
  * Bit  7 : Set for RAW socket output
+ * Bit  8 : Set for shared memory ring output
  *****************************************************************************/
 
 #define OUTPUT_WATCH         0x01
@@ -99,6 +101,7 @@ struct udprawpkt {
 #define OUTPUT_DVB           0x20
 #define OUTPUT_EPG           0x40
 #define OUTPUT_RAW           0x80
+#define OUTPUT_SHM           0x100
 
 typedef int64_t mtime_t;
 
@@ -107,7 +110,6 @@ typedef struct block_t
     uint8_t p_ts[TS_SIZE];
     int i_refcount;
     mtime_t i_dts;
-    uint16_t tmp_pid;
     struct block_t *p_next;
 } block_t;
 
@@ -141,7 +143,11 @@ typedef struct output_config_t
     int i_ttl;
     uint8_t i_tos;
     int i_mtu;
+    int i_pacing_burst; /* datagrams sent back to back, 0 without pacing */
     char *psz_srcaddr; /* raw packets */
+    mtime_t i_segment_duration; /* OUTPUT_FILE, 0 for no limit */
+    uint64_t i_segment_size;
+    int i_fec_columns, i_fec_rows; /* SMPTE 2022-1 L and D, 0 without FEC */
     int i_srcport;
 
     /* demux config */
@@ -158,6 +164,9 @@ typedef struct output_config_t
     uint16_t pi_confpids[N_MAP_PIDS];
 } output_config_t;
 
+#define OUTPUT_GAP_BINS 8
+#define OUTPUT_DEPTH_BUCKETS 32
+
 typedef struct output_t
 {
     output_config_t config;
@@ -168,6 +177,30 @@ typedef struct output_t
     packet_t *p_packet_lifo;
     unsigned int i_packet_count;
     uint16_t i_seqnum;
+    int i_sched_index; /* position in the send heap, -1 when idle */
+    struct output_worker_t *p_worker;
+    struct ring_t *p_queue; /* blocks from the demux, with output threads */
+    struct shm_writer_t *p_shm; /* OUTPUT_SHM, instead of i_handle */
+    struct recorder_t *p_recorder; /* OUTPUT_FILE, instead of i_handle */
+    struct fec_t *p_fec;
+    struct sockaddr_storage p_fec_addr[2]; /* column and row, port + 2, + 4 */
+    unsigned int i_fec_ready; /* parities of the last datagram, not yet sent */
+    /* send time minus PCR, over the current print period */
+    uint16_t i_jitter_pid;
+    mtime_t i_jitter_min, i_jitter_max;
+    unsigned int i_jitter_samples;
+    /* token bucket pacing at the rate of the dts, in bytes per us */
+    double f_pacing_rate, f_pacing_tokens;
+    mtime_t i_pacing_time, i_rate_start;
+    uint64_t i_rate_bytes;
+    /* gaps between datagrams, over the current print period */
+    mtime_t i_last_send;
+    unsigned int pi_gaps[OUTPUT_GAP_BINS];
+    /* since startup, in metrics_Bucket() buckets */
+    uint64_t pi_latency[METRICS_BUCKETS]; /* send time minus block dts, us */
+    uint64_t pi_depth[OUTPUT_DEPTH_BUCKETS]; /* TS packets per datagram */
+    uint64_t pi_print_latency[METRICS_BUCKETS]; /* at the last print */
+    uint64_t pi_print_depth[OUTPUT_DEPTH_BUCKETS];
 
     /* demux */
     int i_nb_errors;
@@ -207,6 +240,19 @@ typedef struct ts_pid_info {
        3 = Scrambled with odd key */
 } ts_pid_info_t;
 
+typedef struct psi_cache_info {
+    uint64_t i_hits;                    /* Repeated sections, not reparsed */
+    uint64_t i_misses;                  /* Sections validated and parsed */
+} psi_cache_info_t;
+
+#define OUTPUT_NAME_SIZE 64
+
+typedef struct output_latency_info {
+    char psz_name[OUTPUT_NAME_SIZE];         /* Display name, truncated */
+    uint64_t pi_latency[METRICS_BUCKETS];    /* Send time minus block dts */
+    uint64_t pi_depth[OUTPUT_DEPTH_BUCKETS]; /* TS packets per datagram */
+} output_latency_info_t;
+
 extern struct ev_loop *event_loop;
 extern int i_syslog;
 extern int i_verbose;
@@ -220,6 +266,11 @@ extern int i_fenum;
 extern int i_canum;
 extern char *psz_delsys;
 extern int i_dvr_buffer_size;
+extern bool b_dvr_thread;
+extern int i_dvr_ring_size;
+extern bool b_block_hugepages;
+extern int i_output_threads;
+extern int i_pcr_clock_pid;
 extern int i_frequency;
 extern char *psz_lnb_type;
 extern int i_srate;
@@ -257,6 +308,8 @@ extern bool b_enable_emm;
 extern bool b_enable_ecm;
 extern mtime_t i_wallclock;
 extern char *psz_udp_src;
+extern char *psz_file_src;
+extern bool b_cputime;
 extern int i_asi_adapter;
 extern const char *psz_native_charset;
 extern enum print_type_t i_print_type;
@@ -271,6 +324,7 @@ extern uint16_t pi_newpids[N_MAP_PIDS];
 extern void init_pid_mapping( output_t * );
 
 extern void (*pf_Open)( void );
+extern void (*pf_Close)( void );
 extern void (*pf_Reset)( void );
 extern int (*pf_SetFilter)( uint16_t i_pid );
 extern void (*pf_UnsetFilter)( int i_fd, uint16_t i_pid );
@@ -303,6 +357,7 @@ void dvb_string_copy(dvb_string_t *p_dst, const dvb_string_t *p_src);
 int dvb_string_cmp(const dvb_string_t *p_1, const dvb_string_t *p_2);
 
 mtime_t mdate( void );
+mtime_t mcputime( void );
 void msleep( mtime_t delay );
 void hexDump( uint8_t *p_data, uint32_t i_len );
 struct addrinfo *ParseNodeService( char *_psz_string, char **ppsz_end,
@@ -313,8 +368,10 @@ void config_ReadFile(void);
 uint8_t *psi_pack_section( uint8_t *p_sections, unsigned int *pi_size );
 uint8_t *psi_pack_sections( uint8_t **pp_sections, unsigned int *pi_size );
 uint8_t **psi_unpack_sections( uint8_t *p_flat_sections, unsigned int i_size );
+uint32_t mpeg_crc32( const uint8_t *p_data, size_t i_size );
 
 void dvb_Open( void );
+void dvb_Close( void );
 void dvb_Reset( void );
 int dvb_SetFilter( uint16_t i_pid );
 void dvb_UnsetFilter( int i_fd, uint16_t i_pid );
@@ -325,6 +382,11 @@ void udp_Reset( void );
 int udp_SetFilter( uint16_t i_pid );
 void udp_UnsetFilter( int i_fd, uint16_t i_pid );
 
+void file_Open( void );
+void file_Reset( void );
+int file_SetFilter( uint16_t i_pid );
+void file_UnsetFilter( int i_fd, uint16_t i_pid );
+
 void asi_Open( void );
 void asi_Reset( void );
 int asi_SetFilter( uint16_t i_pid );
@@ -339,6 +401,7 @@ void asi_deltacast_UnsetFilter( int i_fd, uint16_t i_pid );
 
 void demux_Open( void );
 void demux_Run( block_t *p_ts );
+void demux_RunCaptured( block_t *p_ts, mtime_t i_capture );
 void demux_Change( output_t *p_output, const output_config_t *p_config );
 void demux_ResendCAPMTs( void );
 bool demux_PIDIsSelected( uint16_t i_pid );
@@ -355,6 +418,8 @@ uint8_t *demux_get_packed_EIT_pf( uint16_t service_id, unsigned int *pi_pack_siz
 uint8_t *demux_get_packed_EIT_schedule( uint16_t service_id, unsigned int *pi_pack_size );
 void demux_get_PID_info( uint16_t i_pid, uint8_t *p_data );
 void demux_get_PIDS_info( uint8_t *p_data );
+void demux_get_PSI_cache_info( uint8_t *p_data );
+void demux_get_metrics( uint8_t *p_data );
 
 output_t *output_Create( const output_config_t *p_config );
 int output_Init( output_t *p_output, const output_config_t *p_config );
@@ -364,12 +429,16 @@ output_t *output_Find( const output_config_t *p_config );
 void output_Change( output_t *p_output, const output_config_t *p_config );
 void outputs_Init( void );
 void outputs_Close( int i_num_outputs );
+void outputs_GetStats( uint64_t *pi_datagrams, mtime_t *pi_cputime );
+void outputs_GetLatency( uint8_t *p_data, size_t i_max_size, size_t *pi_size );
 
 void comm_Open( void );
 void comm_Close( void );
 
 block_t *block_New( void );
 void block_Delete( block_t *p_block );
+void block_GetStats( unsigned int *pi_used, unsigned int *pi_max_used,
+                     unsigned int *pi_total );
 void block_Vacuum( void );
 
 /*****************************************************************************
@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include <inttypes.h>
 #include <sys/types.h>
@@ -48,6 +49,7 @@
 #include "dvblast.h"
 #include "en50221.h"
 #include "comm.h"
+#include "metrics.h"
 
 int i_verbose = 3;
 int i_syslog = 0;
@@ -211,6 +213,129 @@ void print_pids( uint8_t *p_data )
     print_pids_footer();
 }
 
+#define METRICS_NAME(name, psz) psz,
+static const char *const ppsz_metrics[] = {
+    METRICS_COUNTERS(METRICS_NAME)
+};
+static const char *const ppsz_histograms[] = {
+    METRICS_HISTOGRAMS(METRICS_NAME)
+};
+#undef METRICS_NAME
+
+/* in text mode the caller prints the start of the line, if any */
+void print_histogram( const char *psz_name, const uint64_t *pi_buckets,
+                      unsigned int i_nb_buckets, const char *psz_indent )
+{
+    uint64_t i_count = 0, i_max = 0;
+    unsigned int i;
+
+    for ( i = 0; i < i_nb_buckets; i++ )
+    {
+        i_count += pi_buckets[i];
+        if ( pi_buckets[i] )
+            i_max = metrics_BucketLow( i );
+    }
+
+    if ( i_print_type == PRINT_XML )
+    {
+        printf("%s<HISTOGRAM name=\"%s\" count=\"%"PRIu64"\" p50=\"%"PRIu64"\" p99=\"%"PRIu64"\" max=\"%"PRIu64"\">\n",
+               psz_indent, psz_name, i_count,
+               metrics_Quantile( pi_buckets, i_nb_buckets, i_count, .5 ),
+               metrics_Quantile( pi_buckets, i_nb_buckets, i_count, .99 ),
+               i_max);
+        for ( i = 0; i < i_nb_buckets; i++ )
+            if ( pi_buckets[i] )
+                printf("%s <BUCKET low=\"%"PRIu64"\" count=\"%"PRIu64"\" />\n",
+                       psz_indent, metrics_BucketLow( i ), pi_buckets[i]);
+        printf("%s</HISTOGRAM>\n", psz_indent);
+    }
+    else
+        printf("%s count: %"PRIu64" p50: %"PRIu64" p99: %"PRIu64" max: %"PRIu64"\n",
+               psz_name, i_count,
+               metrics_Quantile( pi_buckets, i_nb_buckets, i_count, .5 ),
+               metrics_Quantile( pi_buckets, i_nb_buckets, i_count, .99 ),
+               i_max);
+}
+
+void print_metrics( uint8_t *p_data, unsigned int i_data_size )
+{
+    metrics_snapshot_t *p_snapshot = (metrics_snapshot_t *)p_data;
+    const uint64_t *pi_counters, *pi_histograms;
+    unsigned int i_nb_counters, i_nb_histograms, i_nb_buckets, i;
+
+    if ( i_data_size < offsetof(metrics_snapshot_t, pi_counters)
+          || p_snapshot->i_version != METRICS_VERSION
+          || p_snapshot->i_nb_buckets != METRICS_BUCKETS )
+        return_error( "Incompatible metrics" );
+
+    /* the sender may know more metrics than we do, they come last */
+    pi_counters = p_snapshot->pi_counters;
+    pi_histograms = pi_counters + p_snapshot->i_nb_counters;
+    if ( i_data_size < offsetof(metrics_snapshot_t, pi_counters)
+                        + (p_snapshot->i_nb_counters + p_snapshot->i_nb_histograms
+                            * METRICS_BUCKETS) * sizeof(uint64_t) )
+        return_error( "Truncated metrics" );
+    i_nb_counters = MIN(p_snapshot->i_nb_counters, METRIC_COUNT);
+    i_nb_histograms = MIN(p_snapshot->i_nb_histograms, HISTOGRAM_COUNT);
+    i_nb_buckets = p_snapshot->i_nb_buckets;
+
+    if ( i_print_type == PRINT_XML )
+        printf("<METRICS threads=\"%u\">\n", p_snapshot->i_nb_threads);
+
+    for ( i = 0; i < i_nb_counters; i++ )
+    {
+        if ( i_print_type == PRINT_XML )
+            printf(" <METRIC name=\"%s\" value=\"%"PRIu64"\" />\n",
+                   ppsz_metrics[i], pi_counters[i]);
+        else
+            printf("%s: %"PRIu64"\n", ppsz_metrics[i], pi_counters[i]);
+    }
+
+    for ( i = 0; i < i_nb_histograms; i++ )
+        print_histogram( ppsz_histograms[i], pi_histograms + i * i_nb_buckets,
+                         i_nb_buckets, " " );
+
+    if ( i_print_type == PRINT_XML )
+        printf("</METRICS>\n");
+}
+
+void print_output_latency( uint8_t *p_data, unsigned int i_data_size )
+{
+    unsigned int i_nb = i_data_size / sizeof(output_latency_info_t), i;
+
+    if ( i_print_type == PRINT_XML )
+        printf("<OUTPUTS>\n");
+
+    for ( i = 0; i < i_nb; i++ )
+    {
+        output_latency_info_t *p_info =
+            (output_latency_info_t *)(p_data + i * sizeof(output_latency_info_t));
+        p_info->psz_name[OUTPUT_NAME_SIZE - 1] = '\0';
+
+        if ( i_print_type == PRINT_XML )
+        {
+            printf(" <OUTPUT name=\"%s\">\n", p_info->psz_name);
+            print_histogram( "latency", p_info->pi_latency, METRICS_BUCKETS,
+                             "  " );
+            print_histogram( "depth", p_info->pi_depth, OUTPUT_DEPTH_BUCKETS,
+                             "  " );
+            printf(" </OUTPUT>\n");
+        }
+        else
+        {
+            printf("output %s ", p_info->psz_name);
+            print_histogram( "latency", p_info->pi_latency, METRICS_BUCKETS,
+                             "" );
+            printf("output %s ", p_info->psz_name);
+            print_histogram( "depth", p_info->pi_depth, OUTPUT_DEPTH_BUCKETS,
+                             "" );
+        }
+    }
+
+    if ( i_print_type == PRINT_XML )
+        printf("</OUTPUTS>\n");
+}
+
 void print_eit_events(uint8_t *p_eit, f_print pf_print, void *print_opaque, f_iconv pf_iconv, void *iconv_opaque, print_type_t i_print_type)
 {
     uint8_t *p_event;
@@ -349,6 +474,9 @@ static const struct dvblastctl_option options[] =
     { "get_pmt",            1, CMD_GET_PMT }, /* arg: service_id (uint16_t) */
     { "get_pids",           0, CMD_GET_PIDS },
     { "get_pid",            1, CMD_GET_PID },  /* arg: pid (uint16_t) */
+    { "get_psi_cache",      0, CMD_GET_PSI_CACHE },
+    { "get_metrics",        0, CMD_GET_METRICS },
+    { "get_output_latency", 0, CMD_GET_OUTPUT_LATENCY },
 
     { NULL, 0, 0 }
 };
@@ -387,6 +515,9 @@ void usage()
     printf("  get_pmt <service_id>            Return last PMT table.\n");
     printf("  get_pids                        Return info about all pids.\n");
     printf("  get_pid <pid>                   Return info for chosen pid only.\n");
+    printf("  get_psi_cache                   Return PSI section cache hits and misses.\n");
+    printf("  get_metrics                     Return all counters and histograms at once.\n");
+    printf("  get_output_latency              Return the latency and depth histograms of the outputs.\n");
     printf("\n");
     exit(1);
 }
@@ -540,6 +671,9 @@ int main( int i_argc, char **ppsz_argv )
     case CMD_GET_NIT:
     case CMD_GET_SDT:
     case CMD_GET_PIDS:
+    case CMD_GET_PSI_CACHE:
+    case CMD_GET_METRICS:
+    case CMD_GET_OUTPUT_LATENCY:
         /* These commands need no special handling because they have no parameters */
         break;
     case CMD_GET_EIT_PF:
@@ -735,6 +869,30 @@ int main( int i_argc, char **ppsz_argv )
         break;
     }
 
+    case RET_PSI_CACHE:
+    {
+        psi_cache_info_t *p_info = (psi_cache_info_t *)p_data;
+        if ( i_print_type == PRINT_XML )
+            printf("<PSI_CACHE hits=\"%"PRIu64"\" misses=\"%"PRIu64"\" />\n",
+                   p_info->i_hits, p_info->i_misses);
+        else
+            printf("psi_cache hits %"PRIu64" misses %"PRIu64"\n",
+                   p_info->i_hits, p_info->i_misses);
+        break;
+    }
+
+    case RET_METRICS:
+    {
+        print_metrics( p_data, i_packet_size - COMM_HEADER_SIZE );
+        break;
+    }
+
+    case RET_OUTPUT_LATENCY:
+    {
+        print_output_latency( p_data, i_packet_size - COMM_HEADER_SIZE );
+        break;
+    }
+
 #ifdef HAVE_DVB_SUPPORT
     case RET_FRONTEND_STATUS:
     {
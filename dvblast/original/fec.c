@@ -0,0 +1,368 @@
+/*****************************************************************************
+ * fec.c: SMPTE 2022-1 FEC for the RTP outputs
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/*
+ * Parity payloads are the XOR of up to 1316 bytes per media datagram, in
+ * 188-byte pieces, twice (column and row); the XOR runs as wide as the CPU
+ * allows, picked once like the TS header pre-pass.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <immintrin.h>
+#   define HAVE_FEC_X86
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#   include <arm_neon.h>
+#   define HAVE_FEC_NEON
+#endif
+
+#include "dvblast.h"
+#include "fec.h"
+
+#include <bitstream/ietf/rtp.h>
+
+#define FEC_ALIGN 64
+
+/*****************************************************************************
+ * Local declarations
+ *****************************************************************************/
+typedef void (*fec_xor_t)( uint8_t *p_dst, const uint8_t *p_src,
+                           size_t i_size );
+
+static fec_xor_t pf_xor = NULL;
+
+typedef struct fec_parity_t
+{
+    uint8_t *p_payload; /* i_max_payload bytes */
+    size_t i_size;      /* of the longest payload */
+    unsigned int i_count;
+    /* XOR of the fields of the RTP headers */
+    uint16_t i_snbase;
+    uint16_t i_length;
+    uint8_t i_pt;
+    uint32_t i_ts;
+    uint8_t p_header[RTP_HEADER_SIZE + FEC_HEADER_SIZE];
+} fec_parity_t;
+
+struct fec_t
+{
+    unsigned int i_columns, i_rows;
+    size_t i_max_payload;
+    unsigned int i_index; /* of the next datagram in the matrix */
+    uint16_t pi_seqnum[FEC_TYPES];
+    fec_parity_t *pp_ready[FEC_TYPES];
+    fec_parity_t row;
+    fec_parity_t p_columns[FEC_MAX_COLUMNS];
+    uint8_t *p_payloads;
+};
+
+/*****************************************************************************
+ * fec_XorC: 64 bits at a time, also used for the tails
+ *****************************************************************************/
+static void fec_XorC( uint8_t *p_dst, const uint8_t *p_src, size_t i_size )
+{
+    while ( i_size >= 8 )
+    {
+        uint64_t i_dst, i_src;
+
+        memcpy( &i_dst, p_dst, 8 );
+        memcpy( &i_src, p_src, 8 );
+        i_dst ^= i_src;
+        memcpy( p_dst, &i_dst, 8 );
+        p_dst += 8;
+        p_src += 8;
+        i_size -= 8;
+    }
+    while ( i_size-- )
+        *p_dst++ ^= *p_src++;
+}
+
+#ifdef HAVE_FEC_X86
+__attribute__((target("sse2")))
+static void fec_XorSSE2( uint8_t *p_dst, const uint8_t *p_src, size_t i_size )
+{
+    while ( i_size >= 16 )
+    {
+        __m128i dst = _mm_loadu_si128( (const __m128i *)p_dst );
+        __m128i src = _mm_loadu_si128( (const __m128i *)p_src );
+        _mm_storeu_si128( (__m128i *)p_dst, _mm_xor_si128( dst, src ) );
+        p_dst += 16;
+        p_src += 16;
+        i_size -= 16;
+    }
+    fec_XorC( p_dst, p_src, i_size );
+}
+
+__attribute__((target("avx2")))
+static void fec_XorAVX2( uint8_t *p_dst, const uint8_t *p_src, size_t i_size )
+{
+    while ( i_size >= 32 )
+    {
+        __m256i dst = _mm256_loadu_si256( (const __m256i *)p_dst );
+        __m256i src = _mm256_loadu_si256( (const __m256i *)p_src );
+        _mm256_storeu_si256( (__m256i *)p_dst, _mm256_xor_si256( dst, src ) );
+        p_dst += 32;
+        p_src += 32;
+        i_size -= 32;
+    }
+    if ( i_size >= 16 )
+    {
+        __m128i dst = _mm_loadu_si128( (const __m128i *)p_dst );
+        __m128i src = _mm_loadu_si128( (const __m128i *)p_src );
+        _mm_storeu_si128( (__m128i *)p_dst, _mm_xor_si128( dst, src ) );
+        p_dst += 16;
+        p_src += 16;
+        i_size -= 16;
+    }
+    fec_XorC( p_dst, p_src, i_size );
+}
+#endif
+
+#ifdef HAVE_FEC_NEON
+static void fec_XorNEON( uint8_t *p_dst, const uint8_t *p_src, size_t i_size )
+{
+    while ( i_size >= 16 )
+    {
+        vst1q_u8( p_dst, veorq_u8( vld1q_u8( p_dst ), vld1q_u8( p_src ) ) );
+        p_dst += 16;
+        p_src += 16;
+        i_size -= 16;
+    }
+    fec_XorC( p_dst, p_src, i_size );
+}
+#endif
+
+/*****************************************************************************
+ * fec_Init: picks the widest implementation the CPU supports
+ *****************************************************************************/
+static void fec_Init( void )
+{
+    const char *psz_impl = "C";
+
+    pf_xor = fec_XorC;
+
+#ifdef HAVE_FEC_X86
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx2" ) )
+    {
+        pf_xor = fec_XorAVX2;
+        psz_impl = "AVX2";
+    }
+    else if ( __builtin_cpu_supports( "sse2" ) )
+    {
+        pf_xor = fec_XorSSE2;
+        psz_impl = "SSE2";
+    }
+#elif defined(HAVE_FEC_NEON)
+    pf_xor = fec_XorNEON;
+    psz_impl = "NEON";
+#endif
+
+    msg_Dbg( NULL, "using %s FEC parity", psz_impl );
+}
+
+/*****************************************************************************
+ * fec_New: i_max_payload is the largest RTP payload of the output
+ *****************************************************************************/
+fec_t *fec_New( unsigned int i_columns, unsigned int i_rows,
+                size_t i_max_payload )
+{
+    size_t i_stride = (i_max_payload + FEC_ALIGN - 1) & ~(size_t)(FEC_ALIGN - 1);
+    fec_t *p_fec;
+    unsigned int i;
+
+    if ( i_columns < 1 || i_columns > FEC_MAX_COLUMNS
+          || i_rows < FEC_MIN_ROWS || i_rows > FEC_MAX_ROWS
+          || i_columns * i_rows > FEC_MAX_CELLS || !i_max_payload )
+        return NULL;
+
+    if ( pf_xor == NULL )
+        fec_Init();
+
+    p_fec = calloc( 1, sizeof(fec_t) );
+    if ( p_fec == NULL )
+        return NULL;
+    if ( posix_memalign( (void **)&p_fec->p_payloads, FEC_ALIGN,
+                         (i_columns + 1) * i_stride ) )
+    {
+        free( p_fec );
+        return NULL;
+    }
+
+    p_fec->i_columns = i_columns;
+    p_fec->i_rows = i_rows;
+    p_fec->i_max_payload = i_max_payload;
+    p_fec->pi_seqnum[FEC_COLUMN] = rand() & 0xffff;
+    p_fec->pi_seqnum[FEC_ROW] = rand() & 0xffff;
+    p_fec->row.p_payload = p_fec->p_payloads;
+    for ( i = 0; i < i_columns; i++ )
+        p_fec->p_columns[i].p_payload = p_fec->p_payloads + (i + 1) * i_stride;
+
+    return p_fec;
+}
+
+/*****************************************************************************
+ * fec_Delete
+ *****************************************************************************/
+void fec_Delete( fec_t *p_fec )
+{
+    free( p_fec->p_payloads );
+    free( p_fec );
+}
+
+/*****************************************************************************
+ * fec_Accumulate: the first datagram is copied, the next ones XORed
+ *****************************************************************************/
+static void fec_Accumulate( fec_parity_t *p_parity, const uint8_t *p_rtp_hdr,
+                            const struct iovec *p_iov, int i_iov,
+                            size_t i_size )
+{
+    uint8_t *p_dst = p_parity->p_payload;
+    size_t i_left = i_size;
+    bool b_first = !p_parity->i_count++;
+    int i;
+
+    if ( b_first )
+    {
+        p_parity->i_snbase = rtp_get_seqnum( p_rtp_hdr );
+        p_parity->i_length = i_size;
+        p_parity->i_pt = rtp_get_type( p_rtp_hdr );
+        p_parity->i_ts = rtp_get_timestamp( p_rtp_hdr );
+        p_parity->i_size = i_size;
+    }
+    else
+    {
+        p_parity->i_length ^= i_size;
+        p_parity->i_pt ^= rtp_get_type( p_rtp_hdr );
+        p_parity->i_ts ^= rtp_get_timestamp( p_rtp_hdr );
+        /* shorter payloads count as padded with zeros */
+        if ( i_size > p_parity->i_size )
+        {
+            memset( p_parity->p_payload + p_parity->i_size, 0,
+                    i_size - p_parity->i_size );
+            p_parity->i_size = i_size;
+        }
+    }
+
+    for ( i = 0; i < i_iov && i_left; i++ )
+    {
+        size_t i_len = p_iov[i].iov_len < i_left ? p_iov[i].iov_len : i_left;
+
+        if ( b_first )
+            memcpy( p_dst, p_iov[i].iov_base, i_len );
+        else
+            pf_xor( p_dst, p_iov[i].iov_base, i_len );
+        p_dst += i_len;
+        i_left -= i_len;
+    }
+}
+
+/*****************************************************************************
+ * fec_Finish: writes the RTP and FEC headers of a complete parity packet
+ *****************************************************************************/
+static void fec_Finish( fec_t *p_fec, fec_parity_t *p_parity, int i_type,
+                        uint32_t i_timestamp )
+{
+    static const uint8_t pi_ssrc[4] = { 0, 0, 0, 0 };
+    uint8_t *p_header = p_parity->p_header;
+
+    rtp_set_hdr( p_header );
+    rtp_set_type( p_header, FEC_RTP_TYPE );
+    rtp_set_seqnum( p_header, p_fec->pi_seqnum[i_type]++ );
+    rtp_set_timestamp( p_header, i_timestamp );
+    rtp_set_ssrc( p_header, pi_ssrc );
+
+    p_header += RTP_HEADER_SIZE;
+    p_header[0] = p_parity->i_snbase >> 8;
+    p_header[1] = p_parity->i_snbase & 0xff;
+    p_header[2] = p_parity->i_length >> 8;
+    p_header[3] = p_parity->i_length & 0xff;
+    p_header[4] = 0x80 | (p_parity->i_pt & 0x7f); /* E */
+    p_header[5] = p_header[6] = p_header[7] = 0; /* mask */
+    p_header[8] = p_parity->i_ts >> 24;
+    p_header[9] = (p_parity->i_ts >> 16) & 0xff;
+    p_header[10] = (p_parity->i_ts >> 8) & 0xff;
+    p_header[11] = p_parity->i_ts & 0xff;
+    /* N = 0, D = 1 for rows, type XOR, index 0 */
+    p_header[12] = i_type == FEC_ROW ? 0x40 : 0;
+    p_header[13] = i_type == FEC_ROW ? 1 : p_fec->i_columns; /* offset */
+    p_header[14] = i_type == FEC_ROW ? p_fec->i_columns : p_fec->i_rows; /* NA */
+    p_header[15] = 0; /* SNBase ext */
+
+    p_parity->i_count = 0;
+    p_fec->pp_ready[i_type] = p_parity;
+}
+
+/*****************************************************************************
+ * fec_Add: p_iov is the RTP payload of the datagram sent with p_rtp_hdr
+ *****************************************************************************/
+unsigned int fec_Add( fec_t *p_fec, const uint8_t *p_rtp_hdr,
+                      const struct iovec *p_iov, int i_iov )
+{
+    unsigned int i_column = p_fec->i_index % p_fec->i_columns;
+    unsigned int i_row = p_fec->i_index / p_fec->i_columns;
+    fec_parity_t *p_column = &p_fec->p_columns[i_column];
+    uint32_t i_timestamp = rtp_get_timestamp( p_rtp_hdr );
+    unsigned int i_ready = 0;
+    size_t i_size = 0;
+    int i;
+
+    for ( i = 0; i < i_iov; i++ )
+        i_size += p_iov[i].iov_len;
+    if ( i_size > p_fec->i_max_payload )
+        i_size = p_fec->i_max_payload;
+
+    fec_Accumulate( p_column, p_rtp_hdr, p_iov, i_iov, i_size );
+    fec_Accumulate( &p_fec->row, p_rtp_hdr, p_iov, i_iov, i_size );
+
+    if ( i_column == p_fec->i_columns - 1 )
+    {
+        fec_Finish( p_fec, &p_fec->row, FEC_ROW, i_timestamp );
+        i_ready |= 1 << FEC_ROW;
+    }
+    if ( i_row == p_fec->i_rows - 1 )
+    {
+        fec_Finish( p_fec, p_column, FEC_COLUMN, i_timestamp );
+        i_ready |= 1 << FEC_COLUMN;
+    }
+
+    if ( ++p_fec->i_index == p_fec->i_columns * p_fec->i_rows )
+        p_fec->i_index = 0;
+
+    return i_ready;
+}
+
+/*****************************************************************************
+ * fec_Get: the iovecs of a parity packet completed by the last fec_Add()
+ *****************************************************************************/
+int fec_Get( fec_t *p_fec, int i_type, struct iovec *p_iov )
+{
+    fec_parity_t *p_parity = p_fec->pp_ready[i_type];
+
+    p_iov[0].iov_base = p_parity->p_header;
+    p_iov[0].iov_len = RTP_HEADER_SIZE + FEC_HEADER_SIZE;
+    p_iov[1].iov_base = p_parity->p_payload;
+    p_iov[1].iov_len = p_parity->i_size;
+    return FEC_IOV;
+}
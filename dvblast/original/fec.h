@@ -0,0 +1,54 @@
+/*****************************************************************************
+ * fec.h: SMPTE 2022-1 FEC for the RTP outputs
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef _DVBLAST_FEC_H_
+#define _DVBLAST_FEC_H_
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define FEC_HEADER_SIZE 16
+#define FEC_RTP_TYPE 96
+#define FEC_MAX_COLUMNS 20 /* L */
+#define FEC_MIN_ROWS 4     /* D */
+#define FEC_MAX_ROWS 20
+#define FEC_MAX_CELLS 100  /* L x D */
+
+/* parity packets, sent to the media port + 2 and + 4 respectively */
+#define FEC_COLUMN 0
+#define FEC_ROW 1
+#define FEC_TYPES 2
+
+#define FEC_IOV 2 /* iovecs of a parity packet */
+
+/*****************************************************************************
+ * fec_t: the parities of the current L x D matrix. fec_Add() XORs each
+ * media datagram into its column and its row, and returns the parity
+ * packets it completed (1 << FEC_COLUMN, 1 << FEC_ROW), to be fetched with
+ * fec_Get() before the next fec_Add(). Nothing is allocated past fec_New().
+ *****************************************************************************/
+typedef struct fec_t fec_t;
+
+fec_t *fec_New( unsigned int i_columns, unsigned int i_rows,
+                size_t i_max_payload );
+void fec_Delete( fec_t *p_fec );
+unsigned int fec_Add( fec_t *p_fec, const uint8_t *p_rtp_hdr,
+                      const struct iovec *p_iov, int i_iov );
+int fec_Get( fec_t *p_fec, int i_type, struct iovec *p_iov );
+
+#endif
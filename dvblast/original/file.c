@@ -0,0 +1,677 @@
+/*****************************************************************************
+ * file.c: TS file and pcap replay input for DVBlast
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <errno.h>
+
+#include <ev.h>
+
+#include <bitstream/common.h>
+#include <bitstream/mpeg/ts.h>
+#include <bitstream/ietf/rtp.h>
+
+#include "dvblast.h"
+
+/*****************************************************************************
+ * Local declarations
+ *****************************************************************************/
+#define FILE_READ_ONCE 50 /* TS packets per read */
+#define FILE_MAX_BURST 64 /* late chunks handled per wakeup */
+#define FILE_DRAIN_PERIOD 100000 /* 100 ms */
+#define FILE_MAX_PCR_GAP INT64_C(27000000) /* 1 s, beyond is a discontinuity */
+#define PCR_WRAP ((INT64_C(1) << 33) * 300)
+
+#define PCAP_HEADER_SIZE 24
+#define PCAP_RECORD_SIZE 16
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_MAX_SNAPLEN 262144
+
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+static int i_handle = -1;
+static FILE *p_pcap_fh = NULL;
+static bool b_fast = false;
+static bool b_pcap_swapped = false;
+static bool b_pcap_nsec = false;
+static uint32_t i_linktype;
+static uint16_t i_port = 0;
+static uint8_t *p_record = NULL;
+static struct ev_timer file_watcher, drain_watcher;
+static struct ev_idle idle_watcher;
+static block_t *p_pending = NULL;
+static bool b_sync_warned = false;
+
+/* replay clock, in 27 MHz ticks since the first packet */
+static mtime_t i_start_date = 0;
+static int64_t i_clock = 0;
+static int64_t i_pcr_clock = 0;
+static int64_t i_packet_ticks = 0;
+static int64_t i_last_pcr = -1;
+static unsigned int i_pkts_since_pcr = 0;
+static uint16_t i_pcr_pid = UNUSED_PID;
+static int64_t i_first_timestamp = -1;
+
+/* statistics */
+static uint64_t i_nb_packets = 0;
+static uint64_t i_nb_records = 0;
+static mtime_t i_read_cputime = 0;
+static mtime_t i_demux_cputime = 0;
+static mtime_t i_end_date = 0;
+static uint64_t i_end_datagrams = 0;
+static mtime_t i_last_output_date = 0;
+
+/*****************************************************************************
+ * Local prototypes
+ *****************************************************************************/
+static void file_Read(struct ev_loop *loop, struct ev_timer *w, int revents);
+static void file_ReadFast(struct ev_loop *loop, struct ev_idle *w, int revents);
+static void file_DrainCb(struct ev_loop *loop, struct ev_timer *w, int revents);
+
+/*****************************************************************************
+ * file_Pcap32: pcap fields are little-endian unless the file is swapped
+ *****************************************************************************/
+static inline uint32_t file_Pcap32( const uint8_t *p )
+{
+    uint32_t i = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    return b_pcap_swapped ? __builtin_bswap32( i ) : i;
+}
+
+/*****************************************************************************
+ * file_Open
+ *****************************************************************************/
+void file_Open( void )
+{
+    char *psz_string = strdup( psz_file_src );
+    char *psz_option;
+    uint8_t p_header[PCAP_HEADER_SIZE];
+    uint32_t i_magic = 0;
+
+    /* Parse configuration. The path itself contains slashes, so options
+     * are taken from the end until a component is not an option. */
+
+    while ( (psz_option = strrchr( psz_string, '/' )) != NULL )
+    {
+        char *psz_slash = psz_option++;
+
+#define IS_OPTION( option ) (!strncasecmp( psz_option, option, strlen(option) ))
+#define ARG_OPTION( option ) (psz_option + strlen(option))
+
+        if ( IS_OPTION("fast") )
+            b_fast = true;
+        else if ( IS_OPTION("port=") )
+            i_port = strtol( ARG_OPTION("port="), NULL, 0 );
+        else
+            break;
+        *psz_slash = '\0';
+
+#undef IS_OPTION
+#undef ARG_OPTION
+    }
+
+    /* Do stuff. */
+
+    if ( (i_handle = open( psz_string, O_RDONLY )) < 0 )
+    {
+        msg_Err( NULL, "couldn't open %s (%s)", psz_string, strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+
+    /* The pcap magic is stored in the byte order of the capturing host. */
+    if ( read( i_handle, p_header, PCAP_HEADER_SIZE ) == PCAP_HEADER_SIZE )
+    {
+        i_magic = file_Pcap32( p_header );
+        if ( i_magic != PCAP_MAGIC && i_magic != PCAP_MAGIC_NSEC )
+        {
+            b_pcap_swapped = true;
+            i_magic = file_Pcap32( p_header );
+            if ( i_magic != PCAP_MAGIC && i_magic != PCAP_MAGIC_NSEC )
+            {
+                b_pcap_swapped = false;
+                i_magic = 0;
+            }
+        }
+    }
+
+    if ( i_magic )
+    {
+        b_pcap_nsec = i_magic == PCAP_MAGIC_NSEC;
+        i_linktype = file_Pcap32( p_header + 20 );
+
+        p_pcap_fh = fdopen( i_handle, "r" );
+        p_record = malloc( PCAP_MAX_SNAPLEN );
+        if ( p_pcap_fh == NULL || p_record == NULL )
+        {
+            msg_Err( NULL, "couldn't allocate pcap reader" );
+            exit(EXIT_FAILURE);
+        }
+        msg_Dbg( NULL, "replaying pcap %s (link type %"PRIu32")",
+                 psz_string, i_linktype );
+    }
+    else
+    {
+        lseek( i_handle, 0, SEEK_SET );
+        msg_Dbg( NULL, "replaying TS file %s", psz_string );
+    }
+    free( psz_string );
+
+    b_cputime = true;
+
+    if ( b_fast )
+    {
+        ev_idle_init(&idle_watcher, file_ReadFast);
+        ev_idle_start(event_loop, &idle_watcher);
+    }
+    else
+    {
+        ev_timer_init(&file_watcher, file_Read, 0, 0);
+        ev_timer_start(event_loop, &file_watcher);
+    }
+}
+
+/*****************************************************************************
+ * file_Clock: advances the replay clock along the first PCR found
+ *****************************************************************************/
+static void file_Clock( const uint8_t *p_ts )
+{
+    uint16_t i_pid = ts_get_pid( p_ts );
+    int64_t i_pcr;
+
+    i_pkts_since_pcr++;
+
+    if ( !ts_has_adaptation( p_ts ) || !ts_get_adaptation( p_ts )
+          || !tsaf_has_pcr( p_ts )
+          || (i_pcr_pid != UNUSED_PID && i_pid != i_pcr_pid) )
+    {
+        i_clock = i_pcr_clock + i_pkts_since_pcr * i_packet_ticks;
+        return;
+    }
+
+    i_pcr_pid = i_pid;
+    i_pcr = tsaf_get_pcr( p_ts ) * 300 + tsaf_get_pcrext( p_ts );
+
+    if ( i_last_pcr != -1 )
+    {
+        int64_t i_delta = (i_pcr - i_last_pcr + PCR_WRAP) % PCR_WRAP;
+
+        if ( i_delta <= FILE_MAX_PCR_GAP )
+        {
+            i_packet_ticks = i_delta / i_pkts_since_pcr;
+            i_pcr_clock += i_delta;
+        }
+        else
+        {
+            msg_Dbg( NULL, "PCR discontinuity on PID %hu", i_pid );
+            i_pcr_clock += i_pkts_since_pcr * i_packet_ticks;
+        }
+    }
+
+    i_last_pcr = i_pcr;
+    i_pkts_since_pcr = 0;
+    i_clock = i_pcr_clock;
+}
+
+/*****************************************************************************
+ * file_ReadTS: reads up to FILE_READ_ONCE packets from a TS file
+ *****************************************************************************/
+static block_t *file_ReadTS( void )
+{
+    struct iovec p_iov[FILE_READ_ONCE];
+    block_t *p_ts, **pp_current = &p_ts;
+    ssize_t i_len;
+    int i;
+
+    for ( i = 0; i < FILE_READ_ONCE; i++ )
+    {
+        *pp_current = block_New();
+        p_iov[i].iov_base = (*pp_current)->p_ts;
+        p_iov[i].iov_len = TS_SIZE;
+        pp_current = &(*pp_current)->p_next;
+    }
+
+    if ( (i_len = readv( i_handle, p_iov, FILE_READ_ONCE )) < 0 )
+    {
+        msg_Err( NULL, "couldn't read from file (%s)", strerror(errno) );
+        i_len = 0;
+    }
+    i_len /= TS_SIZE;
+
+    if ( !i_len )
+    {
+        block_DeleteChain( p_ts );
+        return NULL;
+    }
+
+    pp_current = &p_ts;
+    while ( i_len && *pp_current != NULL )
+    {
+        if ( (*pp_current)->p_ts[0] != 0x47 && !b_sync_warned )
+        {
+            msg_Warn( NULL, "file is not made of aligned 188-byte packets" );
+            b_sync_warned = true;
+        }
+        file_Clock( (*pp_current)->p_ts );
+        pp_current = &(*pp_current)->p_next;
+        i_len--;
+        i_nb_packets++;
+    }
+
+    block_DeleteChain( *pp_current );
+    *pp_current = NULL;
+    return p_ts;
+}
+
+/*****************************************************************************
+ * file_PcapPayload: strips link, IP and UDP headers, returns the UDP payload
+ *****************************************************************************/
+static const uint8_t *file_PcapPayload( const uint8_t *p_buf, size_t i_len,
+                                        size_t *pi_payload )
+{
+    uint16_t i_ethertype = 0;
+    size_t i_udp_len;
+
+    switch ( i_linktype )
+    {
+    case LINKTYPE_NULL:
+        if ( i_len < 4 )
+            return NULL;
+        /* address family in the capturing host's byte order */
+        i_ethertype = (p_buf[0] == 2 || p_buf[3] == 2) ? 0x0800 : 0x86dd;
+        p_buf += 4; i_len -= 4;
+        break;
+
+    case LINKTYPE_ETHERNET:
+        if ( i_len < 14 )
+            return NULL;
+        i_ethertype = (p_buf[12] << 8) | p_buf[13];
+        p_buf += 14; i_len -= 14;
+        while ( (i_ethertype == 0x8100 || i_ethertype == 0x88a8)
+                 && i_len >= 4 )
+        {
+            i_ethertype = (p_buf[2] << 8) | p_buf[3];
+            p_buf += 4; i_len -= 4;
+        }
+        break;
+
+    case LINKTYPE_LINUX_SLL:
+        if ( i_len < 16 )
+            return NULL;
+        i_ethertype = (p_buf[14] << 8) | p_buf[15];
+        p_buf += 16; i_len -= 16;
+        break;
+
+    case LINKTYPE_LINUX_SLL2:
+        if ( i_len < 20 )
+            return NULL;
+        i_ethertype = (p_buf[0] << 8) | p_buf[1];
+        p_buf += 20; i_len -= 20;
+        break;
+
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+    case LINKTYPE_IPV6:
+        if ( i_len < 1 )
+            return NULL;
+        i_ethertype = (p_buf[0] >> 4) == 4 ? 0x0800 : 0x86dd;
+        break;
+
+    default:
+        return NULL;
+    }
+
+    if ( i_ethertype == 0x0800 )
+    {
+        size_t i_hdr, i_total;
+
+        if ( i_len < 20 || (p_buf[0] >> 4) != 4 || p_buf[9] != 17 )
+            return NULL;
+        /* fragments are not reassembled */
+        if ( (p_buf[6] & 0x3f) || p_buf[7] )
+            return NULL;
+        i_hdr = (p_buf[0] & 0xf) * 4;
+        i_total = (p_buf[2] << 8) | p_buf[3];
+        if ( i_total < i_len )
+            i_len = i_total;
+        if ( i_hdr < 20 || i_len < i_hdr )
+            return NULL;
+        p_buf += i_hdr; i_len -= i_hdr;
+    }
+    else if ( i_ethertype == 0x86dd )
+    {
+        size_t i_payload;
+
+        /* extension headers are not supported */
+        if ( i_len < 40 || (p_buf[0] >> 4) != 6 || p_buf[6] != 17 )
+            return NULL;
+        i_payload = (p_buf[4] << 8) | p_buf[5];
+        p_buf += 40; i_len -= 40;
+        if ( i_payload < i_len )
+            i_len = i_payload;
+    }
+    else
+        return NULL;
+
+    if ( i_len < 8 )
+        return NULL;
+    if ( i_port && ((p_buf[2] << 8) | p_buf[3]) != i_port )
+        return NULL;
+    i_udp_len = (p_buf[4] << 8) | p_buf[5];
+    if ( i_udp_len < 8 || i_udp_len > i_len )
+        return NULL;
+
+    *pi_payload = i_udp_len - 8;
+    return p_buf + 8;
+}
+
+/*****************************************************************************
+ * file_PcapTS: skips the RTP header if any, returns the first TS packet
+ *****************************************************************************/
+static const uint8_t *file_PcapTS( const uint8_t *p_buf, size_t *pi_len )
+{
+    size_t i_len = *pi_len;
+    size_t i_hdr;
+
+    if ( i_len >= TS_SIZE && p_buf[0] == 0x47 && !(i_len % TS_SIZE) )
+        return p_buf;
+
+    if ( i_len < RTP_HEADER_SIZE || (p_buf[0] & 0xc0) != 0x80 )
+        return NULL;
+
+    i_hdr = RTP_HEADER_SIZE + 4 * (p_buf[0] & 0xf);
+    if ( (p_buf[0] & 0x10) && i_hdr + 4 <= i_len )
+        i_hdr += 4 + 4 * ((p_buf[i_hdr + 2] << 8) | p_buf[i_hdr + 3]);
+    if ( p_buf[0] & 0x20 )
+    {
+        /* the padding count can't be 0 nor eat into the header */
+        size_t i_padding = p_buf[i_len - 1];
+        if ( i_hdr >= i_len || !i_padding || i_padding > i_len - i_hdr )
+            return NULL;
+        i_len -= i_padding;
+    }
+
+    if ( i_hdr >= i_len || p_buf[i_hdr] != 0x47 )
+        return NULL;
+
+    *pi_len = (i_len - i_hdr) / TS_SIZE * TS_SIZE;
+    return p_buf + i_hdr;
+}
+
+/*****************************************************************************
+ * file_ReadPcap: reads capture records until i_wanted packets are found
+ *****************************************************************************/
+static block_t *file_ReadPcap( int i_wanted )
+{
+    block_t *p_ts = NULL, **pp_current = &p_ts;
+    int i_found = 0;
+
+    while ( i_found < i_wanted )
+    {
+        uint8_t p_hdr[PCAP_RECORD_SIZE];
+        uint32_t i_caplen;
+        int64_t i_timestamp;
+        const uint8_t *p_payload;
+        size_t i_len;
+
+        if ( fread( p_hdr, PCAP_RECORD_SIZE, 1, p_pcap_fh ) != 1 )
+            break;
+        i_caplen = file_Pcap32( p_hdr + 8 );
+        if ( i_caplen > PCAP_MAX_SNAPLEN )
+        {
+            msg_Err( NULL, "invalid pcap record length %"PRIu32, i_caplen );
+            break;
+        }
+        if ( fread( p_record, 1, i_caplen, p_pcap_fh ) != i_caplen )
+            break;
+
+        p_payload = file_PcapPayload( p_record, i_caplen, &i_len );
+        if ( p_payload == NULL
+              || (p_payload = file_PcapTS( p_payload, &i_len )) == NULL )
+            continue;
+
+        i_timestamp = (int64_t)file_Pcap32( p_hdr ) * 1000000
+                       + (b_pcap_nsec ? file_Pcap32( p_hdr + 4 ) / 1000
+                                      : file_Pcap32( p_hdr + 4 ));
+        if ( i_first_timestamp == -1 )
+            i_first_timestamp = i_timestamp;
+        if ( i_timestamp >= i_first_timestamp )
+            i_clock = (i_timestamp - i_first_timestamp) * 27;
+        i_nb_records++;
+
+        for ( ; i_len >= TS_SIZE; i_len -= TS_SIZE, p_payload += TS_SIZE )
+        {
+            *pp_current = block_New();
+            memcpy( (*pp_current)->p_ts, p_payload, TS_SIZE );
+            pp_current = &(*pp_current)->p_next;
+            i_found++;
+        }
+    }
+
+    i_nb_packets += i_found;
+    return p_ts;
+}
+
+/*****************************************************************************
+ * file_ReadChunk
+ *****************************************************************************/
+static block_t *file_ReadChunk( void )
+{
+    mtime_t i_cputime = mcputime();
+    block_t *p_ts;
+
+    if ( p_pcap_fh != NULL )
+        p_ts = file_ReadPcap( b_fast ? FILE_READ_ONCE : 1 );
+    else
+        p_ts = file_ReadTS();
+
+    i_read_cputime += mcputime() - i_cputime;
+    return p_ts;
+}
+
+/*****************************************************************************
+ * file_Demux
+ *****************************************************************************/
+static void file_Demux( block_t *p_ts )
+{
+    mtime_t i_cputime = mcputime();
+    demux_Run( p_ts );
+    i_demux_cputime += mcputime() - i_cputime;
+}
+
+/*****************************************************************************
+ * file_End: stops reading and lets the outputs drain their queues
+ *****************************************************************************/
+static void file_End( struct ev_loop *loop )
+{
+    mtime_t i_cputime;
+
+    if ( b_fast )
+        ev_idle_stop(loop, &idle_watcher);
+    else
+        ev_timer_stop(loop, &file_watcher);
+
+    if ( p_pcap_fh != NULL )
+        fclose( p_pcap_fh );
+    else
+        close( i_handle );
+    p_pcap_fh = NULL;
+    i_handle = -1;
+
+    i_end_date = i_last_output_date = mdate();
+    outputs_GetStats( &i_end_datagrams, &i_cputime );
+    msg_Info( NULL, "end of file, draining outputs" );
+
+    ev_timer_init(&drain_watcher, file_DrainCb,
+                  FILE_DRAIN_PERIOD / 1000000., FILE_DRAIN_PERIOD / 1000000.);
+    ev_timer_start(loop, &drain_watcher);
+}
+
+/*****************************************************************************
+ * file_Report: throughput and per-stage CPU time of the whole replay
+ *****************************************************************************/
+static void file_Report( void )
+{
+    uint64_t i_datagrams;
+    mtime_t i_output_cputime;
+    mtime_t i_elapsed = i_end_date - i_start_date;
+    mtime_t i_output_elapsed = i_last_output_date - i_start_date;
+    uint64_t i_packets_per_s, i_outputs_per_s;
+
+    outputs_GetStats( &i_datagrams, &i_output_cputime );
+    if ( i_elapsed <= 0 )
+        i_elapsed = 1;
+    if ( i_output_elapsed <= 0 )
+        i_output_elapsed = 1;
+    i_packets_per_s = i_nb_packets * 1000000 / i_elapsed;
+    i_outputs_per_s = i_datagrams * 1000000 / i_output_elapsed;
+
+    msg_Info( NULL, "replayed %"PRIu64" packets in %"PRId64" ms",
+              i_nb_packets, i_elapsed / 1000 );
+
+    switch (i_print_type)
+    {
+    case PRINT_XML:
+        fprintf(print_fh,
+                "<STATUS type=\"replay\" packets=\"%"PRIu64"\" records=\"%"PRIu64"\" elapsed_us=\"%"PRId64"\" packets_per_s=\"%"PRIu64"\" outputs=\"%"PRIu64"\" outputs_per_s=\"%"PRIu64"\" read_cpu_us=\"%"PRId64"\" demux_cpu_us=\"%"PRId64"\" output_cpu_us=\"%"PRId64"\" />\n",
+                i_nb_packets, i_nb_records, i_elapsed, i_packets_per_s,
+                i_datagrams, i_outputs_per_s,
+                i_read_cputime, i_demux_cputime, i_output_cputime);
+        break;
+    case PRINT_TEXT:
+        fprintf(print_fh, "replay packets: %"PRIu64" elapsed: %"PRId64" ms packets/s: %"PRIu64"\n",
+                i_nb_packets, i_elapsed / 1000, i_packets_per_s);
+        fprintf(print_fh, "replay outputs: %"PRIu64" outputs/s: %"PRIu64"\n",
+                i_datagrams, i_outputs_per_s);
+        fprintf(print_fh, "replay cpu read: %"PRId64" ms (%"PRId64"%%) demux: %"PRId64" ms (%"PRId64"%%) output: %"PRId64" ms (%"PRId64"%%)\n",
+                i_read_cputime / 1000, i_read_cputime * 100 / i_elapsed,
+                i_demux_cputime / 1000, i_demux_cputime * 100 / i_elapsed,
+                i_output_cputime / 1000, i_output_cputime * 100 / i_elapsed);
+        break;
+    default:
+        break;
+    }
+}
+
+/*****************************************************************************
+ * File events
+ *****************************************************************************/
+static void file_Read(struct ev_loop *loop, struct ev_timer *w, int revents)
+{
+    int i;
+
+    if ( !i_start_date )
+        i_start_date = mdate();
+
+    for ( i = 0; i < FILE_MAX_BURST; i++ )
+    {
+        mtime_t i_date;
+
+        if ( p_pending == NULL
+              && (p_pending = file_ReadChunk()) == NULL )
+        {
+            file_End( loop );
+            return;
+        }
+
+        i_date = i_start_date + i_clock / 27;
+        i_wallclock = mdate();
+        if ( i_date > i_wallclock )
+        {
+            ev_timer_set(w, (i_date - i_wallclock) / 1000000., 0);
+            ev_timer_start(loop, w);
+            return;
+        }
+
+        file_Demux( p_pending );
+        p_pending = NULL;
+    }
+
+    /* we are late, give the outputs a chance to run */
+    ev_timer_set(w, 0, 0);
+    ev_timer_start(loop, w);
+}
+
+static void file_ReadFast(struct ev_loop *loop, struct ev_idle *w, int revents)
+{
+    block_t *p_ts;
+
+    if ( !i_start_date )
+        i_start_date = mdate();
+
+    if ( (p_ts = file_ReadChunk()) == NULL )
+    {
+        file_End( loop );
+        return;
+    }
+    file_Demux( p_ts );
+}
+
+static void file_DrainCb(struct ev_loop *loop, struct ev_timer *w, int revents)
+{
+    uint64_t i_datagrams;
+    mtime_t i_cputime;
+
+    outputs_GetStats( &i_datagrams, &i_cputime );
+    if ( i_datagrams != i_end_datagrams )
+    {
+        i_end_datagrams = i_datagrams;
+        i_last_output_date = mdate();
+        return;
+    }
+
+    ev_timer_stop(loop, w);
+    file_Report();
+    ev_break(loop, EVBREAK_ALL);
+}
+
+/*****************************************************************************
+ * file_SetFilter
+ *****************************************************************************/
+int file_SetFilter( uint16_t i_pid )
+{
+    return -1;
+}
+
+/*****************************************************************************
+ * file_UnsetFilter: normally never called
+ *****************************************************************************/
+void file_UnsetFilter( int i_fd, uint16_t i_pid )
+{
+}
+
+/*****************************************************************************
+ * file_Reset:
+ *****************************************************************************/
+void file_Reset( void )
+{
+}
@@ -0,0 +1,146 @@
+/*****************************************************************************
+ * metrics.c: registry of counters and histograms, kept per thread
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "dvblast.h"
+#include "metrics.h"
+
+#define METRICS_MAX_THREADS 64
+#define METRICS_CACHELINE 64
+
+__thread metrics_thread_t *p_metrics_thread = NULL;
+
+/* a block is never freed, so that the metrics of the threads which exited
+ * are still counted */
+static _Atomic(metrics_thread_t *) pp_metrics_threads[METRICS_MAX_THREADS];
+static atomic_uint i_nb_metrics_threads;
+static metrics_thread_t metrics_shared = { .b_shared = true };
+
+/*****************************************************************************
+ * metrics_Register: called on the first update of a thread
+ *****************************************************************************/
+metrics_thread_t *metrics_Register( void )
+{
+    metrics_thread_t *p_thread;
+    unsigned int i_slot;
+
+    if ( posix_memalign( (void **)&p_thread, METRICS_CACHELINE,
+                         sizeof(metrics_thread_t) ) )
+    {
+        p_metrics_thread = &metrics_shared;
+        return p_metrics_thread;
+    }
+    memset( p_thread, 0, sizeof(metrics_thread_t) );
+
+    i_slot = atomic_fetch_add( &i_nb_metrics_threads, 1 );
+    if ( i_slot >= METRICS_MAX_THREADS )
+    {
+        free( p_thread );
+        p_metrics_thread = &metrics_shared;
+        return p_metrics_thread;
+    }
+
+    atomic_store_explicit( &pp_metrics_threads[i_slot], p_thread,
+                           memory_order_release );
+    p_metrics_thread = p_thread;
+    return p_thread;
+}
+
+/*****************************************************************************
+ * metrics_Next: iterates over the registered blocks, the shared one last
+ *****************************************************************************/
+static metrics_thread_t *metrics_Next( unsigned int *pi_slot )
+{
+    unsigned int i_nb = atomic_load( &i_nb_metrics_threads );
+
+    if ( i_nb > METRICS_MAX_THREADS )
+        i_nb = METRICS_MAX_THREADS;
+
+    while ( *pi_slot < i_nb )
+    {
+        metrics_thread_t *p_thread =
+            atomic_load_explicit( &pp_metrics_threads[(*pi_slot)++],
+                                  memory_order_acquire );
+        /* NULL while the thread which took the slot is still setting up */
+        if ( p_thread != NULL )
+            return p_thread;
+    }
+
+    if ( *pi_slot == i_nb )
+    {
+        (*pi_slot)++;
+        return &metrics_shared;
+    }
+    return NULL;
+}
+
+/*****************************************************************************
+ * metrics_ReadCounters: the counters only, for the periodic print
+ *****************************************************************************/
+void metrics_ReadCounters( uint64_t *pi_counters )
+{
+    metrics_thread_t *p_thread;
+    unsigned int i_slot = 0;
+    int i;
+
+    memset( pi_counters, 0, METRIC_COUNT * sizeof(uint64_t) );
+    while ( (p_thread = metrics_Next( &i_slot )) != NULL )
+        for ( i = 0; i < METRIC_COUNT; i++ )
+            pi_counters[i] += atomic_load_explicit( &p_thread->pi_counters[i],
+                                                    memory_order_relaxed );
+}
+
+/*****************************************************************************
+ * metrics_Snapshot
+ *****************************************************************************/
+void metrics_Snapshot( metrics_snapshot_t *p_snapshot )
+{
+    metrics_thread_t *p_thread;
+    unsigned int i_slot = 0;
+    int i, j;
+
+    memset( p_snapshot, 0, sizeof(metrics_snapshot_t) );
+    p_snapshot->i_version = METRICS_VERSION;
+    p_snapshot->i_nb_counters = METRIC_COUNT;
+    p_snapshot->i_nb_histograms = HISTOGRAM_COUNT;
+    p_snapshot->i_nb_buckets = METRICS_BUCKETS;
+    p_snapshot->i_time = mdate();
+
+    while ( (p_thread = metrics_Next( &i_slot )) != NULL )
+    {
+        if ( !p_thread->b_shared )
+            p_snapshot->i_nb_threads++;
+
+        for ( i = 0; i < METRIC_COUNT; i++ )
+            p_snapshot->pi_counters[i] +=
+                atomic_load_explicit( &p_thread->pi_counters[i],
+                                      memory_order_relaxed );
+
+        for ( i = 0; i < HISTOGRAM_COUNT; i++ )
+            for ( j = 0; j < METRICS_BUCKETS; j++ )
+                p_snapshot->pi_histograms[i][j] +=
+                    atomic_load_explicit( &p_thread->pi_histograms[i][j],
+                                          memory_order_relaxed );
+    }
+}
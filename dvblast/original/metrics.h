@@ -0,0 +1,186 @@
+/*****************************************************************************
+ * metrics.h: registry of counters and histograms, kept per thread
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef _DVBLAST_METRICS_H_
+#define _DVBLAST_METRICS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*****************************************************************************
+ * Metrics, in the order of the snapshot. New ones go at the end, so that an
+ * older dvblastctl still prints the ones it knows.
+ *****************************************************************************/
+#define METRICS_COUNTERS(X) \
+    X(TS_PACKETS,         "ts_packets") \
+    X(TS_INVALIDS,        "ts_invalids") \
+    X(TS_DISCONTINUITIES, "ts_discontinuities") \
+    X(TS_ERRORS,          "ts_errors") \
+    X(PSI_CACHE_HITS,     "psi_cache_hits") \
+    X(PSI_CACHE_MISSES,   "psi_cache_misses") \
+    X(OUTPUT_SYSCALLS,    "output_syscalls") \
+    X(OUTPUT_DATAGRAMS,   "output_datagrams") \
+    X(OUTPUT_ERRORS,      "output_errors") \
+    X(OUTPUT_FEC_PACKETS, "output_fec_packets")
+
+#define METRICS_HISTOGRAMS(X) \
+    X(INPUT_BATCH,        "input_batch")   /* packets per demux_Run */ \
+    X(OUTPUT_BATCH,       "output_batch")  /* datagrams per send call */ \
+    X(OUTPUT_LATE,        "output_late")   /* us between due and sent */
+
+#define METRICS_ENUM_COUNTER(name, psz) METRIC_##name,
+#define METRICS_ENUM_HISTOGRAM(name, psz) HISTOGRAM_##name,
+
+typedef enum {
+    METRICS_COUNTERS(METRICS_ENUM_COUNTER)
+    METRIC_COUNT
+} metric_t;
+
+typedef enum {
+    METRICS_HISTOGRAMS(METRICS_ENUM_HISTOGRAM)
+    HISTOGRAM_COUNT
+} histogram_t;
+
+#undef METRICS_ENUM_COUNTER
+#undef METRICS_ENUM_HISTOGRAM
+
+/*****************************************************************************
+ * Histogram buckets are log-linear: values below METRICS_SUB have their own
+ * bucket, then each power of two is split in METRICS_SUB buckets (at most
+ * 12.5% wide). Values of 2^26 (about 67 s in us) and more share the last one.
+ *****************************************************************************/
+#define METRICS_SUB_BITS 3
+#define METRICS_SUB (1 << METRICS_SUB_BITS)
+#define METRICS_BUCKETS 192
+
+static inline unsigned int metrics_Bucket( uint64_t i_value )
+{
+    unsigned int i_exp, i_bucket;
+
+    if ( i_value < METRICS_SUB )
+        return i_value;
+
+    i_exp = 63 - __builtin_clzll( i_value );
+    i_bucket = (i_exp - METRICS_SUB_BITS + 1) * METRICS_SUB
+                + ((i_value >> (i_exp - METRICS_SUB_BITS)) & (METRICS_SUB - 1));
+    return i_bucket < METRICS_BUCKETS ? i_bucket : METRICS_BUCKETS - 1;
+}
+
+/* lowest value falling in the bucket */
+static inline uint64_t metrics_BucketLow( unsigned int i_bucket )
+{
+    unsigned int i_exp;
+
+    if ( i_bucket < METRICS_SUB )
+        return i_bucket;
+
+    i_exp = i_bucket / METRICS_SUB + METRICS_SUB_BITS - 1;
+    return (uint64_t)(METRICS_SUB + i_bucket % METRICS_SUB)
+            << (i_exp - METRICS_SUB_BITS);
+}
+
+/* lowest value of the bucket holding the given fraction of the samples */
+static inline uint64_t metrics_Quantile( const uint64_t *pi_buckets,
+                                         unsigned int i_nb_buckets,
+                                         uint64_t i_count, double f_quantile )
+{
+    uint64_t i_rank = f_quantile * i_count, i_seen = 0;
+    unsigned int i;
+
+    for ( i = 0; i < i_nb_buckets; i++ )
+    {
+        i_seen += pi_buckets[i];
+        if ( i_seen > i_rank )
+            return metrics_BucketLow( i );
+    }
+    return i_nb_buckets ? metrics_BucketLow( i_nb_buckets - 1 ) : 0;
+}
+
+/*****************************************************************************
+ * metrics_snapshot_t: answer to CMD_GET_METRICS, the sum over all threads
+ * since startup
+ *****************************************************************************/
+#define METRICS_VERSION 1
+
+typedef struct metrics_snapshot_t
+{
+    uint32_t i_version;
+    uint16_t i_nb_counters;   /* METRIC_COUNT of the sender */
+    uint16_t i_nb_histograms; /* HISTOGRAM_COUNT of the sender */
+    uint16_t i_nb_buckets;    /* METRICS_BUCKETS of the sender */
+    uint16_t i_nb_threads;
+    uint32_t i_reserved;
+    int64_t i_time;           /* mdate() of the snapshot */
+    uint64_t pi_counters[METRIC_COUNT];
+    uint64_t pi_histograms[HISTOGRAM_COUNT][METRICS_BUCKETS];
+} metrics_snapshot_t;
+
+/*****************************************************************************
+ * metrics_thread_t: the metrics of one thread. They are only ever written by
+ * that thread, so updating them is a plain load and store, without a locked
+ * instruction or a shared cache line; readers sum them up without stopping
+ * anybody.
+ *****************************************************************************/
+typedef struct metrics_thread_t
+{
+    atomic_uint_fast64_t pi_counters[METRIC_COUNT];
+    atomic_uint_fast64_t pi_histograms[HISTOGRAM_COUNT][METRICS_BUCKETS];
+    bool b_shared; /* fallback block once too many threads registered */
+} metrics_thread_t;
+
+extern __thread metrics_thread_t *p_metrics_thread;
+
+metrics_thread_t *metrics_Register( void );
+void metrics_ReadCounters( uint64_t *pi_counters );
+void metrics_Snapshot( metrics_snapshot_t *p_snapshot );
+
+static inline void metrics_Increment( metrics_thread_t *p_thread,
+                                      atomic_uint_fast64_t *p_value,
+                                      uint64_t i_add )
+{
+    if ( p_thread->b_shared )
+        atomic_fetch_add_explicit( p_value, i_add, memory_order_relaxed );
+    else
+        atomic_store_explicit( p_value,
+                atomic_load_explicit( p_value, memory_order_relaxed ) + i_add,
+                memory_order_relaxed );
+}
+
+static inline void metrics_Add( metric_t i_metric, uint64_t i_add )
+{
+    metrics_thread_t *p_thread = p_metrics_thread;
+
+    if ( p_thread == NULL )
+        p_thread = metrics_Register();
+    metrics_Increment( p_thread, &p_thread->pi_counters[i_metric], i_add );
+}
+
+static inline void metrics_Observe( histogram_t i_histogram, int64_t i_value )
+{
+    metrics_thread_t *p_thread = p_metrics_thread;
+
+    if ( p_thread == NULL )
+        p_thread = metrics_Register();
+    metrics_Increment( p_thread,
+        &p_thread->pi_histograms[i_histogram]
+                                [metrics_Bucket( i_value > 0 ? i_value : 0 )],
+        1 );
+}
+
+#endif
@@ -34,6 +34,7 @@
 #include <sys/time.h>
 
 #include "dvblast.h"
+#include "ts-batch.h"
 
 // File handle
 static FILE *mrtg_fh = NULL;
@@ -74,52 +75,42 @@ static void dumpCounts()
     }
 }
 
-// analyse the input block counting packets and errors
-// The input is a pointer to a block_t structure, which might be a linked list
-// of blocks. Each block has one TS packet.
-void mrtgAnalyse(block_t * p_ts)
+// analyse the input batch counting packets and errors
+// The headers have already been decoded by tsbatch_Parse(), the packets
+// themselves are not read here.
+void mrtgAnalyse(const ts_batch_t *p_batch)
 {
-    unsigned int i_pid;
-    block_t *p_block = p_ts;
+    unsigned int i;
 
     if (mrtg_fh == NULL) return;
 
-    while (p_block != NULL) {
-        uint8_t *ts_packet = p_block->p_ts;
+    for (i = 0; i < p_batch->i_size; i++) {
+        uint16_t i_pid = p_batch->pi_pid[i];
+        uint8_t i_flags = p_batch->pi_flags[i];
 
         char i_seq, i_last_seq;
         l_mrtg_packets++;
 
-        if (ts_packet[0] != 0x47) {
+        if (i_flags & (TS_BATCH_INVALID | TS_BATCH_TEI)) {
             l_mrtg_error_packets++;
-            p_block = p_block->p_next;
             continue;
         }
 
-        if (ts_packet[1] & 0x80) {
-            l_mrtg_error_packets++;
-            p_block = p_block->p_next;
-            continue;
-        }
-
-        i_pid = (ts_packet[1] & 0x1f) << 8 | ts_packet[2];
-
         // Just count null packets - don't check the sequence numbering
         if (i_pid == 0x1fff) {
-            p_block = p_block->p_next;
             continue;
         }
 
-        if (ts_packet[3] & 0xc0) {
+        if (i_flags & TS_BATCH_SCRAMBLING) {
             l_mrtg_scram_packets++;
         }
         // Check the sequence numbering
-        i_seq = ts_packet[3] & 0xf;
+        i_seq = p_batch->pi_cc[i];
         i_last_seq = i_pid_seq[i_pid];
 
         if (i_last_seq == -1) {
             // First packet - ignore the sequence
-        } else if (ts_packet[3] & 0x10) {
+        } else if (i_flags & TS_BATCH_PAYLOAD) {
             // Packet contains payload - sequence should be up by one
             if (i_seq != ((i_last_seq + 1) & 0x0f)) {
                 l_mrtg_seq_err_packets++;
@@ -131,9 +122,6 @@ void mrtgAnalyse(block_t * p_ts)
             }
         }
         i_pid_seq[i_pid] = i_seq;
-
-        // Look at next block
-        p_block = p_block->p_next;
     }
 
     // All blocks processed. See if we need to dump the stats
@@ -27,6 +27,7 @@
 
 int mrtgInit(char *mrtg_file);
 void mrtgClose();
-void mrtgAnalyse(block_t * p_ts);
+struct ts_batch_t;
+void mrtgAnalyse(const struct ts_batch_t *p_batch);
 
 #endif
@@ -1,4 +1,5 @@
 //{{{  includes
+#define _GNU_SOURCE /* sendmmsg */
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
@@ -11,25 +12,128 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/un.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <ev.h>
 
 #include "dvblast.h"
+#include "ring.h"
+#include "shm-ring.h"
+#include "recorder.h"
+#include "fec.h"
+#include "metrics.h"
 
 #include <bitstream/mpeg/ts.h>
 #include <bitstream/ietf/rtp.h>
 //}}}
 
 #define MAX_PACKETS 100
+#define MAX_SEND_BATCH 64    /* datagrams per sendmmsg() */
+#define MAX_SEND_IOV 1024    /* iovecs shared by a whole batch */
+#define OUTPUT_QUEUE_SIZE 4096   /* blocks queued from the demux per output */
+#define RELEASE_RING_SIZE 65536  /* sent blocks queued back to the demux */
+#define MAX_JITTER 1000000       /* larger PCR steps are discontinuities */
+#define PACING_RATE_PERIOD 100000 /* dts span of a bitrate measurement */
+#define PACING_MAX_LATE 50000     /* further behind, pacing lets it catch up */
+
+int i_output_threads = 0;
+
+static struct ev_timer print_watcher;
+
+/* Outputs with queued packets, in a binary min-heap keyed on the deadline
+ * of their first packet. The timer is re-armed at most once per loop
+ * iteration, from the prepare watcher. */
+typedef struct sched_entry_t
+{
+    mtime_t i_deadline;
+    output_t *p_output;
+} sched_entry_t;
+
+typedef struct output_sched_t
+{
+    sched_entry_t *p_heap;
+    int i_size, i_alloc;
+    mtime_t i_armed; /* deadline the timer is set for, INT64_MAX if stopped */
+    struct ev_timer send_watcher;
+    struct ev_prepare prepare_watcher;
+} output_sched_t;
+
+/* An output worker owns the packet lists, the send heap and the sockets of
+ * its outputs. Without --output-threads there is a single worker running
+ * inline on the main loop. Otherwise each worker has its own thread and
+ * loop: the demux hands blocks over through one SPSC ring per output, and
+ * the worker hands them back through release_ring once sent, so that the
+ * block refcounts and the block allocator stay on the demux thread. */
+typedef struct output_worker_t
+{
+    /* read-only once started */
+    int i_id;
+    bool b_thread;
+    struct ev_loop *p_loop;
+    pthread_t thread;
+    clockid_t cpu_clock;
+    bool b_cpu_clock;
+
+    /* held by the worker except while it waits for events, the demux
+     * thread takes it to add, change or remove outputs */
+    pthread_mutex_t lock;
+    output_t **pp_outputs;
+    int i_nb_outputs;
+
+    struct ev_async wake_watcher;
+    atomic_bool b_die;
+    bool b_wake; /* demux side: blocks queued since the last wake-up */
+
+    ring_t release_ring;
+    block_t **pp_deferred; /* worker side: release_ring was full */
+    int i_nb_deferred, i_max_deferred;
+
+    output_sched_t sched;
+    mtime_t i_wallclock;
+
+    /* batch send state, filled for one output at a time */
+    struct iovec p_batch_iov[MAX_SEND_IOV];
+    uint8_t pp_batch_rtp[MAX_SEND_BATCH][RTP_HEADER_SIZE];
+    /* remapped TS headers, indexed like the iovec pointing to them */
+    uint8_t pp_batch_ts_hdr[MAX_SEND_IOV][TS_HEADER_SIZE];
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr p_batch_msgs[MAX_SEND_BATCH];
+    bool b_sendmmsg;
+#endif
+
+    /* send statistics since startup */
+    atomic_uint_fast64_t i_send_syscalls;
+    atomic_uint_fast64_t i_send_datagrams;
+    mtime_t i_send_cputime; /* once inline, see worker_CPUTime() */
+
+    /* main thread, for the periodic print */
+    uint64_t i_print_datagrams;
+    mtime_t i_print_cputime;
+} output_worker_t;
+
+static output_worker_t **pp_workers = NULL;
+static int i_nb_workers = 0;
+static struct ev_prepare signal_watcher;
+static struct ev_async release_watcher;
 
-static struct ev_timer output_watcher;
-static mtime_t i_next_send = INT64_MAX;
+static uint64_t i_print_syscalls = 0;
+static uint64_t i_print_datagrams = 0;
+
+/* upper bounds of the gap histogram bins, in us */
+static const mtime_t pi_gap_bins[OUTPUT_GAP_BINS - 1] = {
+    50, 100, 200, 500, 1000, 2000, 5000
+};
 
 //{{{
 struct packet_t
 {
     struct packet_t *p_next;
     mtime_t i_dts;
+    mtime_t i_pcr; /* PCR of the jitter PID in us, -1 if none */
     int i_depth;
     block_t *pp_blocks[];
 };
@@ -98,6 +202,76 @@ static void RawFillHeaders(struct udprawpkt *dgram,
 }
 //}}}
 //{{{
+static void sched_Set( output_sched_t *p_sched, int i, mtime_t i_deadline,
+                       output_t *p_output )
+{
+    p_sched->p_heap[i].i_deadline = i_deadline;
+    p_sched->p_heap[i].p_output = p_output;
+    p_output->i_sched_index = i;
+}
+//}}}
+//{{{
+static void sched_SiftUp( output_sched_t *p_sched, int i )
+{
+    sched_entry_t entry = p_sched->p_heap[i];
+
+    while ( i > 0 )
+    {
+        int i_parent = (i - 1) / 2;
+        if ( p_sched->p_heap[i_parent].i_deadline <= entry.i_deadline )
+            break;
+        sched_Set( p_sched, i, p_sched->p_heap[i_parent].i_deadline,
+                   p_sched->p_heap[i_parent].p_output );
+        i = i_parent;
+    }
+    sched_Set( p_sched, i, entry.i_deadline, entry.p_output );
+}
+//}}}
+//{{{
+static void sched_SiftDown( output_sched_t *p_sched, int i )
+{
+    sched_entry_t entry = p_sched->p_heap[i];
+
+    for ( ; ; )
+    {
+        int i_child = 2 * i + 1;
+        if ( i_child >= p_sched->i_size )
+            break;
+        if ( i_child + 1 < p_sched->i_size
+              && p_sched->p_heap[i_child + 1].i_deadline
+                  < p_sched->p_heap[i_child].i_deadline )
+            i_child++;
+        if ( entry.i_deadline <= p_sched->p_heap[i_child].i_deadline )
+            break;
+        sched_Set( p_sched, i, p_sched->p_heap[i_child].i_deadline,
+                   p_sched->p_heap[i_child].p_output );
+        i = i_child;
+    }
+    sched_Set( p_sched, i, entry.i_deadline, entry.p_output );
+}
+//}}}
+//{{{
+static void sched_Remove( output_sched_t *p_sched, output_t *p_output )
+{
+    int i = p_output->i_sched_index;
+    sched_entry_t last;
+
+    if ( i < 0 )
+        return;
+    p_output->i_sched_index = -1;
+
+    last = p_sched->p_heap[--p_sched->i_size];
+    if ( i == p_sched->i_size )
+        return;
+
+    sched_Set( p_sched, i, last.i_deadline, last.p_output );
+    if ( i > 0 && p_sched->p_heap[(i - 1) / 2].i_deadline > last.i_deadline )
+        sched_SiftUp( p_sched, i );
+    else
+        sched_SiftDown( p_sched, i );
+}
+//}}}
+//{{{
 static int output_BlockCount( output_t *p_output )
 {
     int i_mtu = p_output->config.i_mtu;
@@ -106,6 +280,332 @@ static int output_BlockCount( output_t *p_output )
     return i_mtu / TS_SIZE;
 }
 //}}}
+//{{{
+/*****************************************************************************
+ * output_PacingRefill: the bucket holds i_pacing_burst full datagrams and
+ * fills at the rate of the dts
+ *****************************************************************************/
+static void output_PacingRefill( output_t *p_output, mtime_t i_now )
+{
+    double f_max = (double)p_output->config.i_pacing_burst
+                    * output_BlockCount( p_output ) * TS_SIZE;
+
+    if ( i_now > p_output->i_pacing_time )
+    {
+        p_output->f_pacing_tokens += (i_now - p_output->i_pacing_time)
+                                      * p_output->f_pacing_rate;
+        p_output->i_pacing_time = i_now;
+    }
+    if ( p_output->f_pacing_tokens > f_max )
+        p_output->f_pacing_tokens = f_max;
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * output_PacingDeadline: when the bucket will hold enough for the packet
+ *****************************************************************************/
+static mtime_t output_PacingDeadline( output_t *p_output, packet_t *p_packet )
+{
+    mtime_t i_deadline = p_packet->i_dts + p_output->config.i_output_latency;
+    double f_missing = p_packet->i_depth * TS_SIZE - p_output->f_pacing_tokens;
+    mtime_t i_ready;
+
+    if ( !p_output->config.i_pacing_burst || p_output->f_pacing_rate <= 0
+          || f_missing <= 0 )
+        return i_deadline;
+
+    /* rounded up, so that the bucket is really full enough by then */
+    i_ready = p_output->i_pacing_time
+               + (mtime_t)(f_missing / p_output->f_pacing_rate) + 1;
+    if ( i_ready > i_deadline + PACING_MAX_LATE )
+        i_ready = i_deadline + PACING_MAX_LATE;
+    return i_ready > i_deadline ? i_ready : i_deadline;
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * output_Due: whether the packet may be sent now, takes its tokens if so
+ *****************************************************************************/
+static bool output_Due( output_t *p_output, packet_t *p_packet )
+{
+    mtime_t i_now = p_output->p_worker->i_wallclock;
+
+    if ( p_packet->i_dts + p_output->config.i_output_latency > i_now )
+        return false;
+    if ( !p_output->config.i_pacing_burst || p_output->f_pacing_rate <= 0 )
+        return true;
+
+    output_PacingRefill( p_output, i_now );
+    if ( output_PacingDeadline( p_output, p_packet ) > i_now )
+        return false;
+
+    p_output->f_pacing_tokens -= p_packet->i_depth * TS_SIZE;
+    if ( p_output->f_pacing_tokens < 0 )
+        p_output->f_pacing_tokens = 0; /* caught up, do not pay it back */
+    return true;
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * output_PacingMeasure: bitrate of the dts, smoothed over a few periods
+ *****************************************************************************/
+static void output_PacingMeasure( output_t *p_output, block_t *p_block )
+{
+    mtime_t i_span = p_block->i_dts - p_output->i_rate_start;
+    double f_rate;
+
+    if ( !p_output->i_rate_bytes || i_span < 0
+          || i_span > 10 * PACING_RATE_PERIOD )
+    {
+        /* first block, or a dts discontinuity */
+        p_output->i_rate_start = p_block->i_dts;
+        p_output->i_rate_bytes = TS_SIZE;
+        return;
+    }
+
+    p_output->i_rate_bytes += TS_SIZE;
+    if ( i_span < PACING_RATE_PERIOD )
+        return;
+
+    f_rate = (double)p_output->i_rate_bytes / i_span;
+    if ( p_output->f_pacing_rate > 0 )
+        p_output->f_pacing_rate += (f_rate - p_output->f_pacing_rate) / 4;
+    else
+    {
+        p_output->f_pacing_rate = f_rate;
+        p_output->f_pacing_tokens = 0;
+        p_output->i_pacing_time = p_block->i_dts;
+    }
+    p_output->i_rate_start = p_block->i_dts;
+    p_output->i_rate_bytes = 0;
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * output_Schedule: (re)files an output under the deadline of its first
+ * packet, must be called whenever that packet or the latency changes
+ *****************************************************************************/
+static void output_Schedule( output_t *p_output )
+{
+    output_sched_t *p_sched = &p_output->p_worker->sched;
+    int i = p_output->i_sched_index;
+    mtime_t i_deadline;
+
+    if ( p_output->p_packets == NULL )
+    {
+        sched_Remove( p_sched, p_output );
+        return;
+    }
+
+    i_deadline = output_PacingDeadline( p_output, p_output->p_packets );
+
+    if ( i < 0 )
+    {
+        if ( p_sched->i_size == p_sched->i_alloc )
+        {
+            p_sched->i_alloc = p_sched->i_alloc ? p_sched->i_alloc * 2 : 16;
+            p_sched->p_heap = realloc( p_sched->p_heap,
+                                       p_sched->i_alloc
+                                        * sizeof(sched_entry_t) );
+        }
+        i = p_sched->i_size++;
+        sched_Set( p_sched, i, i_deadline, p_output );
+        sched_SiftUp( p_sched, i );
+    }
+    else if ( i_deadline < p_sched->p_heap[i].i_deadline )
+    {
+        p_sched->p_heap[i].i_deadline = i_deadline;
+        sched_SiftUp( p_sched, i );
+    }
+    else if ( i_deadline > p_sched->p_heap[i].i_deadline )
+    {
+        p_sched->p_heap[i].i_deadline = i_deadline;
+        sched_SiftDown( p_sched, i );
+    }
+}
+//}}}
+
+//{{{
+static void worker_Lock( output_worker_t *p_worker )
+{
+    if ( p_worker->b_thread )
+        pthread_mutex_lock( &p_worker->lock );
+}
+//}}}
+//{{{
+static void worker_Unlock( output_worker_t *p_worker )
+{
+    if ( !p_worker->b_thread )
+        return;
+    pthread_mutex_unlock( &p_worker->lock );
+    /* the heap may have changed, have the worker re-arm its timer */
+    ev_async_send( p_worker->p_loop, &p_worker->wake_watcher );
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * worker_LoopRelease, worker_LoopAcquire: a worker only lets go of its
+ * lock while its loop is blocked waiting for events
+ *****************************************************************************/
+static void worker_LoopRelease( struct ev_loop *loop )
+{
+    output_worker_t *p_worker = ev_userdata( loop );
+    pthread_mutex_unlock( &p_worker->lock );
+}
+
+static void worker_LoopAcquire( struct ev_loop *loop )
+{
+    output_worker_t *p_worker = ev_userdata( loop );
+    pthread_mutex_lock( &p_worker->lock );
+}
+//}}}
+//{{{
+static mtime_t worker_CPUTime( output_worker_t *p_worker )
+{
+    struct timespec ts;
+
+    if ( !p_worker->b_thread )
+        return p_worker->i_send_cputime;
+    if ( !p_worker->b_cpu_clock
+          || clock_gettime( p_worker->cpu_clock, &ts ) < 0 )
+        return 0;
+    return (mtime_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * worker_ReleaseBlock: drops the reference of a sent block, or gives it
+ * back to the demux thread if the worker has its own
+ *****************************************************************************/
+static void worker_ReleaseBlock( output_worker_t *p_worker, block_t *p_block )
+{
+    if ( !p_worker->b_thread )
+    {
+        p_block->i_refcount--;
+        if ( !p_block->i_refcount )
+            block_Delete( p_block );
+        return;
+    }
+
+    if ( !p_worker->i_nb_deferred
+          && ring_Push( &p_worker->release_ring, p_block ) )
+        return;
+
+    /* the demux thread is late, keep the block until the next pass
+     * (counted as an overflow of the ring) */
+    if ( p_worker->i_nb_deferred == p_worker->i_max_deferred )
+    {
+        p_worker->i_max_deferred = p_worker->i_max_deferred ?
+                                   p_worker->i_max_deferred * 2 : 1024;
+        p_worker->pp_deferred = realloc( p_worker->pp_deferred,
+                                         p_worker->i_max_deferred
+                                          * sizeof(block_t *) );
+    }
+    p_worker->pp_deferred[p_worker->i_nb_deferred++] = p_block;
+}
+//}}}
+//{{{
+static void worker_FlushDeferred( output_worker_t *p_worker )
+{
+    int i;
+
+    for ( i = 0; i < p_worker->i_nb_deferred; i++ )
+        if ( !ring_Push( &p_worker->release_ring, p_worker->pp_deferred[i] ) )
+            break;
+
+    p_worker->i_nb_deferred -= i;
+    memmove( p_worker->pp_deferred, p_worker->pp_deferred + i,
+             p_worker->i_nb_deferred * sizeof(block_t *) );
+
+    if ( p_worker->i_nb_deferred
+          || ring_Count( &p_worker->release_ring )
+              > ring_Size( &p_worker->release_ring ) / 2 )
+        ev_async_send( event_loop, &release_watcher );
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * worker_ReleaseBlocks: demux side, drops the references of sent blocks
+ *****************************************************************************/
+static void worker_ReleaseBlocks( output_worker_t *p_worker )
+{
+    block_t *p_block;
+
+    while ( (p_block = ring_Pop( &p_worker->release_ring )) != NULL )
+    {
+        p_block->i_refcount--;
+        if ( !p_block->i_refcount )
+            block_Delete( p_block );
+    }
+}
+//}}}
+
+//{{{
+/*****************************************************************************
+ * output_Attach: hands a new output to the least loaded worker
+ *****************************************************************************/
+static void output_Attach( output_t *p_output )
+{
+    output_worker_t *p_worker = pp_workers[0];
+    int i;
+
+    for ( i = 1; i < i_nb_workers; i++ )
+        if ( pp_workers[i]->i_nb_outputs < p_worker->i_nb_outputs )
+            p_worker = pp_workers[i];
+
+    if ( p_worker->b_thread )
+    {
+        p_output->p_queue = aligned_alloc( RING_CACHELINE, sizeof(ring_t) );
+        if ( p_output->p_queue == NULL
+              || !ring_Init( p_output->p_queue, OUTPUT_QUEUE_SIZE ) )
+        {
+            msg_Err( NULL, "couldn't allocate output queue" );
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    worker_Lock( p_worker );
+    p_worker->pp_outputs = realloc( p_worker->pp_outputs,
+                                    (p_worker->i_nb_outputs + 1)
+                                     * sizeof(output_t *) );
+    p_worker->pp_outputs[p_worker->i_nb_outputs++] = p_output;
+    p_output->p_worker = p_worker;
+    worker_Unlock( p_worker );
+}
+//}}}
+//{{{
+/* called with the worker locked */
+static void output_Detach( output_t *p_output )
+{
+    output_worker_t *p_worker = p_output->p_worker;
+    block_t *p_block;
+    int i;
+
+    for ( i = 0; i < p_worker->i_nb_outputs; i++ )
+    {
+        if ( p_worker->pp_outputs[i] == p_output )
+        {
+            p_worker->pp_outputs[i] =
+                p_worker->pp_outputs[--p_worker->i_nb_outputs];
+            break;
+        }
+    }
+
+    if ( p_output->p_queue == NULL )
+        return;
+
+    while ( (p_block = ring_Pop( p_output->p_queue )) != NULL )
+    {
+        p_block->i_refcount--;
+        if ( !p_block->i_refcount )
+            block_Delete( p_block );
+    }
+    ring_Clean( p_output->p_queue );
+    free( p_output->p_queue );
+    p_output->p_queue = NULL;
+}
+//}}}
+
 
 //{{{
 packet_t* output_PacketNew( output_t *p_output )
@@ -125,6 +625,7 @@ packet_t* output_PacketNew( output_t *p_output )
     }
 
     p_packet->i_depth = 0;
+    p_packet->i_pcr = -1;
     p_packet->p_next = NULL;
     return p_packet;
 }
@@ -196,6 +697,67 @@ void init_pid_mapping( output_t *p_output )
 }
 //}}}
 //{{{
+/*****************************************************************************
+ * output_InitShm: the ring replaces the socket, its name is the path of the
+ * local address
+ *****************************************************************************/
+static int output_InitShm( output_t *p_output, const output_config_t *p_config )
+{
+    struct sockaddr_un *p_addr =
+        (struct sockaddr_un *)&p_output->config.connect_addr;
+    int i_ret;
+
+    p_output->i_handle = -1;
+    p_output->p_shm = malloc( sizeof(shm_writer_t) );
+    i_ret = shmwriter_Open( p_output->p_shm, p_addr->sun_path,
+                            DEFAULT_SHM_SLOTS );
+    if ( i_ret < 0 )
+    {
+        msg_Err( NULL, "couldn't create shared memory ring %s (%s)",
+                 p_addr->sun_path, strerror(-i_ret) );
+        free( p_output->p_shm );
+        p_output->p_shm = NULL;
+        p_output->config.i_config &= ~OUTPUT_VALID;
+        return i_ret;
+    }
+
+    p_output->config.i_config |= OUTPUT_SHM | OUTPUT_VALID;
+    output_Attach( p_output );
+
+    return 0;
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * output_InitRecorder: the segments replace the socket, their directory is
+ * the path of the local address
+ *****************************************************************************/
+static int output_InitRecorder( output_t *p_output,
+                                const output_config_t *p_config )
+{
+    struct sockaddr_un *p_addr =
+        (struct sockaddr_un *)&p_output->config.connect_addr;
+
+    p_output->i_handle = -1;
+    p_output->p_recorder = recorder_Open( p_addr->sun_path,
+                                          p_config->i_segment_duration,
+                                          p_config->i_segment_size );
+    if ( p_output->p_recorder == NULL )
+    {
+        msg_Err( NULL, "couldn't start recording to %s", p_addr->sun_path );
+        p_output->config.i_config &= ~OUTPUT_VALID;
+        return -1;
+    }
+
+    p_output->config.i_segment_duration = p_config->i_segment_duration;
+    p_output->config.i_segment_size = p_config->i_segment_size;
+    p_output->config.i_config |= OUTPUT_FILE | OUTPUT_VALID;
+    output_Attach( p_output );
+
+    return 0;
+}
+//}}}
+//{{{
 int output_Init( output_t *p_output, const output_config_t *p_config )
 {
     socklen_t i_sockaddr_len = (p_config->i_family == AF_INET) ?
@@ -209,6 +771,7 @@ int output_Init( output_t *p_output, const output_config_t *p_config )
     p_output->p_packets = p_output->p_last_packet = NULL;
     p_output->p_packet_lifo = NULL;
     p_output->i_packet_count = 0;
+    p_output->i_sched_index = -1;
     p_output->i_seqnum = rand() & 0xffff;
     p_output->i_pat_cc = rand() & 0xf;
     p_output->i_pmt_cc = rand() & 0xf;
@@ -239,6 +802,11 @@ int output_Init( output_t *p_output, const output_config_t *p_config )
             sizeof(struct sockaddr_storage) );
     p_output->config.i_if_index_v6 = p_config->i_if_index_v6;
 
+    if ( p_config->i_config & OUTPUT_SHM )
+        return output_InitShm( p_output, p_config );
+    if ( p_config->i_config & OUTPUT_FILE )
+        return output_InitRecorder( p_output, p_config );
+
     if ( (p_config->i_config & OUTPUT_RAW) ) {
         p_output->config.i_config |= OUTPUT_RAW;
         p_output->i_handle = socket( AF_INET, SOCK_RAW, IPPROTO_RAW );
@@ -310,6 +878,7 @@ int output_Init( output_t *p_output, const output_config_t *p_config )
     }
 
     p_output->config.i_config |= OUTPUT_VALID;
+    output_Attach( p_output );
 
     return 0;
 }
@@ -317,7 +886,14 @@ int output_Init( output_t *p_output, const output_config_t *p_config )
 //{{{
 void output_Close( output_t *p_output )
 {
-    packet_t *p_packet = p_output->p_packets;
+    output_worker_t *p_worker = p_output->p_worker;
+    packet_t *p_packet;
+
+    worker_Lock( p_worker );
+    output_Detach( p_output );
+    sched_Remove( &p_worker->sched, p_output );
+
+    p_packet = p_output->p_packets;
     while ( p_packet != NULL )
     {
         int i;
@@ -339,21 +915,77 @@ void output_Close( output_t *p_output )
     free( p_output->p_pmt_section );
     free( p_output->p_nit_section );
     free( p_output->p_sdt_section );
-    free( p_output->p_eit_ts_buffer );
+    if ( p_output->p_eit_ts_buffer != NULL )
+        block_Delete( p_output->p_eit_ts_buffer );
     p_output->config.i_config &= ~OUTPUT_VALID;
 
-    close( p_output->i_handle );
+    if ( p_output->p_shm != NULL )
+    {
+        shmwriter_Close( p_output->p_shm );
+        free( p_output->p_shm );
+        p_output->p_shm = NULL;
+    }
+    else if ( p_output->p_recorder != NULL )
+    {
+        recorder_Close( p_output->p_recorder );
+        p_output->p_recorder = NULL;
+    }
+    else
+        close( p_output->i_handle );
+
+    if ( p_output->p_fec != NULL )
+    {
+        fec_Delete( p_output->p_fec );
+        p_output->p_fec = NULL;
+    }
 
     config_Free( &p_output->config );
+    worker_Unlock( p_worker );
 }
 //}}}
 //{{{
-static void output_Flush( output_t *p_output )
+/*****************************************************************************
+ * output_SendFec: the parity packets completed by the last output_Prepare()
+ * go out after the media datagram, from the media socket, as the receivers
+ * expect them on their own ports anyway
+ *****************************************************************************/
+static void output_SendFec( output_t *p_output )
 {
-    packet_t *p_packet = p_output->p_packets;
+    unsigned int i_ready = p_output->i_fec_ready;
+    socklen_t i_sockaddr_len = (p_output->config.i_family == AF_INET) ?
+                               sizeof(struct sockaddr_in) :
+                               sizeof(struct sockaddr_in6);
+    int i_type;
+
+    for ( i_type = 0; i_type < FEC_TYPES; i_type++ )
+    {
+        struct iovec p_fec_iov[FEC_IOV];
+        struct msghdr msg;
+
+        if ( !(i_ready & (1 << i_type)) )
+            continue;
+
+        memset( &msg, 0, sizeof(msg) );
+        msg.msg_name = &p_output->p_fec_addr[i_type];
+        msg.msg_namelen = i_sockaddr_len;
+        msg.msg_iov = p_fec_iov;
+        msg.msg_iovlen = fec_Get( p_output->p_fec, i_type, p_fec_iov );
+
+        metrics_Add( METRIC_OUTPUT_SYSCALLS, 1 );
+        if ( sendmsg( p_output->i_handle, &msg, 0 ) < 0 )
+            metrics_Add( METRIC_OUTPUT_ERRORS, 1 );
+        else
+            metrics_Add( METRIC_OUTPUT_FEC_PACKETS, 1 );
+    }
+    p_output->i_fec_ready = 0;
+}
+//}}}
+//{{{
+static int output_Prepare( output_t *p_output, packet_t *p_packet,
+                           struct iovec *p_iov, uint8_t *p_rtp_hdr )
+{
+    output_worker_t *p_worker = p_output->p_worker;
     int i_block_cnt = output_BlockCount( p_output );
-    struct iovec p_iov[i_block_cnt + 2];
-    uint8_t p_rtp_hdr[RTP_HEADER_SIZE];
     int i_iov = 0, i_payload_len, i_block;
 
     if ( (p_output->config.i_config & OUTPUT_RAW) )
@@ -366,14 +998,14 @@ static void output_Flush( output_t *p_output )
     if ( !(p_output->config.i_config & OUTPUT_UDP) )
     {
         p_iov[i_iov].iov_base = p_rtp_hdr;
-        p_iov[i_iov].iov_len = sizeof(p_rtp_hdr);
+        p_iov[i_iov].iov_len = RTP_HEADER_SIZE;
 
         rtp_set_hdr( p_rtp_hdr );
         rtp_set_type( p_rtp_hdr, RTP_TYPE_TS );
         rtp_set_seqnum( p_rtp_hdr, p_output->i_seqnum++ );
         /* New timestamp based only on local time when sent */
         /* 90 kHz clock = 90000 counts per second */
-        rtp_set_timestamp( p_rtp_hdr, i_wallclock * 9 / 100);
+        rtp_set_timestamp( p_rtp_hdr, p_worker->i_wallclock * 9 / 100);
         rtp_set_ssrc( p_rtp_hdr, p_output->config.pi_ssrc );
 
         i_iov++;
@@ -381,25 +1013,33 @@ static void output_Flush( output_t *p_output )
 
     for ( i_block = 0; i_block < p_packet->i_depth; i_block++ )
     {
+        block_t *p_block = p_packet->pp_blocks[i_block];
+
         /* Do pid mapping here if needed.
-         * save the original pid in the block.
-         * set the pid to the new pid
-         * later we re-instate the old pid for the next output
+         * The block is shared with the other outputs, so the new pid is
+         * written to a copy of the TS header sent from its own iovec.
          */
         if ( b_do_remap || p_output->config.b_do_remap ) {
-            block_t *p_block = p_packet->pp_blocks[i_block];
             uint16_t i_pid = ts_get_pid( p_block->p_ts );
-            p_block->tmp_pid = UNUSED_PID;
             if ( p_output->pi_newpids[i_pid] != UNUSED_PID )
             {
-                uint16_t i_newpid = p_output->pi_newpids[i_pid];
-                /* Need to map this pid to the new pid */
-                ts_set_pid( p_block->p_ts, i_newpid );
-                p_block->tmp_pid = i_pid;
+                uint8_t *p_ts_hdr = p_worker->pp_batch_ts_hdr[
+                                        &p_iov[i_iov] - p_worker->p_batch_iov];
+
+                memcpy( p_ts_hdr, p_block->p_ts, TS_HEADER_SIZE );
+                ts_set_pid( p_ts_hdr, p_output->pi_newpids[i_pid] );
+                p_iov[i_iov].iov_base = p_ts_hdr;
+                p_iov[i_iov].iov_len = TS_HEADER_SIZE;
+                i_iov++;
+
+                p_iov[i_iov].iov_base = p_block->p_ts + TS_HEADER_SIZE;
+                p_iov[i_iov].iov_len = TS_SIZE - TS_HEADER_SIZE;
+                i_iov++;
+                continue;
             }
         }
 
-        p_iov[i_iov].iov_base = p_packet->pp_blocks[i_block]->p_ts;
+        p_iov[i_iov].iov_base = p_block->p_ts;
         p_iov[i_iov].iov_len = TS_SIZE;
         i_iov++;
     }
@@ -411,6 +1051,11 @@ static void output_Flush( output_t *p_output )
         i_iov++;
     }
 
+    /* only set on plain RTP outputs, so the RTP header is p_iov[0];
+     * output_SendFec() must run before the next fec_Add() */
+    if ( p_output->p_fec != NULL )
+        p_output->i_fec_ready = fec_Add( p_output->p_fec, p_rtp_hdr,
+                                         p_iov + 1, i_iov - 1 );
 
     if ( (p_output->config.i_config & OUTPUT_RAW) )
     {
@@ -421,25 +1066,69 @@ static void output_Flush( output_t *p_output )
         p_output->raw_pkt_header.udph.len = htons(sizeof(struct udpheader) + i_payload_len);
     }
 
-    if ( writev( p_output->i_handle, p_iov, i_iov ) < 0 )
+    return i_iov;
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * output_JitterSample: i_delta is the send time minus the PCR; its spread
+ * over a print period is the jitter seen by the receivers
+ *****************************************************************************/
+static void output_JitterSample( output_t *p_output, mtime_t i_delta )
+{
+    if ( !p_output->i_jitter_samples
+          || i_delta < p_output->i_jitter_min - MAX_JITTER
+          || i_delta > p_output->i_jitter_max + MAX_JITTER )
     {
-        msg_Err( NULL, "couldn't writev to %s (%s)",
-                 p_output->config.psz_displayname, strerror(errno) );
+        /* first sample or PCR discontinuity */
+        p_output->i_jitter_min = p_output->i_jitter_max = i_delta;
+        p_output->i_jitter_samples = 1;
+        return;
     }
-    /* Update the wallclock because writev() can take some time. */
-    i_wallclock = mdate();
+
+    if ( i_delta < p_output->i_jitter_min )
+        p_output->i_jitter_min = i_delta;
+    if ( i_delta > p_output->i_jitter_max )
+        p_output->i_jitter_max = i_delta;
+    p_output->i_jitter_samples++;
+}
+//}}}
+//{{{
+static void output_Release( output_t *p_output )
+{
+    packet_t *p_packet = p_output->p_packets;
+    mtime_t i_now = p_output->p_worker->i_wallclock;
+    unsigned int i_bucket;
+    int i_block;
+
+    if ( p_packet->i_pcr != -1 )
+        output_JitterSample( p_output, i_now - p_packet->i_pcr );
+    metrics_Observe( HISTOGRAM_OUTPUT_LATE, i_now - p_packet->i_dts
+                                  - p_output->config.i_output_latency );
+
+    if ( p_output->i_last_send )
+    {
+        mtime_t i_gap = i_now - p_output->i_last_send;
+        int i_bin = 0;
+
+        while ( i_bin < OUTPUT_GAP_BINS - 1 && i_gap >= pi_gap_bins[i_bin] )
+            i_bin++;
+        p_output->pi_gaps[i_bin]++;
+    }
+    p_output->i_last_send = i_now;
+
+    i_bucket = metrics_Bucket( p_packet->i_depth );
+    if ( i_bucket >= OUTPUT_DEPTH_BUCKETS )
+        i_bucket = OUTPUT_DEPTH_BUCKETS - 1;
+    p_output->pi_depth[i_bucket]++;
 
     for ( i_block = 0; i_block < p_packet->i_depth; i_block++ )
     {
-        p_packet->pp_blocks[i_block]->i_refcount--;
-        if ( !p_packet->pp_blocks[i_block]->i_refcount )
-            block_Delete( p_packet->pp_blocks[i_block] );
-        else if ( b_do_remap || p_output->config.b_do_remap ) {
-            /* still referenced so re-instate the orignial pid if remapped */
-            block_t * p_block = p_packet->pp_blocks[i_block];
-            if (p_block->tmp_pid != UNUSED_PID)
-                ts_set_pid( p_block->p_ts, p_block->tmp_pid );
-        }
+        block_t *p_block = p_packet->pp_blocks[i_block];
+
+        p_output->pi_latency[metrics_Bucket( i_now > p_block->i_dts ?
+                                             i_now - p_block->i_dts : 0 )]++;
+        worker_ReleaseBlock( p_output->p_worker, p_block );
     }
     p_output->p_packets = p_packet->p_next;
     output_PacketDelete( p_output, p_packet );
@@ -448,22 +1137,273 @@ static void output_Flush( output_t *p_output )
 }
 //}}}
 //{{{
-void output_Put( output_t *p_output, block_t *p_block )
+static void output_Flush( output_t *p_output )
 {
-    int i_block_cnt = output_BlockCount( p_output );
-    packet_t *p_packet;
-
-    p_block->i_refcount++;
+    output_worker_t *p_worker = p_output->p_worker;
+    int i_iov = output_Prepare( p_output, p_output->p_packets,
+                                p_worker->p_batch_iov,
+                                p_worker->pp_batch_rtp[0] );
 
-    if ( p_output->p_last_packet != NULL
-          && p_output->p_last_packet->i_depth < i_block_cnt
-          && p_output->p_last_packet->i_dts + p_output->config.i_max_retention
-              > p_block->i_dts )
+    if ( writev( p_output->i_handle, p_worker->p_batch_iov, i_iov ) < 0 )
+    {
+        msg_Err( NULL, "couldn't writev to %s (%s)",
+                 p_output->config.psz_displayname, strerror(errno) );
+        metrics_Add( METRIC_OUTPUT_ERRORS, 1 );
+    }
+    atomic_fetch_add_explicit( &p_worker->i_send_syscalls, 1,
+                               memory_order_relaxed );
+    atomic_fetch_add_explicit( &p_worker->i_send_datagrams, 1,
+                               memory_order_relaxed );
+    metrics_Add( METRIC_OUTPUT_SYSCALLS, 1 );
+    metrics_Add( METRIC_OUTPUT_DATAGRAMS, 1 );
+    metrics_Observe( HISTOGRAM_OUTPUT_BATCH, 1 );
+    output_SendFec( p_output );
+
+    /* Update the wallclock because writev() can take some time. */
+    p_worker->i_wallclock = mdate();
+
+    output_Release( p_output );
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * output_FlushShm: copies the packets which are due, or all of them when
+ * closing, into the ring, without padding, and publishes them at once
+ *****************************************************************************/
+static void output_FlushShm( output_t *p_output, bool b_all )
+{
+    bool b_remap = b_do_remap || p_output->config.b_do_remap;
+    int i_datagrams = 0;
+
+    while ( p_output->p_packets != NULL
+             && (b_all || output_Due( p_output, p_output->p_packets )) )
+    {
+        packet_t *p_packet = p_output->p_packets;
+        int i_block;
+
+        for ( i_block = 0; i_block < p_packet->i_depth; i_block++ )
+        {
+            block_t *p_block = p_packet->pp_blocks[i_block];
+            uint8_t *p_ts = shmwriter_Begin( p_output->p_shm );
+
+            memcpy( p_ts, p_block->p_ts, TS_SIZE );
+            if ( b_remap )
+            {
+                uint16_t i_pid = ts_get_pid( p_ts );
+                if ( p_output->pi_newpids[i_pid] != UNUSED_PID )
+                    ts_set_pid( p_ts, p_output->pi_newpids[i_pid] );
+            }
+            shmwriter_Commit( p_output->p_shm, p_block->i_dts );
+        }
+
+        output_Release( p_output );
+        i_datagrams++;
+    }
+
+    if ( i_datagrams )
+    {
+        shmwriter_Flush( p_output->p_shm );
+        atomic_fetch_add_explicit( &p_output->p_worker->i_send_datagrams,
+                                   i_datagrams, memory_order_relaxed );
+        metrics_Add( METRIC_OUTPUT_DATAGRAMS, i_datagrams );
+    }
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * output_FlushRecorder: hands the packets which are due, or all of them
+ * when closing, to the recorder, which only copies them
+ *****************************************************************************/
+static void output_FlushRecorder( output_t *p_output, bool b_all )
+{
+    bool b_remap = b_do_remap || p_output->config.b_do_remap;
+    uint8_t p_ts[TS_SIZE];
+    int i_datagrams = 0;
+
+    while ( p_output->p_packets != NULL
+             && (b_all || output_Due( p_output, p_output->p_packets )) )
+    {
+        packet_t *p_packet = p_output->p_packets;
+        int i_block;
+
+        for ( i_block = 0; i_block < p_packet->i_depth; i_block++ )
+        {
+            block_t *p_block = p_packet->pp_blocks[i_block];
+            const uint8_t *p_data = p_block->p_ts;
+
+            if ( b_remap )
+            {
+                uint16_t i_pid = ts_get_pid( p_block->p_ts );
+                if ( p_output->pi_newpids[i_pid] != UNUSED_PID )
+                {
+                    memcpy( p_ts, p_block->p_ts, TS_SIZE );
+                    ts_set_pid( p_ts, p_output->pi_newpids[i_pid] );
+                    p_data = p_ts;
+                }
+            }
+            recorder_Write( p_output->p_recorder, p_data, p_block->i_dts );
+        }
+
+        output_Release( p_output );
+        i_datagrams++;
+    }
+
+    if ( i_datagrams )
+        atomic_fetch_add_explicit( &p_output->p_worker->i_send_datagrams,
+                                   i_datagrams, memory_order_relaxed );
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * output_FlushBatch: sends all the packets of an output which are due,
+ * MAX_SEND_BATCH at a time with sendmmsg()
+ *****************************************************************************/
+static void output_FlushBatch( output_t *p_output )
+{
+    output_worker_t *p_worker = p_output->p_worker;
+
+    if ( p_output->p_shm != NULL )
+    {
+        output_FlushShm( p_output, false );
+        return;
+    }
+    if ( p_output->p_recorder != NULL )
+    {
+        output_FlushRecorder( p_output, false );
+        return;
+    }
+
+#ifdef HAVE_SENDMMSG
+    int i_iov_per_msg = output_BlockCount( p_output );
+    int i_max;
+
+    /* remapped packets take two iovecs, plus the RAW and RTP headers */
+    if ( b_do_remap || p_output->config.b_do_remap )
+        i_iov_per_msg *= 2;
+    i_max = MAX_SEND_IOV / (i_iov_per_msg + 2);
+
+    if ( i_max > MAX_SEND_BATCH )
+        i_max = MAX_SEND_BATCH;
+
+    while ( p_worker->b_sendmmsg && p_output->p_packets != NULL )
+    {
+        packet_t *p_packet = p_output->p_packets;
+        struct iovec *p_iov = p_worker->p_batch_iov;
+        int i_msgs = 0, i_sent = 0;
+
+        while ( i_msgs < i_max && p_packet != NULL
+                 && output_Due( p_output, p_packet ) )
+        {
+            struct msghdr *p_hdr = &p_worker->p_batch_msgs[i_msgs].msg_hdr;
+
+            memset( p_hdr, 0, sizeof(struct msghdr) );
+            p_hdr->msg_iov = p_iov;
+            p_hdr->msg_iovlen = output_Prepare( p_output, p_packet, p_iov,
+                                                p_worker->pp_batch_rtp[i_msgs] );
+            p_iov += p_hdr->msg_iovlen;
+            p_packet = p_packet->p_next;
+            i_msgs++;
+            /* the parities are only valid until the next output_Prepare() */
+            if ( p_output->i_fec_ready )
+                break;
+        }
+        if ( !i_msgs )
+            break;
+
+        while ( i_sent < i_msgs )
+        {
+            int i_ret = sendmmsg( p_output->i_handle,
+                                  &p_worker->p_batch_msgs[i_sent],
+                                  i_msgs - i_sent, 0 );
+            atomic_fetch_add_explicit( &p_worker->i_send_syscalls, 1,
+                                       memory_order_relaxed );
+            metrics_Add( METRIC_OUTPUT_SYSCALLS, 1 );
+
+            if ( i_ret < 0 )
+            {
+                if ( errno == ENOSYS )
+                {
+                    /* old kernel, sendmmsg() is not implemented */
+                    msg_Warn( NULL, "sendmmsg() unavailable, falling back to writev()" );
+                    p_worker->b_sendmmsg = false;
+                    break;
+                }
+                msg_Err( NULL, "couldn't sendmmsg to %s (%s)",
+                         p_output->config.psz_displayname, strerror(errno) );
+                metrics_Add( METRIC_OUTPUT_ERRORS, 1 );
+                i_ret = 1; /* skip the datagram in error */
+            }
+            else
+            {
+                atomic_fetch_add_explicit( &p_worker->i_send_datagrams, i_ret,
+                                           memory_order_relaxed );
+                metrics_Add( METRIC_OUTPUT_DATAGRAMS, i_ret );
+                metrics_Observe( HISTOGRAM_OUTPUT_BATCH, i_ret );
+            }
+            i_sent += i_ret;
+        }
+
+        if ( !p_worker->b_sendmmsg )
+        {
+            /* the remaining datagrams were prepared but never sent */
+            int i;
+            for ( i = i_sent; i < i_msgs; i++ )
+            {
+                struct msghdr *p_hdr = &p_worker->p_batch_msgs[i].msg_hdr;
+                if ( writev( p_output->i_handle, p_hdr->msg_iov,
+                             p_hdr->msg_iovlen ) < 0 )
+                {
+                    msg_Err( NULL, "couldn't writev to %s (%s)",
+                             p_output->config.psz_displayname,
+                             strerror(errno) );
+                    metrics_Add( METRIC_OUTPUT_ERRORS, 1 );
+                }
+                atomic_fetch_add_explicit( &p_worker->i_send_syscalls, 1,
+                                           memory_order_relaxed );
+                atomic_fetch_add_explicit( &p_worker->i_send_datagrams, 1,
+                                           memory_order_relaxed );
+                metrics_Add( METRIC_OUTPUT_SYSCALLS, 1 );
+                metrics_Add( METRIC_OUTPUT_DATAGRAMS, 1 );
+                metrics_Observe( HISTOGRAM_OUTPUT_BATCH, 1 );
+            }
+        }
+
+        output_SendFec( p_output );
+
+        /* Update the wallclock because sendmmsg() can take some time. */
+        p_worker->i_wallclock = mdate();
+
+        while ( i_msgs-- )
+            output_Release( p_output );
+    }
+#endif
+
+    while ( p_output->p_packets != NULL
+             && output_Due( p_output, p_output->p_packets ) )
+        output_Flush( p_output );
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * output_Enqueue: worker side of output_Put, the reference is already taken
+ *****************************************************************************/
+static void output_Enqueue( output_t *p_output, block_t *p_block )
+{
+    int i_block_cnt = output_BlockCount( p_output );
+    bool b_pcr = ts_has_adaptation( p_block->p_ts )
+                  && ts_get_adaptation( p_block->p_ts )
+                  && tsaf_has_pcr( p_block->p_ts );
+    packet_t *p_packet;
+
+    output_PacingMeasure( p_output, p_block );
+
+    if ( p_output->p_last_packet != NULL
+          && p_output->p_last_packet->i_depth < i_block_cnt
+          && p_output->p_last_packet->i_dts + p_output->config.i_max_retention
+              > p_block->i_dts )
     {
         p_packet = p_output->p_last_packet;
-        if ( ts_has_adaptation( p_block->p_ts )
-              && ts_get_adaptation( p_block->p_ts )
-              && tsaf_has_pcr( p_block->p_ts ) )
+        if ( b_pcr )
             p_packet->i_dts = p_block->i_dts;
     }
     else
@@ -480,69 +1420,587 @@ void output_Put( output_t *p_output, block_t *p_block )
     p_packet->pp_blocks[p_packet->i_depth] = p_block;
     p_packet->i_depth++;
 
-    if (i_next_send > p_packet->i_dts + p_output->config.i_output_latency)
+    if ( b_pcr )
     {
-        i_next_send = p_packet->i_dts + p_output->config.i_output_latency;
-        ev_timer_stop(event_loop, &output_watcher);
-        ev_timer_set(&output_watcher, (i_next_send - i_wallclock) / 1000000., 0);
-        ev_timer_start(event_loop, &output_watcher);
+        /* jitter is measured on the first PCR PID seen on the output */
+        uint16_t i_pid = ts_get_pid( p_block->p_ts );
+        if ( !p_output->i_jitter_pid )
+            p_output->i_jitter_pid = i_pid;
+        if ( i_pid == p_output->i_jitter_pid )
+            p_packet->i_pcr = (tsaf_get_pcr( p_block->p_ts ) * 300
+                                + tsaf_get_pcrext( p_block->p_ts )) / 27;
     }
+
+    /* only the first packet of an output carries its deadline */
+    if ( p_packet == p_output->p_packets )
+        output_Schedule( p_output );
+}
+//}}}
+//{{{
+void output_Put( output_t *p_output, block_t *p_block )
+{
+    output_worker_t *p_worker = p_output->p_worker;
+
+    p_block->i_refcount++;
+
+    if ( !p_worker->b_thread )
+    {
+        output_Enqueue( p_output, p_block );
+        return;
+    }
+
+    if ( !ring_Push( p_output->p_queue, p_block ) )
+    {
+        /* the worker is late, drop the block (counted by the ring) */
+        p_block->i_refcount--;
+        if ( !p_block->i_refcount )
+            block_Delete( p_block );
+        return;
+    }
+
+    /* woken up once per loop iteration, from outputs_Signal() */
+    p_worker->b_wake = true;
 }
 //}}}
 //{{{
 static void outputs_Send(struct ev_loop *loop, struct ev_timer *w, int revents)
 {
-    i_wallclock = mdate();
+    output_worker_t *p_worker = w->data;
+    output_sched_t *p_sched = &p_worker->sched;
+    bool b_measure = b_cputime && !p_worker->b_thread;
+    mtime_t i_cputime = b_measure ? mcputime() : 0;
+
+    p_worker->i_wallclock = mdate();
+    p_sched->i_armed = INT64_MAX;
+
+    /* Only the outputs which are due are visited; output_FlushBatch()
+     * refreshes the wallclock after each send. */
+    while ( p_sched->i_size
+             && p_sched->p_heap[0].i_deadline <= p_worker->i_wallclock )
+    {
+        output_t *p_output = p_sched->p_heap[0].p_output;
+
+        output_FlushBatch( p_output );
+        output_Schedule( p_output );
+    }
+
+    if ( p_worker->b_thread )
+        worker_FlushDeferred( p_worker );
+
+    if ( b_measure )
+        p_worker->i_send_cputime += mcputime() - i_cputime;
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * worker_WakeCb: worker side, takes the blocks queued by the demux
+ *****************************************************************************/
+static void worker_WakeCb( struct ev_loop *loop, struct ev_async *w,
+                           int revents )
+{
+    output_worker_t *p_worker = w->data;
+    int i;
 
-    do
+    if ( atomic_load( &p_worker->b_die ) )
     {
-        int i;
-        i_next_send = INT64_MAX;
+        ev_break( loop, EVBREAK_ALL );
+        return;
+    }
+
+    for ( i = 0; i < p_worker->i_nb_outputs; i++ )
+    {
+        output_t *p_output = p_worker->pp_outputs[i];
+        block_t *p_block;
 
-        if ( output_dup.config.i_config & OUTPUT_VALID )
+        while ( (p_block = ring_Pop( p_output->p_queue )) != NULL )
+            output_Enqueue( p_output, p_block );
+    }
+
+    worker_FlushDeferred( p_worker );
+}
+//}}}
+//{{{
+static void *worker_Thread( void *_p_worker )
+{
+    output_worker_t *p_worker = _p_worker;
+
+    pthread_mutex_lock( &p_worker->lock );
+    ev_run( p_worker->p_loop, 0 );
+    p_worker->i_send_cputime = mcputime();
+    pthread_mutex_unlock( &p_worker->lock );
+    return NULL;
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * outputs_Signal: main loop, once per iteration, wakes up the workers which
+ * were given blocks and takes the sent ones back
+ *****************************************************************************/
+static void outputs_Signal( struct ev_loop *loop, struct ev_prepare *w,
+                            int revents )
+{
+    int i;
+
+    for ( i = 0; i < i_nb_workers; i++ )
+    {
+        output_worker_t *p_worker = pp_workers[i];
+
+        worker_ReleaseBlocks( p_worker );
+        if ( p_worker->b_wake )
         {
-            while ( output_dup.p_packets != NULL
-                     && output_dup.p_packets->i_dts
-                         + output_dup.config.i_output_latency <= i_wallclock )
-                output_Flush( &output_dup );
-
-            if ( output_dup.p_packets != NULL )
-                i_next_send = output_dup.p_packets->i_dts
-                                + output_dup.config.i_output_latency;
+            p_worker->b_wake = false;
+            ev_async_send( p_worker->p_loop, &p_worker->wake_watcher );
         }
+    }
+}
+//}}}
+//{{{
+static void outputs_ReleaseCb( struct ev_loop *loop, struct ev_async *w,
+                               int revents )
+{
+    int i;
+
+    for ( i = 0; i < i_nb_workers; i++ )
+        worker_ReleaseBlocks( pp_workers[i] );
+}
+//}}}
+
+//{{{
+static void worker_Print( output_worker_t *p_worker )
+{
+    mtime_t i_cputime = worker_CPUTime( p_worker );
+    uint64_t i_datagrams = atomic_load( &p_worker->i_send_datagrams );
+    uint64_t i_cpu = (i_cputime - p_worker->i_print_cputime) * 10000
+                      / i_print_period;
+    uint64_t i_rate = (i_datagrams - p_worker->i_print_datagrams) * 1000000
+                       / i_print_period;
+    uint64_t i_overflows = 0;
+    unsigned int i_depth = 0, i_max_depth = 0;
+    int i;
+
+    for ( i = 0; i < p_worker->i_nb_outputs; i++ )
+    {
+        ring_t *p_queue = p_worker->pp_outputs[i]->p_queue;
 
-        for ( i = 0; i < i_nb_outputs; i++ )
+        i_depth += ring_Count( p_queue );
+        if ( p_queue->i_max_depth > i_max_depth )
+            i_max_depth = p_queue->i_max_depth;
+        i_overflows += atomic_load( &p_queue->i_overflows );
+    }
+
+    switch (i_print_type)
+    {
+        case PRINT_XML:
+            fprintf(print_fh,
+                    "<STATUS type=\"output_worker\" id=\"%d\" outputs=\"%d\" depth=\"%u\" max_depth=\"%u\" overflows=\"%"PRIu64"\" release_depth=\"%u\" release_overflows=\"%"PRIu64"\" datagrams=\"%"PRIu64"\" cpu=\"%"PRIu64".%02"PRIu64"\" />\n",
+                    p_worker->i_id, p_worker->i_nb_outputs, i_depth,
+                    i_max_depth, i_overflows,
+                    ring_Count( &p_worker->release_ring ),
+                    (uint64_t)atomic_load( &p_worker->release_ring.i_overflows ),
+                    i_rate, i_cpu / 100, i_cpu % 100);
+            break;
+        case PRINT_TEXT:
+            fprintf(print_fh, "output worker %d outputs: %d depth: %u max_depth: %u overflows: %"PRIu64" release_depth: %u release_overflows: %"PRIu64" datagrams/s: %"PRIu64" cpu: %"PRIu64".%02"PRIu64"%%\n",
+                    p_worker->i_id, p_worker->i_nb_outputs, i_depth,
+                    i_max_depth, i_overflows,
+                    ring_Count( &p_worker->release_ring ),
+                    (uint64_t)atomic_load( &p_worker->release_ring.i_overflows ),
+                    i_rate, i_cpu / 100, i_cpu % 100);
+            break;
+        default:
+            break;
+    }
+
+    p_worker->i_print_cputime = i_cputime;
+    p_worker->i_print_datagrams = i_datagrams;
+}
+//}}}
+//{{{
+static void output_PrintGaps( output_t *p_output )
+{
+    char psz_gaps[OUTPUT_GAP_BINS * 24];
+    unsigned int i_total = 0;
+    int i, j = 0;
+
+    for ( i = 0; i < OUTPUT_GAP_BINS; i++ )
+        i_total += p_output->pi_gaps[i];
+    if ( !i_total )
+        return;
+
+    for ( i = 0; i < OUTPUT_GAP_BINS; i++ )
+    {
+        if ( i_print_type == PRINT_XML )
+            j += sprintf( psz_gaps + j, i ? ",%u" : "%u",
+                          p_output->pi_gaps[i] );
+        else if ( i < OUTPUT_GAP_BINS - 1 )
+            j += sprintf( psz_gaps + j, " <%"PRId64":%u",
+                          pi_gap_bins[i], p_output->pi_gaps[i] );
+        else
+            j += sprintf( psz_gaps + j, " >=%"PRId64":%u",
+                          pi_gap_bins[i - 1], p_output->pi_gaps[i] );
+    }
+
+    switch (i_print_type)
+    {
+        case PRINT_XML:
+            fprintf(print_fh,
+                    "<STATUS type=\"output_gaps\" output=\"%s\" bitrate=\"%"PRIu64"\" pacing=\"%d\" gaps=\"%s\" />\n",
+                    p_output->config.psz_displayname,
+                    (uint64_t)(p_output->f_pacing_rate * 8000000.),
+                    p_output->config.i_pacing_burst, psz_gaps);
+            break;
+        case PRINT_TEXT:
+            fprintf(print_fh, "output %s bitrate: %"PRIu64" pacing: %d gaps (us):%s\n",
+                    p_output->config.psz_displayname,
+                    (uint64_t)(p_output->f_pacing_rate * 8000000.),
+                    p_output->config.i_pacing_burst, psz_gaps);
+            break;
+        default:
+            break;
+    }
+    memset( p_output->pi_gaps, 0, sizeof(p_output->pi_gaps) );
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * output_PrintLatency: send time minus block dts over the print period, and
+ * how full the datagrams were; a low min depth means the retention expired
+ *****************************************************************************/
+static void output_PrintLatency( output_t *p_output )
+{
+    uint64_t pi_latency[METRICS_BUCKETS], pi_depth[OUTPUT_DEPTH_BUCKETS];
+    uint64_t i_count = 0, i_max = 0, i_min_depth = 0;
+    int i;
+
+    for ( i = 0; i < METRICS_BUCKETS; i++ )
+    {
+        pi_latency[i] = p_output->pi_latency[i] - p_output->pi_print_latency[i];
+        i_count += pi_latency[i];
+        if ( pi_latency[i] )
+            i_max = metrics_BucketLow( i );
+    }
+    for ( i = OUTPUT_DEPTH_BUCKETS - 1; i >= 0; i-- )
+    {
+        pi_depth[i] = p_output->pi_depth[i] - p_output->pi_print_depth[i];
+        if ( pi_depth[i] )
+            i_min_depth = metrics_BucketLow( i );
+    }
+    memcpy( p_output->pi_print_latency, p_output->pi_latency,
+            sizeof(p_output->pi_latency) );
+    memcpy( p_output->pi_print_depth, p_output->pi_depth,
+            sizeof(p_output->pi_depth) );
+    if ( !i_count )
+        return;
+
+    switch (i_print_type)
+    {
+        case PRINT_XML:
+            fprintf(print_fh,
+                    "<STATUS type=\"output_latency\" output=\"%s\" p50=\"%"PRIu64"\" p99=\"%"PRIu64"\" max=\"%"PRIu64"\" min_depth=\"%"PRIu64"\" />\n",
+                    p_output->config.psz_displayname,
+                    metrics_Quantile( pi_latency, METRICS_BUCKETS, i_count, .5 ),
+                    metrics_Quantile( pi_latency, METRICS_BUCKETS, i_count, .99 ),
+                    i_max, i_min_depth);
+            break;
+        case PRINT_TEXT:
+            fprintf(print_fh, "output %s latency p50: %"PRIu64" p99: %"PRIu64" max: %"PRIu64" us min_depth: %"PRIu64"\n",
+                    p_output->config.psz_displayname,
+                    metrics_Quantile( pi_latency, METRICS_BUCKETS, i_count, .5 ),
+                    metrics_Quantile( pi_latency, METRICS_BUCKETS, i_count, .99 ),
+                    i_max, i_min_depth);
+            break;
+        default:
+            break;
+    }
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * worker_PrintOutputs: gaps between datagrams, latency, and spread of send
+ * time minus PCR in us, per output
+ *****************************************************************************/
+static void worker_PrintOutputs( output_worker_t *p_worker )
+{
+    int i;
+
+    worker_Lock( p_worker );
+    for ( i = 0; i < p_worker->i_nb_outputs; i++ )
+    {
+        output_t *p_output = p_worker->pp_outputs[i];
+        mtime_t i_jitter = p_output->i_jitter_max - p_output->i_jitter_min;
+
+        output_PrintGaps( p_output );
+        output_PrintLatency( p_output );
+
+        if ( !p_output->i_jitter_samples )
         {
-            output_t *p_output = pp_outputs[i];
-            if ( !( p_output->config.i_config & OUTPUT_VALID ) )
-                continue;
+            /* the PCR PID went away, pick another one */
+            p_output->i_jitter_pid = 0;
+            continue;
+        }
 
-            while ( p_output->p_packets != NULL
-                     && p_output->p_packets->i_dts
-                         + p_output->config.i_output_latency <= i_wallclock )
-                output_Flush( p_output );
+        switch (i_print_type)
+        {
+            case PRINT_XML:
+                fprintf(print_fh,
+                        "<STATUS type=\"output_jitter\" output=\"%s\" pid=\"%"PRIu16"\" jitter=\"%"PRId64"\" samples=\"%u\" />\n",
+                        p_output->config.psz_displayname,
+                        p_output->i_jitter_pid, i_jitter,
+                        p_output->i_jitter_samples);
+                break;
+            case PRINT_TEXT:
+                fprintf(print_fh, "output %s pcr_pid: %"PRIu16" jitter: %"PRId64" us samples: %u\n",
+                        p_output->config.psz_displayname,
+                        p_output->i_jitter_pid, i_jitter,
+                        p_output->i_jitter_samples);
+                break;
+            default:
+                break;
+        }
+        p_output->i_jitter_samples = 0;
+    }
+    worker_Unlock( p_worker );
+}
+//}}}
+//{{{
+static void outputs_PrintCb( struct ev_loop *loop, struct ev_timer *w, int revents )
+{
+    uint64_t i_send_syscalls = 0, i_send_datagrams = 0;
+    uint64_t i_nb_syscalls, i_nb_datagrams, i_syscalls, i_per_syscall;
+    int i;
+
+    for ( i = 0; i < i_nb_workers; i++ )
+    {
+        i_send_syscalls += atomic_load( &pp_workers[i]->i_send_syscalls );
+        i_send_datagrams += atomic_load( &pp_workers[i]->i_send_datagrams );
+    }
+
+    i_nb_syscalls = i_send_syscalls - i_print_syscalls;
+    i_nb_datagrams = i_send_datagrams - i_print_datagrams;
+    i_syscalls = i_nb_syscalls * 1000000 / i_print_period;
+    i_per_syscall = i_nb_syscalls ? i_nb_datagrams * 100 / i_nb_syscalls : 0;
+
+    switch (i_print_type)
+    {
+        case PRINT_XML:
+            fprintf(print_fh,
+                    "<STATUS type=\"send\" syscalls=\"%"PRIu64"\" datagrams_per_syscall=\"%"PRIu64".%02"PRIu64"\" />\n",
+                    i_syscalls, i_per_syscall / 100, i_per_syscall % 100);
+            break;
+        case PRINT_TEXT:
+            fprintf(print_fh, "send syscalls/s: %"PRIu64" datagrams/syscall: %"PRIu64".%02"PRIu64"\n",
+                    i_syscalls, i_per_syscall / 100, i_per_syscall % 100);
+            break;
+        default:
+            break;
+    }
+    i_print_syscalls = i_send_syscalls;
+    i_print_datagrams = i_send_datagrams;
 
-            if ( p_output->p_packets != NULL
-                  && (p_output->p_packets->i_dts
-                       + p_output->config.i_output_latency < i_next_send) )
-                i_next_send = p_output->p_packets->i_dts
-                                  + p_output->config.i_output_latency;
+    for ( i = 0; i < i_nb_workers; i++ )
+    {
+        if ( pp_workers[i]->b_thread )
+            worker_Print( pp_workers[i] );
+        worker_PrintOutputs( pp_workers[i] );
+    }
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * outputs_Prepare: runs before the loop blocks, re-arms the send timer once
+ * for all the packets queued during this iteration
+ *****************************************************************************/
+static void outputs_Prepare( struct ev_loop *loop, struct ev_prepare *w,
+                             int revents )
+{
+    output_sched_t *p_sched = &((output_worker_t *)w->data)->sched;
+    mtime_t i_deadline = p_sched->i_size ? p_sched->p_heap[0].i_deadline
+                                         : INT64_MAX;
+
+    if ( i_deadline == p_sched->i_armed )
+        return;
+
+    ev_timer_stop(loop, &p_sched->send_watcher);
+    p_sched->i_armed = i_deadline;
+    if ( i_deadline == INT64_MAX )
+        return;
+
+    i_deadline -= mdate();
+    ev_timer_set(&p_sched->send_watcher,
+                 i_deadline > 0 ? i_deadline / 1000000. : 0., 0);
+    ev_timer_start(loop, &p_sched->send_watcher);
+}
+//}}}
+//{{{
+void outputs_GetStats( uint64_t *pi_datagrams, mtime_t *pi_cputime )
+{
+    int i;
+
+    *pi_datagrams = 0;
+    *pi_cputime = 0;
+    for ( i = 0; i < i_nb_workers; i++ )
+    {
+        *pi_datagrams += atomic_load( &pp_workers[i]->i_send_datagrams );
+        *pi_cputime += worker_CPUTime( pp_workers[i] );
+    }
+}
+//}}}
+//{{{
+/*****************************************************************************
+ * outputs_GetLatency: histograms of all the outputs for the comm socket, as
+ * many as fit
+ *****************************************************************************/
+void outputs_GetLatency( uint8_t *p_data, size_t i_max_size, size_t *pi_size )
+{
+    int i, j;
+
+    *pi_size = 0;
+    for ( i = 0; i < i_nb_workers; i++ )
+    {
+        output_worker_t *p_worker = pp_workers[i];
+
+        worker_Lock( p_worker );
+        for ( j = 0; j < p_worker->i_nb_outputs
+                      && *pi_size + sizeof(output_latency_info_t) <= i_max_size;
+              j++ )
+        {
+            output_t *p_output = p_worker->pp_outputs[j];
+            output_latency_info_t *p_info =
+                (output_latency_info_t *)(p_data + *pi_size);
+
+            memset( p_info->psz_name, 0, OUTPUT_NAME_SIZE );
+            strncpy( p_info->psz_name, p_output->config.psz_displayname,
+                     OUTPUT_NAME_SIZE - 1 );
+            memcpy( p_info->pi_latency, p_output->pi_latency,
+                    sizeof(p_info->pi_latency) );
+            memcpy( p_info->pi_depth, p_output->pi_depth,
+                    sizeof(p_info->pi_depth) );
+            *pi_size += sizeof(output_latency_info_t);
         }
+        worker_Unlock( p_worker );
+    }
+}
+//}}}
+//{{{
+static output_worker_t *worker_New( int i_id, bool b_thread )
+{
+    output_worker_t *p_worker = aligned_alloc( RING_CACHELINE,
+                                               sizeof(output_worker_t) );
+    int i_error;
+
+    memset( p_worker, 0, sizeof(output_worker_t) );
+    p_worker->i_id = i_id;
+    p_worker->b_thread = b_thread;
+    p_worker->sched.i_armed = INT64_MAX;
+#ifdef HAVE_SENDMMSG
+    p_worker->b_sendmmsg = true;
+#endif
+    atomic_init( &p_worker->b_die, false );
+    atomic_init( &p_worker->i_send_syscalls, 0 );
+    atomic_init( &p_worker->i_send_datagrams, 0 );
+
+    p_worker->p_loop = b_thread ? ev_loop_new( EVFLAG_AUTO ) : event_loop;
+    if ( p_worker->p_loop == NULL
+          || (b_thread && !ring_Init( &p_worker->release_ring,
+                                      RELEASE_RING_SIZE )) )
+    {
+        msg_Err( NULL, "couldn't allocate output worker %d", i_id );
+        exit(EXIT_FAILURE);
     }
-    while (i_next_send <= i_wallclock);
 
-    if (i_next_send < INT64_MAX)
+    ev_timer_init(&p_worker->sched.send_watcher, outputs_Send, 0, 0);
+    p_worker->sched.send_watcher.data = p_worker;
+    ev_prepare_init(&p_worker->sched.prepare_watcher, outputs_Prepare);
+    p_worker->sched.prepare_watcher.data = p_worker;
+    ev_prepare_start(p_worker->p_loop, &p_worker->sched.prepare_watcher);
+
+    if ( !b_thread )
+        return p_worker;
+
+    pthread_mutex_init( &p_worker->lock, NULL );
+    ev_async_init(&p_worker->wake_watcher, worker_WakeCb);
+    p_worker->wake_watcher.data = p_worker;
+    ev_async_start(p_worker->p_loop, &p_worker->wake_watcher);
+    ev_set_userdata( p_worker->p_loop, p_worker );
+    ev_set_loop_release_cb( p_worker->p_loop, worker_LoopRelease,
+                            worker_LoopAcquire );
+
+    if ( (i_error = pthread_create( &p_worker->thread, NULL, worker_Thread,
+                                    p_worker )) )
     {
-        ev_timer_set(&output_watcher, (i_next_send - i_wallclock) / 1000000., 0);
-        ev_timer_start(loop, &output_watcher);
+        msg_Err( NULL, "couldn't create output thread (%s)",
+                 strerror(i_error) );
+        exit(EXIT_FAILURE);
     }
+    if ( (i_error = pthread_getcpuclockid( p_worker->thread,
+                                           &p_worker->cpu_clock )) )
+        msg_Warn( NULL, "couldn't get output thread CPU clock (%s)",
+                  strerror(i_error) );
+    else
+        p_worker->b_cpu_clock = true;
+
+    return p_worker;
 }
 //}}}
+//{{{
+/*****************************************************************************
+ * worker_Stop: joins the thread, after which the worker runs inline so that
+ * outputs_Close() can flush and close its outputs
+ *****************************************************************************/
+static void worker_Stop( output_worker_t *p_worker )
+{
+    int i;
 
+    atomic_store( &p_worker->b_die, true );
+    ev_async_send( p_worker->p_loop, &p_worker->wake_watcher );
+    pthread_join( p_worker->thread, NULL );
+
+    worker_ReleaseBlocks( p_worker );
+    for ( i = 0; i < p_worker->i_nb_deferred; i++ )
+    {
+        p_worker->pp_deferred[i]->i_refcount--;
+        if ( !p_worker->pp_deferred[i]->i_refcount )
+            block_Delete( p_worker->pp_deferred[i] );
+    }
+    free( p_worker->pp_deferred );
+    p_worker->pp_deferred = NULL;
+    p_worker->i_nb_deferred = p_worker->i_max_deferred = 0;
+
+    /* blocks still in the output queues are released by output_Close() */
+    p_worker->b_thread = false;
+}
+//}}}
 //{{{
 void outputs_Init( void )
 {
-    ev_timer_init(&output_watcher, outputs_Send, 0, 0);
+    int i;
+
+    if ( i_output_threads > 0 )
+    {
+        ev_prepare_init(&signal_watcher, outputs_Signal);
+        ev_prepare_start(event_loop, &signal_watcher);
+        ev_async_init(&release_watcher, outputs_ReleaseCb);
+        ev_async_start(event_loop, &release_watcher);
+
+        i_nb_workers = i_output_threads;
+        pp_workers = malloc( i_nb_workers * sizeof(output_worker_t *) );
+        for ( i = 0; i < i_nb_workers; i++ )
+            pp_workers[i] = worker_New( i, true );
+        msg_Dbg( NULL, "%d output threads", i_nb_workers );
+    }
+    else
+    {
+        i_nb_workers = 1;
+        pp_workers = malloc( sizeof(output_worker_t *) );
+        pp_workers[0] = worker_New( 0, false );
+    }
+
+    if ( i_print_period )
+    {
+        ev_timer_init( &print_watcher, outputs_PrintCb,
+                       i_print_period / 1000000., i_print_period / 1000000. );
+        ev_timer_start( event_loop, &print_watcher );
+    }
 }
 //}}}
 //{{{
@@ -550,6 +2008,8 @@ output_t *output_Find( const output_config_t *p_config )
 {
     socklen_t i_sockaddr_len = (p_config->i_family == AF_INET) ?
                                sizeof(struct sockaddr_in) :
+                               (p_config->i_family == AF_UNIX) ?
+                               sizeof(struct sockaddr_un) :
                                sizeof(struct sockaddr_in6);
     int i;
 
@@ -581,12 +2041,94 @@ output_t *output_Find( const output_config_t *p_config )
 }
 //}}}
 //{{{
+/*****************************************************************************
+ * output_SetFec: (re)creates the encoder for the matrix and datagram size
+ *****************************************************************************/
+static void output_SetFec( output_t *p_output, const output_config_t *p_config )
+{
+    int i_type;
+
+    if ( p_output->p_fec != NULL )
+    {
+        fec_Delete( p_output->p_fec );
+        p_output->p_fec = NULL;
+    }
+
+    p_output->config.i_fec_columns = p_config->i_fec_columns;
+    p_output->config.i_fec_rows = p_config->i_fec_rows;
+    if ( !p_config->i_fec_columns )
+        return;
+
+    if ( p_output->config.i_config
+          & (OUTPUT_UDP | OUTPUT_RAW | OUTPUT_SHM | OUTPUT_FILE) )
+    {
+        msg_Warn( NULL, "FEC is only sent along RTP, not for %s",
+                  p_output->config.psz_displayname );
+        return;
+    }
+
+    p_output->p_fec = fec_New( p_config->i_fec_columns, p_config->i_fec_rows,
+                               output_BlockCount( p_output ) * TS_SIZE );
+    if ( p_output->p_fec == NULL )
+    {
+        msg_Warn( NULL, "invalid FEC matrix %dx%d for %s (L <= %d, "
+                  "%d <= D <= %d, L x D <= %d)", p_config->i_fec_columns,
+                  p_config->i_fec_rows, p_output->config.psz_displayname,
+                  FEC_MAX_COLUMNS, FEC_MIN_ROWS, FEC_MAX_ROWS, FEC_MAX_CELLS );
+        return;
+    }
+
+    for ( i_type = 0; i_type < FEC_TYPES; i_type++ )
+    {
+        struct sockaddr_storage *p_addr = &p_output->p_fec_addr[i_type];
+        int i_offset = i_type == FEC_COLUMN ? 2 : 4;
+
+        memcpy( p_addr, &p_output->config.connect_addr,
+                sizeof(struct sockaddr_storage) );
+        if ( p_addr->ss_family == AF_INET6 )
+        {
+            struct sockaddr_in6 *p_addr6 = (struct sockaddr_in6 *)p_addr;
+            p_addr6->sin6_port = htons( ntohs( p_addr6->sin6_port ) + i_offset );
+        }
+        else
+        {
+            struct sockaddr_in *p_addr4 = (struct sockaddr_in *)p_addr;
+            p_addr4->sin_port = htons( ntohs( p_addr4->sin_port ) + i_offset );
+        }
+    }
+}
+//}}}
+//{{{
 void output_Change( output_t *p_output, const output_config_t *p_config )
 {
     int ret = 0;
+    bool b_fec_change = p_output->config.i_fec_columns != p_config->i_fec_columns
+        || p_output->config.i_fec_rows != p_config->i_fec_rows
+        || p_output->config.i_mtu != p_config->i_mtu
+        || ((p_output->config.i_config ^ p_config->i_config) & OUTPUT_UDP);
+
+    /* the worker reads the configuration while it sends */
+    worker_Lock( p_output->p_worker );
+
+    if ( p_config->psz_displayname != NULL )
+    {
+        free( p_output->config.psz_displayname );
+        p_output->config.psz_displayname = strdup( p_config->psz_displayname );
+    }
+
     memcpy( p_output->config.pi_ssrc, p_config->pi_ssrc, 4 * sizeof(uint8_t) );
     p_output->config.i_output_latency = p_config->i_output_latency;
     p_output->config.i_max_retention = p_config->i_max_retention;
+    p_output->config.i_pacing_burst = p_config->i_pacing_burst;
+    if ( p_output->p_recorder != NULL )
+    {
+        p_output->config.i_segment_duration = p_config->i_segment_duration;
+        p_output->config.i_segment_size = p_config->i_segment_size;
+        recorder_SetLimits( p_output->p_recorder, p_config->i_segment_duration,
+                            p_config->i_segment_size );
+    }
+    if ( p_output->i_sched_index >= 0 )
+        output_Schedule( p_output );
 
     if ( p_output->config.i_ttl != p_config->i_ttl )
     {
@@ -599,7 +2141,7 @@ void output_Change( output_t *p_output, const output_config_t *p_config )
                                   IPV6_MULTICAST_HOPS, (void *)&p_config->i_ttl,
                                   sizeof(p_config->i_ttl) );
         }
-        else
+        else if ( p_output->config.i_family == AF_INET )
         {
             struct sockaddr_in *p_addr =
                 (struct sockaddr_in *)&p_output->config.connect_addr;
@@ -649,6 +2191,11 @@ void output_Change( output_t *p_output, const output_config_t *p_config )
         p_output->raw_pkt_header.iph.saddr = inet_addr(p_config->psz_srcaddr);
         p_output->raw_pkt_header.udph.source = htons(p_config->i_srcport);
     }
+
+    if ( b_fec_change )
+        output_SetFec( p_output, p_config );
+
+    worker_Unlock( p_output->p_worker );
 }
 //}}}
 //{{{
@@ -656,6 +2203,14 @@ void outputs_Close( int i_num_outputs )
 {
     int i;
 
+    if ( i_output_threads > 0 )
+    {
+        for ( i = 0; i < i_nb_workers; i++ )
+            worker_Stop( pp_workers[i] );
+        ev_prepare_stop( event_loop, &signal_watcher );
+        ev_async_stop( event_loop, &release_watcher );
+    }
+
     for ( i = 0; i < i_num_outputs; i++ )
     {
         output_t *p_output = pp_outputs[i];
@@ -664,7 +2219,12 @@ void outputs_Close( int i_num_outputs )
         {
             msg_Dbg( NULL, "removing %s", p_output->config.psz_displayname );
 
-            if ( p_output->p_packets )
+            /* shm and recorder outputs have no socket to writev() to */
+            if ( p_output->p_shm != NULL )
+                output_FlushShm( p_output, true );
+            else if ( p_output->p_recorder != NULL )
+                output_FlushRecorder( p_output, true );
+            else if ( p_output->p_packets )
                 output_Flush( p_output );
             output_Close( p_output );
         }
@@ -673,5 +2233,30 @@ void outputs_Close( int i_num_outputs )
     }
 
     free( pp_outputs );
+    recorder_JoinAll();
+
+    for ( i = 0; i < i_nb_workers; i++ )
+    {
+        output_worker_t *p_worker = pp_workers[i];
+
+        ev_timer_stop( p_worker->p_loop, &p_worker->sched.send_watcher );
+        ev_prepare_stop( p_worker->p_loop, &p_worker->sched.prepare_watcher );
+        if ( p_worker->p_loop != event_loop )
+        {
+            ev_async_stop( p_worker->p_loop, &p_worker->wake_watcher );
+            ev_loop_destroy( p_worker->p_loop );
+            ring_Clean( &p_worker->release_ring );
+            pthread_mutex_destroy( &p_worker->lock );
+        }
+        free( p_worker->sched.p_heap );
+        free( p_worker->pp_outputs );
+        free( p_worker );
+    }
+    free( pp_workers );
+    pp_workers = NULL;
+    i_nb_workers = 0;
+
+    if ( i_print_period )
+        ev_timer_stop( event_loop, &print_watcher );
 }
 //}}}
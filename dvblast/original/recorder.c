@@ -0,0 +1,684 @@
+/*****************************************************************************
+ * recorder.c: segment recorder outputs, writing the TS to disk
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#define _GNU_SOURCE /* O_DIRECT */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "dvblast.h"
+#include "recorder.h"
+
+#include <bitstream/mpeg/ts.h>
+#include <bitstream/mpeg/psi.h>
+
+#define RECORD_BLOCK_SIZE (1024 * 1024) /* bytes per write */
+#define RECORD_BUFFERS 4 /* blocks in flight, of which one being filled */
+#define RECORD_ALIGN 4096 /* of the buffers, offsets and sizes for O_DIRECT */
+#define RECORD_MAX_ENTRIES 1024 /* index entries between two blocks */
+#define RECORD_INDEX_PERIOD 500000 /* us between two PCR entries */
+#define RECORD_RAP_TIMEOUT 5000000 /* us to wait for a RAP before cutting
+                                    * on a PAT anyway */
+
+typedef struct record_block_t
+{
+    struct record_block_t *p_next;
+    uint8_t *p_data;
+    size_t i_size;
+    unsigned int i_segment;
+    bool b_open;  /* first block of the segment */
+    bool b_close; /* last block of the segment */
+    unsigned int i_nb_entries;
+    record_index_t p_entries[RECORD_MAX_ENTRIES];
+} record_block_t;
+
+struct recorder_t
+{
+    char *psz_dir;
+    int64_t i_start; /* time() at the opening, prefix of the file names */
+
+    /* caller side */
+    int64_t i_duration;
+    uint64_t i_size;
+    record_block_t *p_block; /* being filled, NULL if none was free */
+    unsigned int i_segment;
+    bool b_started;
+    int64_t i_segment_dts;
+    uint64_t i_segment_bytes;
+    int64_t i_rotate_dts; /* when a limit was reached, -1 before */
+    bool b_rap_seen;
+    int64_t i_pcr, i_index_dts;
+    unsigned int i_nb_entries;
+    record_index_t p_entries[RECORD_MAX_ENTRIES];
+    /* last single-packet PAT and PMT, to start a segment on a RAP */
+    uint16_t i_pmt_pid;
+    bool b_pat, b_pmt;
+    uint8_t p_pat[TS_SIZE], p_pmt[TS_SIZE];
+    uint64_t i_dropped;
+
+    /* shared with the writer thread */
+    pthread_mutex_t lock;
+    pthread_cond_t wait;
+    record_block_t *p_free;
+    record_block_t *p_first, **pp_last;
+    bool b_exit;
+    bool b_done; /* the writer thread is about to return */
+
+    /* closed, until the writer thread is joined */
+    pthread_t thread;
+    struct recorder_t *p_next_closed;
+
+    /* writer thread side */
+    int i_fd, i_index_fd;
+    bool b_direct;
+    uint64_t i_written;
+
+    record_block_t p_blocks[RECORD_BUFFERS];
+};
+
+/*****************************************************************************
+ * Writer thread
+ *****************************************************************************/
+static bool recorder_WriteAll( int i_fd, const uint8_t *p_data, size_t i_size )
+{
+    while ( i_size )
+    {
+        ssize_t i_ret = write( i_fd, p_data, i_size );
+        if ( i_ret < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return false;
+        }
+        p_data += i_ret;
+        i_size -= i_ret;
+    }
+    return true;
+}
+
+static void recorder_Path( recorder_t *p_recorder, char *psz_path,
+                           unsigned int i_segment, const char *psz_ext )
+{
+    snprintf( psz_path, PATH_MAX, "%s/%"PRId64"-%06u.%s", p_recorder->psz_dir,
+              p_recorder->i_start, i_segment, psz_ext );
+}
+
+static void recorder_CloseSegment( recorder_t *p_recorder )
+{
+    /* the last block was written rounded up */
+    if ( p_recorder->b_direct
+          && ftruncate( p_recorder->i_fd, p_recorder->i_written ) < 0 )
+        msg_Warn( NULL, "couldn't truncate segment in %s (%s)",
+                  p_recorder->psz_dir, strerror(errno) );
+    close( p_recorder->i_fd );
+    p_recorder->i_fd = -1;
+
+    if ( p_recorder->i_index_fd != -1 )
+    {
+        close( p_recorder->i_index_fd );
+        p_recorder->i_index_fd = -1;
+    }
+}
+
+static void recorder_OpenSegment( recorder_t *p_recorder,
+                                  unsigned int i_segment )
+{
+    char psz_path[PATH_MAX];
+    record_index_header_t header;
+
+    recorder_Path( p_recorder, psz_path, i_segment, "ts" );
+    p_recorder->b_direct = true;
+    p_recorder->i_fd = open( psz_path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT,
+                             0644 );
+    if ( p_recorder->i_fd < 0 && errno == EINVAL )
+    {
+        /* tmpfs and a few others don't do direct I/O */
+        p_recorder->b_direct = false;
+        p_recorder->i_fd = open( psz_path, O_WRONLY | O_CREAT | O_TRUNC,
+                                 0644 );
+    }
+    if ( p_recorder->i_fd < 0 )
+    {
+        msg_Err( NULL, "couldn't create segment %s (%s)", psz_path,
+                 strerror(errno) );
+        return;
+    }
+    p_recorder->i_written = 0;
+
+    recorder_Path( p_recorder, psz_path, i_segment, "idx" );
+    p_recorder->i_index_fd = open( psz_path, O_WRONLY | O_CREAT | O_TRUNC,
+                                   0644 );
+    if ( p_recorder->i_index_fd < 0 )
+    {
+        msg_Warn( NULL, "couldn't create index %s (%s)", psz_path,
+                  strerror(errno) );
+        return;
+    }
+
+    memset( &header, 0, sizeof(header) );
+    header.i_magic = RECORD_INDEX_MAGIC;
+    header.i_version = RECORD_INDEX_VERSION;
+    header.i_entry_size = sizeof(record_index_t);
+    recorder_WriteAll( p_recorder->i_index_fd, (uint8_t *)&header,
+                       sizeof(header) );
+}
+
+static void recorder_WriteBlock( recorder_t *p_recorder,
+                                 record_block_t *p_block )
+{
+    if ( p_block->b_open )
+    {
+        /* the end of the previous segment may have been dropped */
+        if ( p_recorder->i_fd != -1 )
+            recorder_CloseSegment( p_recorder );
+        recorder_OpenSegment( p_recorder, p_block->i_segment );
+    }
+
+    if ( p_recorder->i_fd == -1 )
+        return;
+
+    if ( p_block->i_size )
+    {
+        size_t i_write = p_block->i_size;
+
+        if ( p_recorder->b_direct )
+        {
+            i_write = (i_write + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+            memset( p_block->p_data + p_block->i_size, 0,
+                    i_write - p_block->i_size );
+        }
+
+        if ( !recorder_WriteAll( p_recorder->i_fd, p_block->p_data, i_write ) )
+        {
+            msg_Err( NULL, "couldn't write segment in %s (%s)",
+                     p_recorder->psz_dir, strerror(errno) );
+            recorder_CloseSegment( p_recorder );
+            return;
+        }
+        p_recorder->i_written += p_block->i_size;
+    }
+
+    if ( p_recorder->i_index_fd != -1 && p_block->i_nb_entries )
+        recorder_WriteAll( p_recorder->i_index_fd,
+                           (uint8_t *)p_block->p_entries,
+                           p_block->i_nb_entries * sizeof(record_index_t) );
+
+    if ( p_block->b_close )
+        recorder_CloseSegment( p_recorder );
+}
+
+static void recorder_Free( recorder_t *p_recorder )
+{
+    int i;
+
+    for ( i = 0; i < RECORD_BUFFERS; i++ )
+        free( p_recorder->p_blocks[i].p_data );
+    pthread_cond_destroy( &p_recorder->wait );
+    pthread_mutex_destroy( &p_recorder->lock );
+    free( p_recorder->psz_dir );
+    free( p_recorder );
+}
+
+/* exits once closed and drained, the recorder is then freed by the join */
+static void *recorder_Thread( void *p_arg )
+{
+    recorder_t *p_recorder = p_arg;
+
+    for ( ; ; )
+    {
+        record_block_t *p_block;
+
+        pthread_mutex_lock( &p_recorder->lock );
+        while ( p_recorder->p_first == NULL && !p_recorder->b_exit )
+            pthread_cond_wait( &p_recorder->wait, &p_recorder->lock );
+        p_block = p_recorder->p_first;
+        if ( p_block != NULL )
+        {
+            p_recorder->p_first = p_block->p_next;
+            if ( p_recorder->p_first == NULL )
+                p_recorder->pp_last = &p_recorder->p_first;
+        }
+        pthread_mutex_unlock( &p_recorder->lock );
+
+        if ( p_block == NULL )
+            break;
+
+        recorder_WriteBlock( p_recorder, p_block );
+
+        pthread_mutex_lock( &p_recorder->lock );
+        p_block->p_next = p_recorder->p_free;
+        p_recorder->p_free = p_block;
+        pthread_mutex_unlock( &p_recorder->lock );
+    }
+
+    if ( p_recorder->i_fd != -1 )
+        recorder_CloseSegment( p_recorder );
+
+    pthread_mutex_lock( &p_recorder->lock );
+    p_recorder->b_done = true;
+    pthread_mutex_unlock( &p_recorder->lock );
+    return NULL;
+}
+
+/*****************************************************************************
+ * Closed recorders, kept until their writer thread is joined
+ *****************************************************************************/
+static pthread_mutex_t closed_lock = PTHREAD_MUTEX_INITIALIZER;
+static recorder_t *p_closed = NULL;
+
+static bool recorder_Done( recorder_t *p_recorder )
+{
+    bool b_done;
+
+    pthread_mutex_lock( &p_recorder->lock );
+    b_done = p_recorder->b_done;
+    pthread_mutex_unlock( &p_recorder->lock );
+    return b_done;
+}
+
+/* joins the writers which are done, or all of them if b_wait */
+static void recorder_Reap( bool b_wait )
+{
+    recorder_t **pp_recorder = &p_closed;
+
+    pthread_mutex_lock( &closed_lock );
+    while ( *pp_recorder != NULL )
+    {
+        recorder_t *p_recorder = *pp_recorder;
+
+        if ( !b_wait && !recorder_Done( p_recorder ) )
+        {
+            pp_recorder = &p_recorder->p_next_closed;
+            continue;
+        }
+
+        *pp_recorder = p_recorder->p_next_closed;
+        pthread_join( p_recorder->thread, NULL );
+        recorder_Free( p_recorder );
+    }
+    pthread_mutex_unlock( &closed_lock );
+}
+
+/*****************************************************************************
+ * Caller side
+ *****************************************************************************/
+static record_block_t *recorder_GetBlock( recorder_t *p_recorder )
+{
+    record_block_t *p_block;
+
+    pthread_mutex_lock( &p_recorder->lock );
+    p_block = p_recorder->p_free;
+    if ( p_block != NULL )
+        p_recorder->p_free = p_block->p_next;
+    pthread_mutex_unlock( &p_recorder->lock );
+
+    if ( p_block != NULL )
+    {
+        p_block->p_next = NULL;
+        p_block->i_size = 0;
+        p_block->i_segment = p_recorder->i_segment;
+        p_block->b_open = !p_recorder->i_segment_bytes;
+        p_block->b_close = false;
+    }
+    return p_block;
+}
+
+/* the block takes the index entries gathered so far along */
+static void recorder_Submit( recorder_t *p_recorder, record_block_t *p_block )
+{
+    memcpy( p_block->p_entries, p_recorder->p_entries,
+            p_recorder->i_nb_entries * sizeof(record_index_t) );
+    p_block->i_nb_entries = p_recorder->i_nb_entries;
+    p_recorder->i_nb_entries = 0;
+
+    pthread_mutex_lock( &p_recorder->lock );
+    *p_recorder->pp_last = p_block;
+    p_recorder->pp_last = &p_block->p_next;
+    pthread_cond_signal( &p_recorder->wait );
+    pthread_mutex_unlock( &p_recorder->lock );
+}
+
+static bool recorder_Append( recorder_t *p_recorder, const uint8_t *p_ts )
+{
+    record_block_t *p_block = p_recorder->p_block;
+    size_t i_room;
+
+    if ( p_block == NULL
+          && (p_block = p_recorder->p_block = recorder_GetBlock( p_recorder ))
+              == NULL )
+        goto drop;
+
+    i_room = RECORD_BLOCK_SIZE - p_block->i_size;
+    if ( i_room > TS_SIZE )
+    {
+        memcpy( p_block->p_data + p_block->i_size, p_ts, TS_SIZE );
+        p_block->i_size += TS_SIZE;
+    }
+    else
+    {
+        /* blocks are a whole number of pages, so packets straddle them;
+         * take the next one first, never to write half a packet */
+        record_block_t *p_next = NULL;
+
+        if ( i_room < TS_SIZE
+              && (p_next = recorder_GetBlock( p_recorder )) == NULL )
+            goto drop;
+
+        memcpy( p_block->p_data + p_block->i_size, p_ts, i_room );
+        p_block->i_size = RECORD_BLOCK_SIZE;
+        recorder_Submit( p_recorder, p_block );
+
+        if ( p_next != NULL )
+        {
+            memcpy( p_next->p_data, p_ts + i_room, TS_SIZE - i_room );
+            p_next->i_size = TS_SIZE - i_room;
+        }
+        p_recorder->p_block = p_next;
+    }
+
+    p_recorder->i_segment_bytes += TS_SIZE;
+    if ( p_recorder->i_dropped )
+    {
+        msg_Warn( NULL, "recorder %s dropped %"PRIu64" packets",
+                  p_recorder->psz_dir, p_recorder->i_dropped );
+        p_recorder->i_dropped = 0;
+    }
+    return true;
+
+drop:
+    if ( !p_recorder->i_dropped++ )
+        msg_Warn( NULL, "recorder %s: disk too slow, dropping packets",
+                  p_recorder->psz_dir );
+    /* rather than a segment without its tables, wait for the next PAT */
+    if ( !p_recorder->i_segment_bytes )
+        p_recorder->b_started = false;
+    return false;
+}
+
+static void recorder_StartSegment( recorder_t *p_recorder, int64_t i_dts )
+{
+    p_recorder->i_segment++;
+    p_recorder->b_started = true;
+    p_recorder->i_segment_dts = i_dts;
+    p_recorder->i_segment_bytes = 0;
+    p_recorder->i_rotate_dts = -1;
+    p_recorder->i_index_dts = i_dts - RECORD_INDEX_PERIOD;
+}
+
+static void recorder_EndSegment( recorder_t *p_recorder )
+{
+    record_block_t *p_block = p_recorder->p_block;
+
+    /* an empty block still carries the last index entries */
+    if ( p_block == NULL && p_recorder->i_segment_bytes
+          && p_recorder->i_nb_entries )
+        p_block = recorder_GetBlock( p_recorder );
+
+    if ( p_block != NULL )
+    {
+        p_block->b_close = true;
+        recorder_Submit( p_recorder, p_block );
+    }
+    p_recorder->p_block = NULL;
+    p_recorder->i_nb_entries = 0;
+}
+
+/* returns the section of a PSI packet, if it fits in the packet */
+static const uint8_t *recorder_Section( const uint8_t *p_ts )
+{
+    const uint8_t *p_payload = ts_payload( (uint8_t *)p_ts );
+    const uint8_t *p_section;
+
+    if ( !ts_get_unitstart( p_ts ) || p_payload >= p_ts + TS_SIZE )
+        return NULL;
+    p_section = p_payload + 1 + *p_payload;
+    if ( p_section + PSI_HEADER_SIZE > p_ts + TS_SIZE
+          || p_section + PSI_HEADER_SIZE + psi_get_length( p_section )
+              > p_ts + TS_SIZE )
+        return NULL;
+    return p_section;
+}
+
+static void recorder_CachePSI( recorder_t *p_recorder, const uint8_t *p_ts,
+                               uint16_t i_pid )
+{
+    const uint8_t *p_section = recorder_Section( p_ts );
+    uint8_t *p_program;
+    int i;
+
+    if ( i_pid == PAT_PID )
+    {
+        if ( p_section == NULL || !pat_validate( (uint8_t *)p_section ) )
+            return;
+        memcpy( p_recorder->p_pat, p_ts, TS_SIZE );
+        p_recorder->b_pat = true;
+
+        for ( i = 0; (p_program = pat_get_program( (uint8_t *)p_section, i ))
+                      != NULL; i++ )
+        {
+            if ( !patn_get_program( p_program ) )
+                continue; /* NIT */
+            if ( patn_get_pid( p_program ) != p_recorder->i_pmt_pid )
+            {
+                p_recorder->i_pmt_pid = patn_get_pid( p_program );
+                p_recorder->b_pmt = false;
+            }
+            break;
+        }
+    }
+    else if ( i_pid == p_recorder->i_pmt_pid && ts_get_unitstart( p_ts ) )
+    {
+        /* a PMT spanning several packets can't be repeated from one */
+        p_recorder->b_pmt = p_section != NULL;
+        if ( p_section != NULL )
+            memcpy( p_recorder->p_pmt, p_ts, TS_SIZE );
+    }
+}
+
+/*****************************************************************************
+ * recorder_Open: psz_dir is created if need be; i_duration (us) and i_size
+ * (bytes) are the segment limits, 0 for none
+ *****************************************************************************/
+recorder_t *recorder_Open( const char *psz_dir, int64_t i_duration,
+                           uint64_t i_size )
+{
+    recorder_t *p_recorder;
+    int i;
+
+    if ( mkdir( psz_dir, 0755 ) < 0 && errno != EEXIST )
+    {
+        msg_Err( NULL, "couldn't create directory %s (%s)", psz_dir,
+                 strerror(errno) );
+        return NULL;
+    }
+
+    p_recorder = calloc( 1, sizeof(recorder_t) );
+    if ( p_recorder == NULL )
+        return NULL;
+    p_recorder->psz_dir = strdup( psz_dir );
+    p_recorder->i_start = time( NULL );
+    p_recorder->i_duration = i_duration;
+    p_recorder->i_size = i_size;
+    p_recorder->i_rotate_dts = -1;
+    p_recorder->i_pcr = -1;
+    p_recorder->i_pmt_pid = UNUSED_PID;
+    p_recorder->pp_last = &p_recorder->p_first;
+    p_recorder->i_fd = p_recorder->i_index_fd = -1;
+
+    for ( i = 0; i < RECORD_BUFFERS; i++ )
+    {
+        record_block_t *p_block = &p_recorder->p_blocks[i];
+
+        if ( posix_memalign( (void **)&p_block->p_data, RECORD_ALIGN,
+                             RECORD_BLOCK_SIZE ) )
+        {
+            p_block->p_data = NULL;
+            goto error;
+        }
+        p_block->p_next = p_recorder->p_free;
+        p_recorder->p_free = p_block;
+    }
+
+    pthread_mutex_init( &p_recorder->lock, NULL );
+    pthread_cond_init( &p_recorder->wait, NULL );
+    if ( pthread_create( &p_recorder->thread, NULL, recorder_Thread,
+                         p_recorder ) )
+    {
+        recorder_Free( p_recorder );
+        return NULL;
+    }
+
+    return p_recorder;
+
+error:
+    for ( i = 0; i < RECORD_BUFFERS; i++ )
+        free( p_recorder->p_blocks[i].p_data );
+    free( p_recorder->psz_dir );
+    free( p_recorder );
+    return NULL;
+}
+
+/*****************************************************************************
+ * recorder_SetLimits: applies from the current segment on
+ *****************************************************************************/
+void recorder_SetLimits( recorder_t *p_recorder, int64_t i_duration,
+                         uint64_t i_size )
+{
+    p_recorder->i_duration = i_duration;
+    p_recorder->i_size = i_size;
+}
+
+/*****************************************************************************
+ * recorder_Write: a segment starts on a PAT, and once a limit is reached the
+ * next one starts on a random access point (preceded by the PAT and the
+ * PMT), or on a PAT if the stream doesn't signal them
+ *****************************************************************************/
+void recorder_Write( recorder_t *p_recorder, const uint8_t *p_ts,
+                     int64_t i_dts )
+{
+    uint16_t i_pid = ts_get_pid( p_ts );
+    bool b_af = ts_has_adaptation( p_ts ) && ts_get_adaptation( p_ts );
+    bool b_rap = b_af && tsaf_has_randomaccess( p_ts );
+    bool b_pcr = b_af && tsaf_has_pcr( p_ts );
+    bool b_pat = i_pid == PAT_PID && ts_get_unitstart( p_ts );
+    uint64_t i_offset;
+
+    if ( b_pat || i_pid == p_recorder->i_pmt_pid )
+        recorder_CachePSI( p_recorder, p_ts, i_pid );
+
+    if ( !p_recorder->b_started )
+    {
+        if ( !b_pat )
+            return;
+        recorder_StartSegment( p_recorder, i_dts );
+    }
+    else
+    {
+        if ( p_recorder->i_rotate_dts == -1
+              && ((p_recorder->i_duration
+                    && i_dts - p_recorder->i_segment_dts
+                        >= p_recorder->i_duration)
+                   || (p_recorder->i_size
+                        && p_recorder->i_segment_bytes >= p_recorder->i_size)) )
+            p_recorder->i_rotate_dts = i_dts;
+
+        if ( p_recorder->i_rotate_dts != -1
+              && (b_rap || (b_pat && (!p_recorder->b_rap_seen
+                      || i_dts - p_recorder->i_rotate_dts
+                          >= RECORD_RAP_TIMEOUT))) )
+        {
+            recorder_EndSegment( p_recorder );
+            recorder_StartSegment( p_recorder, i_dts );
+            if ( b_rap && p_recorder->b_pat
+                  && recorder_Append( p_recorder, p_recorder->p_pat )
+                  && p_recorder->b_pmt )
+                recorder_Append( p_recorder, p_recorder->p_pmt );
+            if ( !p_recorder->b_started )
+                return;
+        }
+    }
+
+    if ( b_rap )
+        p_recorder->b_rap_seen = true;
+    if ( b_pcr )
+        p_recorder->i_pcr = tsaf_get_pcr( p_ts ) * 300
+                             + tsaf_get_pcrext( p_ts );
+
+    i_offset = p_recorder->i_segment_bytes;
+    if ( !recorder_Append( p_recorder, p_ts ) )
+        return;
+
+    if ( (b_rap || (b_pcr && i_dts - p_recorder->i_index_dts
+                                 >= RECORD_INDEX_PERIOD))
+          && p_recorder->i_nb_entries < RECORD_MAX_ENTRIES )
+    {
+        record_index_t *p_entry =
+            &p_recorder->p_entries[p_recorder->i_nb_entries++];
+
+        p_entry->i_offset = i_offset;
+        p_entry->i_pcr = p_recorder->i_pcr;
+        p_entry->i_dts = i_dts;
+        p_entry->i_flags = (b_rap ? RECORD_INDEX_RAP : 0)
+                            | (b_pcr ? RECORD_INDEX_PCR : 0);
+        p_entry->i_reserved = 0;
+        p_recorder->i_index_dts = i_dts;
+    }
+}
+
+/*****************************************************************************
+ * recorder_Close: doesn't wait for the disk, the writer thread finishes the
+ * last segment and is joined later, by another recorder_Close or by
+ * recorder_JoinAll
+ *****************************************************************************/
+void recorder_Close( recorder_t *p_recorder )
+{
+    if ( p_recorder->b_started )
+        recorder_EndSegment( p_recorder );
+
+    pthread_mutex_lock( &p_recorder->lock );
+    p_recorder->b_exit = true;
+    pthread_cond_signal( &p_recorder->wait );
+    pthread_mutex_unlock( &p_recorder->lock );
+
+    recorder_Reap( false );
+
+    pthread_mutex_lock( &closed_lock );
+    p_recorder->p_next_closed = p_closed;
+    p_closed = p_recorder;
+    pthread_mutex_unlock( &closed_lock );
+}
+
+/*****************************************************************************
+ * recorder_JoinAll: waits for the closed recorders to be written out, so
+ * that the last blocks and the truncation of their tails aren't lost at exit
+ *****************************************************************************/
+void recorder_JoinAll( void )
+{
+    recorder_Reap( true );
+}
@@ -0,0 +1,70 @@
+/*****************************************************************************
+ * recorder.h: segment recorder outputs, writing the TS to disk
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef _DVBLAST_RECORDER_H_
+#define _DVBLAST_RECORDER_H_
+
+#include <stdint.h>
+
+/*****************************************************************************
+ * Each segment <start>-<n>.ts comes with a sidecar <start>-<n>.idx: a
+ * record_index_header_t followed by record_index_t entries, one for each
+ * random access point and one per RECORD_INDEX_PERIOD on the PCRs in
+ * between. Both are in host byte order.
+ *****************************************************************************/
+#define RECORD_INDEX_MAGIC 0x64766269 /* "dvbi" */
+#define RECORD_INDEX_VERSION 1
+
+#define RECORD_INDEX_RAP 0x1 /* the packet has random_access_indicator */
+#define RECORD_INDEX_PCR 0x2 /* the packet carries i_pcr */
+
+typedef struct record_index_header_t
+{
+    uint32_t i_magic;
+    uint32_t i_version;
+    uint32_t i_entry_size; /* sizeof(record_index_t) */
+    uint32_t i_reserved;
+} record_index_header_t;
+
+typedef struct record_index_t
+{
+    uint64_t i_offset; /* of the packet in the segment, in bytes */
+    int64_t i_pcr;     /* last PCR up to the packet, 27 MHz, -1 if none */
+    int64_t i_dts;     /* arrival of the packet, CLOCK_MONOTONIC in us */
+    uint32_t i_flags;
+    uint32_t i_reserved;
+} record_index_t;
+
+/*****************************************************************************
+ * Writer side, used by the outputs. recorder_Write only ever copies into
+ * the current block: the files are opened, written and closed by a thread
+ * of the recorder, so a slow disk drops packets rather than holding up the
+ * caller. recorder_JoinAll waits for the closed recorders at exit.
+ *****************************************************************************/
+typedef struct recorder_t recorder_t;
+
+recorder_t *recorder_Open( const char *psz_dir, int64_t i_duration,
+                           uint64_t i_size );
+void recorder_SetLimits( recorder_t *p_recorder, int64_t i_duration,
+                         uint64_t i_size );
+void recorder_Write( recorder_t *p_recorder, const uint8_t *p_ts,
+                     int64_t i_dts );
+void recorder_Close( recorder_t *p_recorder );
+void recorder_JoinAll( void );
+
+#endif
@@ -0,0 +1,138 @@
+/*****************************************************************************
+ * ring.h: lock-free single-producer/single-consumer ring
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef _DVBLAST_RING_H_
+#define _DVBLAST_RING_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define RING_CACHELINE 64
+
+/*****************************************************************************
+ * ring_t: exactly one thread may push and exactly one thread may pop.
+ * Head and tail live on separate cache lines so that the producer and the
+ * consumer do not bounce the same line between cores.
+ *****************************************************************************/
+typedef struct ring_t
+{
+    /* written by the producer */
+    _Alignas(RING_CACHELINE) atomic_uint i_head;
+    unsigned int i_max_depth;
+    atomic_uint_fast64_t i_overflows;
+
+    /* written by the consumer */
+    _Alignas(RING_CACHELINE) atomic_uint i_tail;
+
+    /* read-only after ring_Init */
+    _Alignas(RING_CACHELINE) unsigned int i_mask;
+    void **pp_items;
+} ring_t;
+
+/*****************************************************************************
+ * ring_Init: the size is rounded up to a power of two
+ *****************************************************************************/
+static inline bool ring_Init( ring_t *p_ring, unsigned int i_size )
+{
+    unsigned int i_real_size = 2;
+
+    while ( i_real_size < i_size )
+        i_real_size <<= 1;
+
+    p_ring->pp_items = calloc( i_real_size, sizeof(void *) );
+    if ( p_ring->pp_items == NULL )
+        return false;
+
+    p_ring->i_mask = i_real_size - 1;
+    p_ring->i_max_depth = 0;
+    atomic_init( &p_ring->i_head, 0 );
+    atomic_init( &p_ring->i_tail, 0 );
+    atomic_init( &p_ring->i_overflows, 0 );
+    return true;
+}
+
+static inline void ring_Clean( ring_t *p_ring )
+{
+    free( p_ring->pp_items );
+    p_ring->pp_items = NULL;
+}
+
+static inline unsigned int ring_Size( const ring_t *p_ring )
+{
+    return p_ring->i_mask + 1;
+}
+
+/*****************************************************************************
+ * ring_Count: approximate when called from a third thread
+ *****************************************************************************/
+static inline unsigned int ring_Count( ring_t *p_ring )
+{
+    return atomic_load_explicit( &p_ring->i_head, memory_order_acquire )
+         - atomic_load_explicit( &p_ring->i_tail, memory_order_acquire );
+}
+
+/*****************************************************************************
+ * ring_Push: producer side, returns false (and counts it) when full
+ *****************************************************************************/
+static inline bool ring_Push( ring_t *p_ring, void *p_item )
+{
+    unsigned int i_head = atomic_load_explicit( &p_ring->i_head,
+                                                memory_order_relaxed );
+    unsigned int i_tail = atomic_load_explicit( &p_ring->i_tail,
+                                                memory_order_acquire );
+    unsigned int i_depth = i_head - i_tail;
+
+    if ( i_depth > p_ring->i_mask )
+    {
+        atomic_fetch_add_explicit( &p_ring->i_overflows, 1,
+                                   memory_order_relaxed );
+        return false;
+    }
+
+    p_ring->pp_items[i_head & p_ring->i_mask] = p_item;
+    atomic_store_explicit( &p_ring->i_head, i_head + 1,
+                           memory_order_release );
+
+    if ( i_depth + 1 > p_ring->i_max_depth )
+        p_ring->i_max_depth = i_depth + 1;
+    return true;
+}
+
+/*****************************************************************************
+ * ring_Pop: consumer side, returns NULL when empty
+ *****************************************************************************/
+static inline void *ring_Pop( ring_t *p_ring )
+{
+    unsigned int i_tail = atomic_load_explicit( &p_ring->i_tail,
+                                                memory_order_relaxed );
+    unsigned int i_head = atomic_load_explicit( &p_ring->i_head,
+                                                memory_order_acquire );
+    void *p_item;
+
+    if ( i_head == i_tail )
+        return NULL;
+
+    p_item = p_ring->pp_items[i_tail & p_ring->i_mask];
+    atomic_store_explicit( &p_ring->i_tail, i_tail + 1,
+                           memory_order_release );
+    return p_item;
+}
+
+#endif
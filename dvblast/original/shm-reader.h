@@ -0,0 +1,68 @@
+/*****************************************************************************
+ * shm-reader.h: reader library for the shared memory outputs of dvblast
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/*
+ * An output configured as "shm:<name>" publishes its TS packets in the
+ * POSIX shared memory object /dvblast-<name>. Any number of readers may
+ * map it; they never slow down or block dvblast, and reading costs no
+ * system call. A reader which falls more than a ring behind loses the
+ * oldest packets, and is told how many.
+ *
+ *     shm_reader_t *p_reader = shmreader_Open( "tv1" );
+ *     uint8_t p_ts[100 * 188];
+ *     uint64_t i_lost = 0;
+ *
+ *     for ( ;; )
+ *     {
+ *         int i = shmreader_Read( p_reader, p_ts, 100, NULL, &i_lost );
+ *         if ( !i )
+ *             shmreader_Wait( p_reader, 10000 );
+ *         ...
+ *     }
+ */
+
+#ifndef _DVBLAST_SHM_READER_H_
+#define _DVBLAST_SHM_READER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct shm_reader_t shm_reader_t;
+
+/* NULL with errno set if the ring does not exist or is not a ring */
+shm_reader_t *shmreader_Open( const char *psz_name );
+void shmreader_Close( shm_reader_t *p_reader );
+
+/* Copies up to i_max packets of 188 bytes into p_ts and their dts (in us,
+ * CLOCK_MONOTONIC) into pi_dts if it is not NULL. Never blocks; returns the
+ * number of packets copied and adds the packets overrun to *pi_lost. */
+int shmreader_Read( shm_reader_t *p_reader, uint8_t *p_ts, int i_max,
+                    int64_t *pi_dts, uint64_t *pi_lost );
+
+/* Returns true as soon as a packet is available, false after i_timeout us */
+bool shmreader_Wait( shm_reader_t *p_reader, int i_timeout );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,285 @@
+/*****************************************************************************
+ * shm-ring.c: shared memory output rings, writer and reader sides
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm-ring.h"
+#include "shm-reader.h"
+
+#define WAIT_PERIOD 1000 /* us between two polls in shmreader_Wait() */
+
+struct shm_reader_t
+{
+    shm_ring_t *p_ring;
+    size_t i_size;
+    uint64_t i_nb_slots; /* checked at the opening, the writer can't change it */
+    uint64_t i_read;
+};
+
+/*****************************************************************************
+ * ShmPath: the object name is the prefix followed by the output name
+ *****************************************************************************/
+static char *ShmPath( const char *psz_name )
+{
+    char *psz_path = malloc( strlen(SHM_RING_PREFIX) + strlen(psz_name) + 1 );
+
+    if ( psz_path == NULL )
+        return NULL;
+    strcpy( psz_path, SHM_RING_PREFIX );
+    strcat( psz_path, psz_name );
+    return psz_path;
+}
+
+/*****************************************************************************
+ * shmwriter_Open: creates a new object, a stale one of the same name is
+ * unlinked first so that its readers are not left with a truncated mapping
+ *****************************************************************************/
+int shmwriter_Open( shm_writer_t *p_writer, const char *psz_name,
+                    unsigned int i_nb_slots )
+{
+    unsigned int i_real_slots = 2;
+    shm_ring_t *p_ring;
+    int i_fd, i_ret;
+
+    while ( i_real_slots < i_nb_slots )
+        i_real_slots <<= 1;
+
+    p_writer->psz_path = ShmPath( psz_name );
+    if ( p_writer->psz_path == NULL )
+        return -ENOMEM;
+    p_writer->i_size = sizeof(shm_ring_t)
+                        + (size_t)i_real_slots * sizeof(shm_ring_slot_t);
+    p_writer->i_write = 0;
+
+    shm_unlink( p_writer->psz_path );
+    i_fd = shm_open( p_writer->psz_path, O_RDWR | O_CREAT | O_EXCL, 0644 );
+    if ( i_fd < 0 )
+        goto error;
+
+    if ( ftruncate( i_fd, p_writer->i_size ) < 0 )
+    {
+        close( i_fd );
+        shm_unlink( p_writer->psz_path );
+        goto error;
+    }
+
+    p_ring = mmap( NULL, p_writer->i_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   i_fd, 0 );
+    close( i_fd );
+    if ( p_ring == MAP_FAILED )
+    {
+        shm_unlink( p_writer->psz_path );
+        goto error;
+    }
+
+    /* the object is zeroed, so every slot reads as not written yet */
+    p_ring->i_version = SHM_RING_VERSION;
+    p_ring->i_slot_size = sizeof(shm_ring_slot_t);
+    p_ring->i_nb_slots = i_real_slots;
+    atomic_init( &p_ring->i_write, 0 );
+    atomic_thread_fence( memory_order_release );
+    p_ring->i_magic = SHM_RING_MAGIC;
+
+    p_writer->p_ring = p_ring;
+    return 0;
+
+error:
+    i_ret = -errno;
+    free( p_writer->psz_path );
+    p_writer->psz_path = NULL;
+    p_writer->p_ring = NULL;
+    return i_ret;
+}
+
+/*****************************************************************************
+ * shmwriter_Close: readers keep their mapping until they close it
+ *****************************************************************************/
+void shmwriter_Close( shm_writer_t *p_writer )
+{
+    if ( p_writer->p_ring == NULL )
+        return;
+
+    munmap( p_writer->p_ring, p_writer->i_size );
+    shm_unlink( p_writer->psz_path );
+    free( p_writer->psz_path );
+    p_writer->p_ring = NULL;
+    p_writer->psz_path = NULL;
+}
+
+/*****************************************************************************
+ * shmreader_Open: starts with the next packet written
+ *****************************************************************************/
+shm_reader_t *shmreader_Open( const char *psz_name )
+{
+    char *psz_path = ShmPath( psz_name );
+    shm_reader_t *p_reader;
+    struct stat st;
+    int i_fd;
+
+    if ( psz_path == NULL )
+        return NULL;
+    i_fd = shm_open( psz_path, O_RDONLY, 0 );
+    free( psz_path );
+    if ( i_fd < 0 )
+        return NULL;
+
+    if ( fstat( i_fd, &st ) < 0 )
+    {
+        close( i_fd );
+        return NULL;
+    }
+    if ( st.st_size < (off_t)sizeof(shm_ring_t) )
+    {
+        close( i_fd );
+        errno = EINVAL;
+        return NULL;
+    }
+
+    p_reader = malloc( sizeof(shm_reader_t) );
+    if ( p_reader == NULL )
+    {
+        close( i_fd );
+        return NULL;
+    }
+    p_reader->i_size = st.st_size;
+    p_reader->p_ring = mmap( NULL, p_reader->i_size, PROT_READ, MAP_SHARED,
+                             i_fd, 0 );
+    close( i_fd );
+    if ( p_reader->p_ring == MAP_FAILED )
+    {
+        free( p_reader );
+        return NULL;
+    }
+
+    /* the header comes from another process, the slot mask needs a power
+     * of two */
+    p_reader->i_nb_slots = p_reader->p_ring->i_nb_slots;
+    if ( p_reader->p_ring->i_magic != SHM_RING_MAGIC
+          || p_reader->p_ring->i_version != SHM_RING_VERSION
+          || p_reader->p_ring->i_slot_size != sizeof(shm_ring_slot_t)
+          || !p_reader->i_nb_slots
+          || (p_reader->i_nb_slots & (p_reader->i_nb_slots - 1))
+          || sizeof(shm_ring_t) + (size_t)p_reader->i_nb_slots
+               * sizeof(shm_ring_slot_t) > p_reader->i_size )
+    {
+        shmreader_Close( p_reader );
+        errno = EINVAL;
+        return NULL;
+    }
+    atomic_thread_fence( memory_order_acquire );
+
+    p_reader->i_read = atomic_load_explicit( &p_reader->p_ring->i_write,
+                                             memory_order_acquire );
+    return p_reader;
+}
+
+void shmreader_Close( shm_reader_t *p_reader )
+{
+    munmap( p_reader->p_ring, p_reader->i_size );
+    free( p_reader );
+}
+
+/*****************************************************************************
+ * shmreader_Read: a packet is only returned if its slot carried the same
+ * sequence before and after the copy, otherwise the writer overran it
+ *****************************************************************************/
+int shmreader_Read( shm_reader_t *p_reader, uint8_t *p_ts, int i_max,
+                    int64_t *pi_dts, uint64_t *pi_lost )
+{
+    shm_ring_t *p_ring = p_reader->p_ring;
+    uint64_t i_nb_slots = p_reader->i_nb_slots;
+    uint64_t i_write = atomic_load_explicit( &p_ring->i_write,
+                                             memory_order_acquire );
+    int i_nb = 0;
+
+    while ( i_nb < i_max && p_reader->i_read < i_write )
+    {
+        shm_ring_slot_t *p_slot =
+            &p_ring->p_slots[p_reader->i_read & (i_nb_slots - 1)];
+        uint64_t i_seq = 2 * p_reader->i_read + 2;
+        uint64_t i_before, i_after, i_skip;
+
+        if ( i_write - p_reader->i_read > i_nb_slots )
+        {
+            /* overrun, skip to half a ring behind the writer */
+            i_skip = i_write - i_nb_slots / 2;
+            *pi_lost += i_skip - p_reader->i_read;
+            p_reader->i_read = i_skip;
+            continue;
+        }
+
+        i_before = atomic_load_explicit( &p_slot->i_seq,
+                                         memory_order_acquire );
+        if ( i_before == i_seq )
+        {
+            memcpy( p_ts + i_nb * SHM_RING_TS_SIZE, p_slot->p_ts,
+                    SHM_RING_TS_SIZE );
+            if ( pi_dts != NULL )
+                pi_dts[i_nb] = p_slot->i_dts;
+            atomic_thread_fence( memory_order_acquire );
+            i_after = atomic_load_explicit( &p_slot->i_seq,
+                                            memory_order_relaxed );
+            if ( i_after == i_seq )
+            {
+                i_nb++;
+                p_reader->i_read++;
+                continue;
+            }
+        }
+
+        /* the slot was rewritten by a packet which may not even be
+         * published yet, so skip at least this one */
+        i_write = atomic_load_explicit( &p_ring->i_write,
+                                        memory_order_acquire );
+        i_skip = i_write > i_nb_slots / 2 ? i_write - i_nb_slots / 2 : 0;
+        if ( i_skip <= p_reader->i_read )
+            i_skip = p_reader->i_read + 1;
+        *pi_lost += i_skip - p_reader->i_read;
+        p_reader->i_read = i_skip;
+    }
+
+    return i_nb;
+}
+
+/*****************************************************************************
+ * shmreader_Wait: polls, so that readers need no write access to the ring
+ *****************************************************************************/
+bool shmreader_Wait( shm_reader_t *p_reader, int i_timeout )
+{
+    struct timespec ts = { 0, WAIT_PERIOD * 1000 };
+
+    for ( ;; )
+    {
+        if ( atomic_load_explicit( &p_reader->p_ring->i_write,
+                                   memory_order_acquire ) > p_reader->i_read )
+            return true;
+        if ( i_timeout <= 0 )
+            return false;
+        nanosleep( &ts, NULL );
+        i_timeout -= WAIT_PERIOD;
+    }
+}
@@ -0,0 +1,109 @@
+/*****************************************************************************
+ * shm-ring.h: layout of the shared memory output rings
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef _DVBLAST_SHM_RING_H_
+#define _DVBLAST_SHM_RING_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define SHM_RING_MAGIC 0x64766273 /* "dvbs" */
+#define SHM_RING_VERSION 1
+#define SHM_RING_PREFIX "/dvblast-"
+#define SHM_RING_TS_SIZE 188
+
+/*****************************************************************************
+ * shm_ring_slot_t: one TS packet. Packet n goes to slot n % i_nb_slots, and
+ * i_seq is 2n+1 while it is written and 2n+2 once it is complete, so that
+ * a reader can tell a packet it has not seen yet from a packet which
+ * overwrote the one it wanted.
+ *****************************************************************************/
+typedef struct shm_ring_slot_t
+{
+    atomic_uint_fast64_t i_seq;
+    int64_t i_dts; /* CLOCK_MONOTONIC, in us */
+    uint8_t p_ts[SHM_RING_TS_SIZE];
+} shm_ring_slot_t;
+
+/*****************************************************************************
+ * shm_ring_t: mapped at the start of the shared memory object, written by
+ * dvblast only
+ *****************************************************************************/
+typedef struct shm_ring_t
+{
+    uint32_t i_magic;
+    uint32_t i_version;
+    uint32_t i_slot_size; /* sizeof(shm_ring_slot_t) */
+    uint32_t i_nb_slots;  /* power of two */
+
+    /* packets published so far */
+    _Alignas(64) atomic_uint_fast64_t i_write;
+
+    _Alignas(64) shm_ring_slot_t p_slots[];
+} shm_ring_t;
+
+/*****************************************************************************
+ * Writer side, used by the outputs
+ *****************************************************************************/
+typedef struct shm_writer_t
+{
+    shm_ring_t *p_ring;
+    size_t i_size;
+    uint64_t i_write;
+    char *psz_path;
+} shm_writer_t;
+
+int shmwriter_Open( shm_writer_t *p_writer, const char *psz_name,
+                    unsigned int i_nb_slots );
+void shmwriter_Close( shm_writer_t *p_writer );
+
+/*****************************************************************************
+ * shmwriter_Begin/Commit: the packet is written in place between the two;
+ * the write counter is only published by shmwriter_Flush
+ *****************************************************************************/
+static inline uint8_t *shmwriter_Begin( shm_writer_t *p_writer )
+{
+    shm_ring_t *p_ring = p_writer->p_ring;
+    shm_ring_slot_t *p_slot =
+        &p_ring->p_slots[p_writer->i_write & (p_ring->i_nb_slots - 1)];
+
+    atomic_store_explicit( &p_slot->i_seq, 2 * p_writer->i_write + 1,
+                           memory_order_relaxed );
+    atomic_thread_fence( memory_order_release );
+    return p_slot->p_ts;
+}
+
+static inline void shmwriter_Commit( shm_writer_t *p_writer, int64_t i_dts )
+{
+    shm_ring_t *p_ring = p_writer->p_ring;
+    shm_ring_slot_t *p_slot =
+        &p_ring->p_slots[p_writer->i_write & (p_ring->i_nb_slots - 1)];
+
+    p_slot->i_dts = i_dts;
+    atomic_store_explicit( &p_slot->i_seq, 2 * p_writer->i_write + 2,
+                           memory_order_release );
+    p_writer->i_write++;
+}
+
+static inline void shmwriter_Flush( shm_writer_t *p_writer )
+{
+    atomic_store_explicit( &p_writer->p_ring->i_write, p_writer->i_write,
+                           memory_order_release );
+}
+
+#endif
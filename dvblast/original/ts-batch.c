@@ -0,0 +1,294 @@
+/*****************************************************************************
+ * ts-batch.c: TS header pre-pass over a chain of blocks
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/*
+ * Blocks are scattered in memory, so the four header bytes of each packet
+ * are first loaded once into pi_hdr[]. The fields are then extracted from
+ * that contiguous array several packets at a time, into arrays which
+ * demux_Handle() and mrtgAnalyse() read instead of the packets.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <immintrin.h>
+#   define HAVE_TS_BATCH_X86
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#   include <arm_neon.h>
+#   define HAVE_TS_BATCH_NEON
+#endif
+
+#include "dvblast.h"
+#include "ts-batch.h"
+
+/*****************************************************************************
+ * Local declarations
+ *****************************************************************************/
+typedef unsigned int (*tsbatch_parse_t)( ts_batch_t *p_batch );
+
+static tsbatch_parse_t pf_parse = NULL;
+
+/*****************************************************************************
+ * tsbatch_ParseOne: scalar extraction, also used for the tail of a batch
+ *****************************************************************************/
+static inline void tsbatch_ParseOne( ts_batch_t *p_batch, unsigned int i )
+{
+    uint32_t i_hdr = p_batch->pi_hdr[i];
+
+    p_batch->pi_pid[i] = (i_hdr & 0x1f00) | ((i_hdr >> 16) & 0xff);
+    p_batch->pi_cc[i] = (i_hdr >> 24) & 0xf;
+    p_batch->pi_flags[i] = ((i_hdr & 0xff) != 0x47 ? TS_BATCH_INVALID : 0)
+                            | ((i_hdr >> 14) & TS_BATCH_TEI)
+                            | ((i_hdr >> 12) & TS_BATCH_UNITSTART)
+                            | ((i_hdr >> 24) & 0xf0);
+}
+
+static unsigned int tsbatch_ParseC( ts_batch_t *p_batch )
+{
+    return 0;
+}
+
+#ifdef HAVE_TS_BATCH_X86
+/*****************************************************************************
+ * tsbatch_ParseSSE41: 4 headers per iteration
+ *****************************************************************************/
+__attribute__((target("sse4.1")))
+static unsigned int tsbatch_ParseSSE41( ts_batch_t *p_batch )
+{
+    const __m128i pid_hi = _mm_set1_epi32( 0x1f00 );
+    const __m128i low_byte = _mm_set1_epi32( 0xff );
+    const __m128i sync = _mm_set1_epi32( 0x47 );
+    const __m128i invalid = _mm_set1_epi32( TS_BATCH_INVALID );
+    const __m128i tei = _mm_set1_epi32( TS_BATCH_TEI );
+    const __m128i unitstart = _mm_set1_epi32( TS_BATCH_UNITSTART );
+    const __m128i high_nibble = _mm_set1_epi32( 0xf0 );
+    const __m128i low_nibble = _mm_set1_epi32( 0xf );
+    unsigned int i;
+
+    for ( i = 0; i + 4 <= p_batch->i_size; i += 4 )
+    {
+        __m128i hdr = _mm_loadu_si128( (const __m128i *)&p_batch->pi_hdr[i] );
+        __m128i pid = _mm_or_si128( _mm_and_si128( hdr, pid_hi ),
+                          _mm_and_si128( _mm_srli_epi32( hdr, 16 ), low_byte ) );
+        __m128i cc = _mm_and_si128( _mm_srli_epi32( hdr, 24 ), low_nibble );
+        __m128i is_sync = _mm_cmpeq_epi32( _mm_and_si128( hdr, low_byte ),
+                                           sync );
+        __m128i flags = _mm_andnot_si128( is_sync, invalid );
+        __m128i bytes;
+        int32_t i_cc, i_flags;
+
+        flags = _mm_or_si128( flags,
+                    _mm_and_si128( _mm_srli_epi32( hdr, 14 ), tei ) );
+        flags = _mm_or_si128( flags,
+                    _mm_and_si128( _mm_srli_epi32( hdr, 12 ), unitstart ) );
+        flags = _mm_or_si128( flags,
+                    _mm_and_si128( _mm_srli_epi32( hdr, 24 ), high_nibble ) );
+
+        _mm_storel_epi64( (__m128i *)&p_batch->pi_pid[i],
+                          _mm_packus_epi32( pid, pid ) );
+
+        /* cc in bytes 0-3, flags in bytes 4-7 */
+        bytes = _mm_packus_epi32( cc, flags );
+        bytes = _mm_packus_epi16( bytes, bytes );
+        i_cc = _mm_cvtsi128_si32( bytes );
+        i_flags = _mm_extract_epi32( bytes, 1 );
+        memcpy( &p_batch->pi_cc[i], &i_cc, 4 );
+        memcpy( &p_batch->pi_flags[i], &i_flags, 4 );
+    }
+    return i;
+}
+
+/*****************************************************************************
+ * tsbatch_ParseAVX2: 8 headers per iteration
+ *****************************************************************************/
+__attribute__((target("avx2")))
+static unsigned int tsbatch_ParseAVX2( ts_batch_t *p_batch )
+{
+    const __m256i pid_hi = _mm256_set1_epi32( 0x1f00 );
+    const __m256i low_byte = _mm256_set1_epi32( 0xff );
+    const __m256i sync = _mm256_set1_epi32( 0x47 );
+    const __m256i invalid = _mm256_set1_epi32( TS_BATCH_INVALID );
+    const __m256i tei = _mm256_set1_epi32( TS_BATCH_TEI );
+    const __m256i unitstart = _mm256_set1_epi32( TS_BATCH_UNITSTART );
+    const __m256i high_nibble = _mm256_set1_epi32( 0xf0 );
+    const __m256i low_nibble = _mm256_set1_epi32( 0xf );
+    unsigned int i;
+
+    for ( i = 0; i + 8 <= p_batch->i_size; i += 8 )
+    {
+        __m256i hdr = _mm256_loadu_si256(
+                          (const __m256i *)&p_batch->pi_hdr[i] );
+        __m256i pid = _mm256_or_si256( _mm256_and_si256( hdr, pid_hi ),
+                          _mm256_and_si256( _mm256_srli_epi32( hdr, 16 ),
+                                            low_byte ) );
+        __m256i cc = _mm256_and_si256( _mm256_srli_epi32( hdr, 24 ),
+                                       low_nibble );
+        __m256i is_sync = _mm256_cmpeq_epi32(
+                              _mm256_and_si256( hdr, low_byte ), sync );
+        __m256i flags = _mm256_andnot_si256( is_sync, invalid );
+        __m256i words, bytes;
+        int32_t i_word;
+
+        flags = _mm256_or_si256( flags,
+                    _mm256_and_si256( _mm256_srli_epi32( hdr, 14 ), tei ) );
+        flags = _mm256_or_si256( flags,
+                    _mm256_and_si256( _mm256_srli_epi32( hdr, 12 ),
+                                      unitstart ) );
+        flags = _mm256_or_si256( flags,
+                    _mm256_and_si256( _mm256_srli_epi32( hdr, 24 ),
+                                      high_nibble ) );
+
+        /* packs work within 128-bit lanes, gather the two halves back */
+        words = _mm256_packus_epi32( pid, pid );
+        words = _mm256_permute4x64_epi64( words, 0x08 );
+        _mm_storeu_si128( (__m128i *)&p_batch->pi_pid[i],
+                          _mm256_castsi256_si128( words ) );
+
+        /* per lane: cc in bytes 0-3, flags in bytes 4-7 */
+        bytes = _mm256_packus_epi32( cc, flags );
+        bytes = _mm256_packus_epi16( bytes, bytes );
+        i_word = _mm256_extract_epi32( bytes, 0 );
+        memcpy( &p_batch->pi_cc[i], &i_word, 4 );
+        i_word = _mm256_extract_epi32( bytes, 4 );
+        memcpy( &p_batch->pi_cc[i + 4], &i_word, 4 );
+        i_word = _mm256_extract_epi32( bytes, 1 );
+        memcpy( &p_batch->pi_flags[i], &i_word, 4 );
+        i_word = _mm256_extract_epi32( bytes, 5 );
+        memcpy( &p_batch->pi_flags[i + 4], &i_word, 4 );
+    }
+    return i;
+}
+#endif
+
+#ifdef HAVE_TS_BATCH_NEON
+/*****************************************************************************
+ * tsbatch_ParseNEON: 4 headers per iteration
+ *****************************************************************************/
+static unsigned int tsbatch_ParseNEON( ts_batch_t *p_batch )
+{
+    const uint32x4_t pid_hi = vdupq_n_u32( 0x1f00 );
+    const uint32x4_t low_byte = vdupq_n_u32( 0xff );
+    const uint32x4_t sync = vdupq_n_u32( 0x47 );
+    const uint32x4_t invalid = vdupq_n_u32( TS_BATCH_INVALID );
+    const uint32x4_t tei = vdupq_n_u32( TS_BATCH_TEI );
+    const uint32x4_t unitstart = vdupq_n_u32( TS_BATCH_UNITSTART );
+    const uint32x4_t high_nibble = vdupq_n_u32( 0xf0 );
+    const uint32x4_t low_nibble = vdupq_n_u32( 0xf );
+    unsigned int i;
+
+    for ( i = 0; i + 4 <= p_batch->i_size; i += 4 )
+    {
+        uint32x4_t hdr = vld1q_u32( &p_batch->pi_hdr[i] );
+        uint32x4_t pid = vorrq_u32( vandq_u32( hdr, pid_hi ),
+                             vandq_u32( vshrq_n_u32( hdr, 16 ), low_byte ) );
+        uint32x4_t cc = vandq_u32( vshrq_n_u32( hdr, 24 ), low_nibble );
+        uint32x4_t is_sync = vceqq_u32( vandq_u32( hdr, low_byte ), sync );
+        uint32x4_t flags = vbicq_u32( invalid, is_sync );
+        uint8x8_t bytes;
+
+        flags = vorrq_u32( flags,
+                    vandq_u32( vshrq_n_u32( hdr, 14 ), tei ) );
+        flags = vorrq_u32( flags,
+                    vandq_u32( vshrq_n_u32( hdr, 12 ), unitstart ) );
+        flags = vorrq_u32( flags,
+                    vandq_u32( vshrq_n_u32( hdr, 24 ), high_nibble ) );
+
+        vst1_u16( &p_batch->pi_pid[i], vmovn_u32( pid ) );
+
+        /* cc in bytes 0-3, flags in bytes 4-7 */
+        bytes = vmovn_u16( vcombine_u16( vmovn_u32( cc ), vmovn_u32( flags ) ) );
+        vst1_lane_u32( (uint32_t *)&p_batch->pi_cc[i],
+                       vreinterpret_u32_u8( bytes ), 0 );
+        vst1_lane_u32( (uint32_t *)&p_batch->pi_flags[i],
+                       vreinterpret_u32_u8( bytes ), 1 );
+    }
+    return i;
+}
+#endif
+
+/*****************************************************************************
+ * tsbatch_Init: picks the widest implementation the CPU supports
+ *****************************************************************************/
+void tsbatch_Init( void )
+{
+    const char *psz_impl = "C";
+
+    pf_parse = tsbatch_ParseC;
+
+#ifdef HAVE_TS_BATCH_X86
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx2" ) )
+    {
+        pf_parse = tsbatch_ParseAVX2;
+        psz_impl = "AVX2";
+    }
+    else if ( __builtin_cpu_supports( "sse4.1" ) )
+    {
+        pf_parse = tsbatch_ParseSSE41;
+        psz_impl = "SSE4.1";
+    }
+#elif defined(HAVE_TS_BATCH_NEON)
+    pf_parse = tsbatch_ParseNEON;
+    psz_impl = "NEON";
+#endif
+
+    msg_Dbg( NULL, "using %s TS header pre-pass", psz_impl );
+}
+
+/*****************************************************************************
+ * tsbatch_Fill: takes up to TS_BATCH_SIZE blocks off the chain, loading
+ * their headers, and returns the rest of the chain
+ *****************************************************************************/
+block_t *tsbatch_Fill( ts_batch_t *p_batch, block_t *p_ts )
+{
+    unsigned int i = 0;
+
+    while ( p_ts != NULL && i < TS_BATCH_SIZE )
+    {
+        const uint8_t *p = p_ts->p_ts;
+        block_t *p_next = p_ts->p_next;
+
+        p_ts->p_next = NULL;
+        p_batch->pp_blocks[i] = p_ts;
+        p_batch->pi_hdr[i] = p[0] | (p[1] << 8) | (p[2] << 16)
+                              | ((uint32_t)p[3] << 24);
+        i++;
+        p_ts = p_next;
+    }
+
+    p_batch->i_size = i;
+    return p_ts;
+}
+
+/*****************************************************************************
+ * tsbatch_Parse: fills the pid, cc and flags arrays from the raw headers
+ *****************************************************************************/
+void tsbatch_Parse( ts_batch_t *p_batch )
+{
+    unsigned int i;
+
+    if ( pf_parse == NULL )
+        tsbatch_Init();
+
+    for ( i = pf_parse( p_batch ); i < p_batch->i_size; i++ )
+        tsbatch_ParseOne( p_batch, i );
+}
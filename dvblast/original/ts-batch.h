@@ -0,0 +1,52 @@
+/*****************************************************************************
+ * ts-batch.h: TS header pre-pass over a chain of blocks
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef _DVBLAST_TS_BATCH_H_
+#define _DVBLAST_TS_BATCH_H_
+
+#include <stdint.h>
+
+#define TS_BATCH_SIZE 256
+
+/* pi_flags bits; the upper nibble is the upper nibble of the 4th header
+ * byte, so TS_BATCH_SCRAMBLING >> 6 is the transport_scrambling_control */
+#define TS_BATCH_INVALID 0x01 /* no sync byte */
+#define TS_BATCH_TEI 0x02
+#define TS_BATCH_UNITSTART 0x04
+#define TS_BATCH_PAYLOAD 0x10
+#define TS_BATCH_ADAPTATION 0x20
+#define TS_BATCH_SCRAMBLING 0xc0
+
+/*****************************************************************************
+ * ts_batch_t: headers of up to TS_BATCH_SIZE packets, one array per field
+ *****************************************************************************/
+typedef struct ts_batch_t
+{
+    unsigned int i_size;
+    struct block_t *pp_blocks[TS_BATCH_SIZE];
+    uint32_t pi_hdr[TS_BATCH_SIZE]; /* raw headers, first byte lowest */
+    uint16_t pi_pid[TS_BATCH_SIZE];
+    uint8_t pi_cc[TS_BATCH_SIZE];
+    uint8_t pi_flags[TS_BATCH_SIZE];
+} ts_batch_t;
+
+void tsbatch_Init( void );
+struct block_t *tsbatch_Fill( ts_batch_t *p_batch, struct block_t *p_ts );
+void tsbatch_Parse( ts_batch_t *p_batch );
+
+#endif
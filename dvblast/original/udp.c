@@ -20,6 +20,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
  *****************************************************************************/
 
+#define _GNU_SOURCE /* recvmmsg */
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -50,12 +51,20 @@
  *****************************************************************************/
 #define UDP_LOCK_TIMEOUT 5000000 /* 5 s */
 #define PRINT_REFRACTORY_PERIOD 1000000 /* 1 s */
+#define MAX_RECV_BATCH 64 /* datagrams per recvmmsg() */
 
 static int i_handle;
 static struct ev_io udp_watcher;
 static struct ev_timer mute_watcher;
 static bool b_udp = false;
 static int i_block_cnt;
+static int i_recv_batch = 1;
+#ifdef HAVE_RECVMMSG
+static struct mmsghdr *p_recv_msgs = NULL;
+static struct iovec *p_recv_iov;
+static uint8_t (*pp_recv_rtp_hdr)[RTP_HEADER_SIZE];
+static block_t **pp_recv_blocks;
+#endif
 static uint8_t pi_ssrc[4] = { 0, 0, 0, 0 };
 static uint16_t i_seqnum = 0;
 static bool b_sync = false;
@@ -66,6 +75,9 @@ static struct sockaddr_storage last_addr;
  * Local prototypes
  *****************************************************************************/
 static void udp_Read(struct ev_loop *loop, struct ev_io *w, int revents);
+#ifdef HAVE_RECVMMSG
+static void udp_ReadBatch(struct ev_loop *loop);
+#endif
 static void udp_MuteCb(struct ev_loop *loop, struct ev_timer *w, int revents);
 
 /*****************************************************************************
@@ -120,6 +132,8 @@ void udp_Open( void )
             b_udp = true;
         else if ( IS_OPTION("mtu=") )
             i_mtu = strtol( ARG_OPTION("mtu="), NULL, 0 );
+        else if ( IS_OPTION("batch=") )
+            i_recv_batch = strtol( ARG_OPTION("batch="), NULL, 0 );
         else if ( IS_OPTION("ifindex=") )
             i_if_index = strtol( ARG_OPTION("ifindex="), NULL, 0 );
         else if ( IS_OPTION("ifaddr=") ) {
@@ -144,6 +158,16 @@ void udp_Open( void )
         i_mtu = i_family == AF_INET6 ? DEFAULT_IPV6_MTU : DEFAULT_IPV4_MTU;
     i_block_cnt = (i_mtu - (b_udp ? 0 : RTP_HEADER_SIZE)) / TS_SIZE;
 
+#ifdef HAVE_RECVMMSG
+    if ( i_recv_batch > MAX_RECV_BATCH )
+        i_recv_batch = MAX_RECV_BATCH;
+#else
+    if ( i_recv_batch > 1 )
+        msg_Warn( NULL, "recvmmsg() unavailable, ignoring batch option" );
+#endif
+    if ( i_recv_batch < 1 )
+        i_recv_batch = 1;
+
 
     /* Do stuff. */
 
@@ -273,6 +297,9 @@ void udp_Open( void )
     free( psz_save );
 
     msg_Dbg( NULL, "binding socket to %s", psz_udp_src );
+    if ( i_recv_batch > 1 )
+        msg_Dbg( NULL, "receiving up to %d datagrams per wakeup",
+                 i_recv_batch );
 
     ev_io_init(&udp_watcher, udp_Read, i_handle, EV_READ);
     ev_io_start(event_loop, &udp_watcher);
@@ -282,6 +309,70 @@ void udp_Open( void )
     memset(&last_addr, 0, sizeof(last_addr));
 }
 
+/*****************************************************************************
+ * udp_CheckRTP: SSRC and sequence number tracking
+ *****************************************************************************/
+static void udp_CheckRTP( const uint8_t *p_rtp_hdr )
+{
+    uint8_t pi_new_ssrc[4];
+
+    if ( !rtp_check_hdr(p_rtp_hdr) )
+        msg_Warn( NULL, "invalid RTP packet received" );
+    if ( rtp_get_type(p_rtp_hdr) != RTP_TYPE_TS )
+        msg_Warn( NULL, "non-TS RTP packet received" );
+    rtp_get_ssrc(p_rtp_hdr, pi_new_ssrc);
+    if ( !memcmp( pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t) ) )
+    {
+        if ( rtp_get_seqnum(p_rtp_hdr) != i_seqnum )
+            msg_Warn( NULL, "RTP discontinuity" );
+    }
+    else
+    {
+        struct in_addr addr;
+        memcpy( &addr.s_addr, pi_new_ssrc, 4 * sizeof(uint8_t) );
+        msg_Dbg( NULL, "new RTP source: %s", inet_ntoa( addr ) );
+        memcpy( pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t) );
+        switch (i_print_type) {
+        case PRINT_XML:
+            fprintf(print_fh,
+                    "<STATUS type=\"rtpsource\" source=\"%s\"/>\n",
+                    inet_ntoa( addr ));
+            break;
+        case PRINT_TEXT:
+            fprintf(print_fh, "rtpsource: %s\n", inet_ntoa( addr ) );
+            break;
+        default:
+            break;
+        }
+    }
+    i_seqnum = rtp_get_seqnum(p_rtp_hdr) + 1;
+}
+
+/*****************************************************************************
+ * udp_Lock: we received TS packets
+ *****************************************************************************/
+static void udp_Lock( struct ev_loop *loop )
+{
+    if ( !b_sync )
+    {
+        msg_Info( NULL, "frontend has acquired lock" );
+        switch (i_print_type) {
+        case PRINT_XML:
+            fprintf(print_fh, "<STATUS type=\"lock\" status=\"1\"/>\n");
+            break;
+        case PRINT_TEXT:
+            fprintf(print_fh, "lock status: 1\n");
+            break;
+        default:
+            break;
+        }
+
+        b_sync = true;
+    }
+
+    ev_timer_again(loop, &mute_watcher);
+}
+
 /*****************************************************************************
  * UDP events
  *****************************************************************************/
@@ -328,6 +419,14 @@ static void udp_Read(struct ev_loop *loop, struct ev_io *w, int revents)
         }
     }
 
+#ifdef HAVE_RECVMMSG
+    if ( i_recv_batch > 1 )
+    {
+        udp_ReadBatch( loop );
+        return;
+    }
+#endif
+
     struct iovec p_iov[i_block_cnt + 1];
     block_t *p_ts, **pp_current = &p_ts;
     int i_iov, i_block;
@@ -362,78 +461,117 @@ static void udp_Read(struct ev_loop *loop, struct ev_io *w, int revents)
 
     if ( !b_udp )
     {
-        uint8_t pi_new_ssrc[4];
-
-        if ( !rtp_check_hdr(p_rtp_hdr) )
-            msg_Warn( NULL, "invalid RTP packet received" );
-        if ( rtp_get_type(p_rtp_hdr) != RTP_TYPE_TS )
-            msg_Warn( NULL, "non-TS RTP packet received" );
-        rtp_get_ssrc(p_rtp_hdr, pi_new_ssrc);
-        if ( !memcmp( pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t) ) )
-        {
-            if ( rtp_get_seqnum(p_rtp_hdr) != i_seqnum )
-                msg_Warn( NULL, "RTP discontinuity" );
-        }
-        else
-        {
-            struct in_addr addr;
-            memcpy( &addr.s_addr, pi_new_ssrc, 4 * sizeof(uint8_t) );
-            msg_Dbg( NULL, "new RTP source: %s", inet_ntoa( addr ) );
-            memcpy( pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t) );
-            switch (i_print_type) {
-            case PRINT_XML:
-                fprintf(print_fh,
-                        "<STATUS type=\"rtpsource\" source=\"%s\"/>\n",
-                        inet_ntoa( addr ));
-                break;
-            case PRINT_TEXT:
-                fprintf(print_fh, "rtpsource: %s\n", inet_ntoa( addr ) );
-                break;
-            default:
-                break;
-            }
-        }
-        i_seqnum = rtp_get_seqnum(p_rtp_hdr) + 1;
-
+        udp_CheckRTP( p_rtp_hdr );
         i_len -= RTP_HEADER_SIZE;
     }
 
     i_len /= TS_SIZE;
 
-    if ( i_len )
+    if ( i_len > 0 )
+        udp_Lock( loop );
+
+    while ( i_len && *pp_current )
+    {
+        pp_current = &(*pp_current)->p_next;
+        i_len--;
+    }
+
+err:
+    block_DeleteChain( *pp_current );
+    *pp_current = NULL;
+
+    demux_Run( p_ts );
+}
+
+#ifdef HAVE_RECVMMSG
+/*****************************************************************************
+ * udp_ReadBatch: drains up to i_recv_batch datagrams with one recvmmsg(),
+ * and passes them to the demux as a single chain
+ *****************************************************************************/
+static void udp_ReadBatch(struct ev_loop *loop)
+{
+    int i_iov_cnt = i_block_cnt + (b_udp ? 0 : 1);
+    block_t *p_ts = NULL, **pp_current = &p_ts;
+    int i_msg, i_nb_msgs, i_block;
+    bool b_lock = false;
+
+    if ( p_recv_msgs == NULL )
     {
-        if ( !b_sync )
+        /* armed once, then only the slots recvmmsg() filled are re-armed */
+        p_recv_msgs = calloc( i_recv_batch, sizeof(struct mmsghdr) );
+        p_recv_iov = malloc( i_recv_batch * i_iov_cnt * sizeof(struct iovec) );
+        pp_recv_rtp_hdr = malloc( i_recv_batch * RTP_HEADER_SIZE );
+        pp_recv_blocks = malloc( i_recv_batch * i_block_cnt * sizeof(block_t *) );
+
+        for ( i_msg = 0; i_msg < i_recv_batch; i_msg++ )
         {
-            msg_Info( NULL, "frontend has acquired lock" );
-            switch (i_print_type) {
-            case PRINT_XML:
-                fprintf(print_fh, "<STATUS type=\"lock\" status=\"1\"/>\n");
-                break;
-            case PRINT_TEXT:
-                fprintf(print_fh, "lock status: 1\n");
-                break;
-            default:
-                break;
+            struct iovec *p_msg_iov = &p_recv_iov[i_msg * i_iov_cnt];
+            int i_iov = 0;
+
+            if ( !b_udp )
+            {
+                /* FIXME : this is wrong if RTP header > 12 bytes */
+                p_msg_iov[0].iov_base = pp_recv_rtp_hdr[i_msg];
+                p_msg_iov[0].iov_len = RTP_HEADER_SIZE;
+                i_iov = 1;
             }
 
-            b_sync = true;
-        }
+            for ( i_block = 0; i_block < i_block_cnt; i_block++ )
+            {
+                block_t *p_block = block_New();
+                pp_recv_blocks[i_msg * i_block_cnt + i_block] = p_block;
+                p_msg_iov[i_iov].iov_base = p_block->p_ts;
+                p_msg_iov[i_iov].iov_len = TS_SIZE;
+                i_iov++;
+            }
 
-        ev_timer_again(loop, &mute_watcher);
+            p_recv_msgs[i_msg].msg_hdr.msg_iov = p_msg_iov;
+            p_recv_msgs[i_msg].msg_hdr.msg_iovlen = i_iov;
+        }
     }
 
-    while ( i_len && *pp_current )
+    if ( (i_nb_msgs = recvmmsg( i_handle, p_recv_msgs, i_recv_batch,
+                                MSG_DONTWAIT, NULL )) < 0 )
     {
-        pp_current = &(*pp_current)->p_next;
-        i_len--;
+        if ( errno != EAGAIN && errno != EWOULDBLOCK )
+            msg_Err( NULL, "couldn't read from network (%s)",
+                     strerror(errno) );
+        i_nb_msgs = 0;
     }
 
-err:
-    block_DeleteChain( *pp_current );
+    for ( i_msg = 0; i_msg < i_nb_msgs; i_msg++ )
+    {
+        struct iovec *p_msg_iov = &p_recv_iov[i_msg * i_iov_cnt
+                                              + (b_udp ? 0 : 1)];
+        block_t **pp_slots = &pp_recv_blocks[i_msg * i_block_cnt];
+        ssize_t i_len = p_recv_msgs[i_msg].msg_len;
+
+        if ( !b_udp )
+        {
+            udp_CheckRTP( pp_recv_rtp_hdr[i_msg] );
+            i_len -= RTP_HEADER_SIZE;
+        }
+        i_len /= TS_SIZE;
+
+        for ( i_block = 0; i_block < i_len && i_block < i_block_cnt;
+              i_block++ )
+        {
+            *pp_current = pp_slots[i_block];
+            pp_current = &pp_slots[i_block]->p_next;
+            b_lock = true;
+
+            pp_slots[i_block] = block_New();
+            p_msg_iov[i_block].iov_base = pp_slots[i_block]->p_ts;
+        }
+    }
     *pp_current = NULL;
 
+    if ( b_lock )
+        udp_Lock( loop );
+
     demux_Run( p_ts );
 }
+#endif
 
 static void udp_MuteCb(struct ev_loop *loop, struct ev_timer *w, int revents)
 {
@@ -35,6 +35,8 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <syslog.h>
+#include <inttypes.h>
+#include <sys/mman.h>
 
 #include <bitstream/mpeg/psi.h>
 
@@ -43,33 +45,105 @@
 /*****************************************************************************
  * Local declarations
  *****************************************************************************/
-#define MAX_BLOCKS 500
 #define MAX_MSG 1024
 #define VERB_DBG  4
 #define VERB_INFO 3
 #define VERB_WARN 2
 #define VERB_ERR 1
 
+/* Blocks are carved out of large slabs, each one starting on a cache line.
+ * The first slot of a slab holds the slab descriptor. Slabs are only given
+ * back to the system by block_Vacuum(). */
+#define BLOCK_CACHELINE 64
+#define BLOCK_STRIDE ((sizeof(block_t) + BLOCK_CACHELINE - 1) \
+                        & ~(size_t)(BLOCK_CACHELINE - 1))
+#define BLOCK_SLAB_SIZE (2 * 1024 * 1024) /* bytes, one x86 huge page */
+#define BLOCK_SLAB_COUNT (BLOCK_SLAB_SIZE / BLOCK_STRIDE - 1)
+
+typedef struct block_slab_t
+{
+    struct block_slab_t *p_next;
+    bool b_mmap;
+} block_slab_t;
+
+bool b_block_hugepages = false;
+
 static block_t *p_block_lifo = NULL;
-static unsigned int i_block_count = 0;
+static block_slab_t *p_block_slabs = NULL;
+static unsigned int i_block_slabs = 0;
+static unsigned int i_block_count = 0; /* free blocks in the LIFO */
+static unsigned int i_block_used = 0, i_block_max_used = 0;
 
 /*****************************************************************************
- * block_New
+ * block_Grow: adds one slab to the free LIFO
  *****************************************************************************/
-block_t *block_New( void )
+static void block_Grow( void )
 {
-    block_t *p_block;
+    block_slab_t *p_slab = NULL;
+    uint8_t *p_slot;
+    bool b_mmap = false;
+    unsigned int i;
+
+#ifdef MAP_HUGETLB
+    if ( b_block_hugepages )
+    {
+        p_slab = mmap( NULL, BLOCK_SLAB_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        if ( p_slab == MAP_FAILED )
+        {
+            msg_Warn( NULL, "couldn't map a huge page for blocks (%s), falling back to regular pages",
+                      strerror(errno) );
+            b_block_hugepages = false;
+            p_slab = NULL;
+        }
+        else
+            b_mmap = true;
+    }
+#endif
 
-    if (i_block_count)
+    if ( p_slab == NULL
+          && posix_memalign( (void **)&p_slab, BLOCK_CACHELINE,
+                             BLOCK_SLAB_SIZE ) )
     {
-        p_block = p_block_lifo;
-        p_block_lifo = p_block->p_next;
-        i_block_count--;
+        msg_Err( NULL, "couldn't allocate blocks" );
+        exit(EXIT_FAILURE);
     }
-    else
+
+    p_slab->p_next = p_block_slabs;
+    p_slab->b_mmap = b_mmap;
+    p_block_slabs = p_slab;
+    i_block_slabs++;
+
+    /* push in reverse so that blocks are handed out in address order */
+    p_slot = (uint8_t *)p_slab + BLOCK_STRIDE * BLOCK_SLAB_COUNT;
+    for ( i = 0; i < BLOCK_SLAB_COUNT; i++, p_slot -= BLOCK_STRIDE )
     {
-        p_block = malloc(sizeof(block_t));
+        block_t *p_block = (block_t *)p_slot;
+        p_block->p_next = p_block_lifo;
+        p_block_lifo = p_block;
     }
+    i_block_count += BLOCK_SLAB_COUNT;
+
+    msg_Dbg( NULL, "block slab %u allocated (%u blocks in use)",
+             i_block_slabs, i_block_used );
+}
+
+/*****************************************************************************
+ * block_New
+ *****************************************************************************/
+block_t *block_New( void )
+{
+    block_t *p_block;
+
+    if ( !i_block_count )
+        block_Grow();
+
+    p_block = p_block_lifo;
+    p_block_lifo = p_block->p_next;
+    i_block_count--;
+
+    if ( ++i_block_used > i_block_max_used )
+        i_block_max_used = i_block_used;
 
     p_block->p_next = NULL;
     p_block->i_refcount = 1;
@@ -81,15 +155,21 @@ block_t *block_New( void )
  *****************************************************************************/
 void block_Delete( block_t *p_block )
 {
-    if (i_block_count >= MAX_BLOCKS )
-    {
-        free( p_block );
-        return;
-    }
-
     p_block->p_next = p_block_lifo;
     p_block_lifo = p_block;
     i_block_count++;
+    i_block_used--;
+}
+
+/*****************************************************************************
+ * block_GetStats
+ *****************************************************************************/
+void block_GetStats( unsigned int *pi_used, unsigned int *pi_max_used,
+                     unsigned int *pi_total )
+{
+    *pi_used = i_block_used;
+    *pi_max_used = i_block_max_used;
+    *pi_total = i_block_slabs * BLOCK_SLAB_COUNT;
 }
 
 /*****************************************************************************
@@ -97,13 +177,22 @@ void block_Delete( block_t *p_block )
  *****************************************************************************/
 void block_Vacuum( void )
 {
-    while (i_block_count)
+    msg_Dbg( NULL, "blocks: high-water mark %u of %u (%u slabs of %zu bytes)",
+             i_block_max_used, i_block_slabs * (unsigned int)BLOCK_SLAB_COUNT,
+             i_block_slabs, (size_t)BLOCK_SLAB_SIZE );
+
+    while ( p_block_slabs != NULL )
     {
-        block_t *p_block = p_block_lifo;
-        p_block_lifo = p_block->p_next;
-        free(p_block);
-        i_block_count--;
+        block_slab_t *p_slab = p_block_slabs;
+        p_block_slabs = p_slab->p_next;
+        if ( p_slab->b_mmap )
+            munmap( p_slab, BLOCK_SLAB_SIZE );
+        else
+            free( p_slab );
     }
+
+    p_block_lifo = NULL;
+    i_block_slabs = i_block_count = 0;
 }
 
 /*****************************************************************************
@@ -318,6 +407,20 @@ mtime_t mdate( void )
 #endif
 }
 
+/*****************************************************************************
+ * mcputime: CPU time consumed by the calling thread
+ *****************************************************************************/
+mtime_t mcputime( void )
+{
+    struct timespec ts;
+
+    if ( clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) )
+        return 0;
+
+    return ((mtime_t)ts.tv_sec * (mtime_t)1000000)
+            + (mtime_t)(ts.tv_nsec / 1000);
+}
+
 /*****************************************************************************
  * msleep
  *****************************************************************************/
@@ -577,3 +680,62 @@ uint8_t **psi_unpack_sections( uint8_t *p_flat_sections, unsigned int i_size ) {
 
     return pp_sections;
 }
+
+/*****************************************************************************
+ * mpeg_crc32: CRC-32/MPEG-2 (polynomial 0x04c11db7, MSB first, no final
+ * XOR), eight bytes per step using the slice-by-8 tables. Running it over
+ * a whole section, CRC field included, yields 0 when the section is intact.
+ *****************************************************************************/
+static uint32_t ppi_crc32_table[8][256];
+static bool b_crc32_table = false;
+
+static void mpeg_crc32_init( void )
+{
+    unsigned int i, j;
+
+    for ( i = 0; i < 256; i++ )
+    {
+        uint32_t i_crc = i << 24;
+        for ( j = 0; j < 8; j++ )
+            i_crc = (i_crc << 1) ^ ((i_crc & 0x80000000) ? 0x04c11db7 : 0);
+        ppi_crc32_table[0][i] = i_crc;
+    }
+
+    for ( i = 0; i < 256; i++ )
+        for ( j = 1; j < 8; j++ )
+        {
+            uint32_t i_crc = ppi_crc32_table[j - 1][i];
+            ppi_crc32_table[j][i] = (i_crc << 8)
+                                     ^ ppi_crc32_table[0][i_crc >> 24];
+        }
+
+    b_crc32_table = true;
+}
+
+uint32_t mpeg_crc32( const uint8_t *p_data, size_t i_size )
+{
+    uint32_t (*t)[256] = ppi_crc32_table;
+    uint32_t i_crc = 0xffffffff;
+
+    if ( !b_crc32_table )
+        mpeg_crc32_init();
+
+    for ( ; i_size >= 8; i_size -= 8, p_data += 8 )
+    {
+        uint32_t i_hi = i_crc ^ (((uint32_t)p_data[0] << 24)
+                                  | (p_data[1] << 16) | (p_data[2] << 8)
+                                  | p_data[3]);
+        uint32_t i_lo = ((uint32_t)p_data[4] << 24) | (p_data[5] << 16)
+                         | (p_data[6] << 8) | p_data[7];
+
+        i_crc = t[7][i_hi >> 24] ^ t[6][(i_hi >> 16) & 0xff]
+              ^ t[5][(i_hi >> 8) & 0xff] ^ t[4][i_hi & 0xff]
+              ^ t[3][i_lo >> 24] ^ t[2][(i_lo >> 16) & 0xff]
+              ^ t[1][(i_lo >> 8) & 0xff] ^ t[0][i_lo & 0xff];
+    }
+
+    while ( i_size-- )
+        i_crc = (i_crc << 8) ^ t[0][(i_crc >> 24) ^ *p_data++];
+
+    return i_crc;
+}
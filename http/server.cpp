@@ -14,9 +14,13 @@
   #include <fcntl.h>
   #include <sys/types.h>
   #include <sys/socket.h>
+  #include <errno.h>
   #include <sys/mman.h>
   #include <sys/wait.h>
+  #include <sys/epoll.h>
+  #include <sys/sendfile.h>
   #include <netinet/in.h>
+  #include <netinet/tcp.h>
   #include <arpa/inet.h>
 
   #define SOCKET int
@@ -24,10 +28,16 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <unordered_set>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 
@@ -40,15 +50,99 @@ using namespace fmt;
 
 constexpr int kHttpPortNumber = 80;
 constexpr int kRtspPortNumber = 554;
+constexpr int kIdleTimeoutMs = 15000; // keep-alive connection closed after this long without progress
+constexpr int kMaxThreads = 256;
+
+#ifdef __linux__
+  constexpr int kSendFlags = MSG_NOSIGNAL; // peer gone is an error return, not SIGPIPE
+#else
+  constexpr int kSendFlags = 0;
+#endif
 
+//{{{
+static bool wouldBlock() {
+// last socket call failed only because nonBlocking socket has nothing to do
+
+  #ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+  #else
+    return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+  #endif
+  }
+//}}}
+//{{{
+static bool interrupted() {
+
+  #ifdef _WIN32
+    return WSAGetLastError() == WSAEINTR;
+  #else
+    return errno == EINTR;
+  #endif
+  }
+//}}}
+
+//{{{
+class cHttpStats {
+// counters shared by all engine threads, served as /stats
+public:
+  //{{{
+  void closed (int numRequests) {
+  // connection closed after numRequests, bucketed 0, 1, 2-3, 4-7 ...
+
+    int bucket = 0;
+    while ((numRequests > 0) && (bucket < kBuckets-1)) {
+      numRequests >>= 1;
+      bucket++;
+      }
+    mRequestsPerConnection[bucket]++;
+    mOpen--;
+    }
+  //}}}
+  //{{{
+  string getString() {
+
+    string str = format ("connections accepted:{} open:{}\n"
+                         "requests:{}\n"
+                         "requests per closed connection\n",
+                         mAccepted.load(), mOpen.load(), mRequests.load());
+
+    for (int bucket = 0; bucket < kBuckets; bucket++) {
+      int lo = bucket ? 1 << (bucket-1) : 0;
+      int hi = (1 << bucket) - 1;
+      if (bucket == kBuckets-1)
+        str += format ("  {}+:{}\n", lo, mRequestsPerConnection[bucket].load());
+      else if (lo >= hi)
+        str += format ("  {}:{}\n", lo, mRequestsPerConnection[bucket].load());
+      else
+        str += format ("  {}-{}:{}\n", lo, hi, mRequestsPerConnection[bucket].load());
+      }
+
+    return str;
+    }
+  //}}}
+
+  atomic <uint64_t> mAccepted = { 0 };
+  atomic <int64_t> mOpen = { 0 };
+  atomic <uint64_t> mRequests = { 0 };
+
+private:
+  static constexpr int kBuckets = 10;
+  atomic <uint64_t> mRequestsPerConnection[kBuckets] = {};
+  };
+
+static cHttpStats gStats;
+//}}}
 //{{{
 class cHttpServer {
 public:
   cHttpServer (uint16_t portNumber) : mPortNumber(portNumber) {}
   ~cHttpServer() {}
 
+  SOCKET getSocket() { return mParentSocket; }
+
   //{{{
-  void start() {
+  void start (bool nonBlocking = false) {
+  // nonBlocking - SO_REUSEPORT listener per thread, accepted sockets nonBlocking
 
     #ifdef _WIN32
       WSADATA wsaData;
@@ -63,6 +157,16 @@ public:
     int optval = 1;
     setsockopt (mParentSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&optval , sizeof(int));
 
+    #ifdef __linux__
+      mNonBlocking = nonBlocking;
+      if (mNonBlocking) {
+        // every thread binds its own listener, kernel spreads connections across them
+        if (setsockopt (mParentSocket, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(int)) < 0)
+          cLog::log (LOGERROR, "SO_REUSEPORT failed");
+        fcntl (mParentSocket, F_SETFL, fcntl (mParentSocket, F_GETFL) | O_NONBLOCK);
+        }
+    #endif
+
     // bind port to socket
     struct sockaddr_in serverAddr;
     memset (&serverAddr, 0, sizeof(serverAddr));
@@ -74,7 +178,7 @@ public:
       cLog::log (LOGERROR, "bind failed");
 
     // ready to accept connection requests
-    if (listen (mParentSocket, 5) < 0) // allow 5 requests to queue up
+    if (listen (mParentSocket, SOMAXCONN) < 0)
       cLog::log (LOGERROR, "listen failed");
     }
   //}}}
@@ -82,6 +186,12 @@ public:
   SOCKET client (struct sockaddr_in& clientAddr) {
 
     socklen_t clientlen = sizeof (clientAddr);
+
+    #ifdef __linux__
+      if (mNonBlocking)
+        return ::accept4 (mParentSocket, (struct sockaddr*)&clientAddr, &clientlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    #endif
+
     return ::accept (mParentSocket, (struct sockaddr*)&clientAddr, &clientlen);
     }
   //}}}
@@ -89,134 +199,369 @@ public:
 private:
   SOCKET mParentSocket;
   const uint16_t mPortNumber;
+  bool mNonBlocking = false;
   };
 //}}}
 //{{{
-class cHttpRequest {
+class cHttpParser {
+// incremental request parser over a fixed buffer, recv straight into getFree
+// - method, uri, version, headers are std::string_view spans into mBuffer, valid until next
+// - bytes after the request, pipelined, stay in mBuffer for next
+// - a body, once declared by skipBody, is dropped before the next request is parsed
 public:
-  cHttpRequest (SOCKET socket, const struct sockaddr_in& clientAddr, bool debug = false)
-    : mSocket(socket), mSockAddrIn(clientAddr), mDebug(debug) {}
-  ~cHttpRequest() {}
+  static constexpr int kBufferSize = 0x2000;
+  static constexpr int kMaxHeaders = 32;
+
+  enum eKnownHeader { eConnection, eRange, eIfRange, eIfNoneMatch, eIfModifiedSince,
+                      eContentLength, eTransferEncoding, eNumKnownHeaders };
+  enum eResult { eNeedMore, eParsed, eTooLarge };
+
+  char* getFree() { return mBuffer + mUsed; }
+  int getFreeSize() { return kBufferSize - mUsed; }
+  int getSize() { return mUsed; }
+  void received (int bytesReceived) { mUsed += bytesReceived; }
+
+  bool isValid() { return mNumLines && (mNumRequestParts == 3); }
+  std::string_view getMethod() { return mNumRequestParts > 0 ? mRequestParts[0] : "no method"; }
+  std::string_view getUri() { return mNumRequestParts > 1 ? mRequestParts[1] : "no uri"; }
+  std::string_view getVersion() { return mNumRequestParts > 2 ? mRequestParts[2] : "no version"; }
+
+  int getNumLines() { return mNumLines; }
+  int getNumHeaders() { return mNumHeaders; }
+  std::string_view getTag (int index) { return mHeaders[index].mTag; }
+  std::string_view getValue (int index) { return mHeaders[index].mValue; }
+  std::string_view getHeader (eKnownHeader knownHeader) { return mKnownHeaders[knownHeader]; }
+  int getHeaderCount (eKnownHeader knownHeader) { return mKnownHeaderCounts[knownHeader]; }
+  void skipBody (int64_t size) { mBodyLeft = size; }
+  //{{{
+  std::string_view getHeader (std::string_view tag) {
+  // header tags are case insensitive
+
+    for (int i = 0; i < mNumHeaders; i++)
+      if (equalsNoCase (mHeaders[i].mTag, tag))
+        return mHeaders[i].mValue;
+
+    return std::string_view();
+    }
+  //}}}
 
-  string getMethod() { return mRequestStrings.size() > 0 ? mRequestStrings[0] : "no method"; }
-  string getUri() { return mRequestStrings.size() > 1 ? mRequestStrings[1] : "no uri"; }
-  string getVersion() { return mRequestStrings.size() > 2 ? mRequestStrings[2] : "no version"; }
   //{{{
-  string getClientName() {
-  // determine who sent the message
+  eResult parse() {
+  // crude http line parser, carries on from mParsed, eParsed at empty line ending headers
+
+    if (mBodyLeft) {
+      // drop body of previous request as it arrives, mParsed is 0 after next
+      int drop = (int)min ((int64_t)mUsed, mBodyLeft);
+      memmove (mBuffer, mBuffer + drop, mUsed - drop);
+      mUsed -= drop;
+      mBodyLeft -= drop;
+      if (mBodyLeft)
+        return eNeedMore;
+      }
 
-    struct hostent* hostEnt = gethostbyaddr ((const char*)&mSockAddrIn.sin_addr.s_addr,
-                                             sizeof(mSockAddrIn.sin_addr.s_addr), AF_INET);
-    // other hostent fields
-    // char** h_aliases;
-    // short h_addrtype;
-    // short h_length;
-    // char** h_addr_list;
+    while (mParsed < mUsed) {
+      char ch = mBuffer[mParsed++];
+      switch (mState) {
+        case eDone:
+        case eNone:
+        case eLine:
+        case eError:
+          mLineStart = mParsed - 1;
+        case eChar:
+          if (ch =='\r') // return, expect newline
+            mState = eReturn;
+          else if (ch =='\n') {
+            // newline before return, error
+            cLog::log (LOGERROR, "newline before return");
+            mState = eError;
+            }
+          else {
+            // skip to end of line
+            while ((mParsed < mUsed) && (mBuffer[mParsed] != '\r') && (mBuffer[mParsed] != '\n'))
+              mParsed++;
+            mState = eChar;
+            }
+          break;
 
-    return hostEnt ? string(hostEnt->h_name) : string ("no clientName");
+        case eReturn:
+          if (ch == '\n') {
+            // newline after return, line excludes return
+            std::string_view line (mBuffer + mLineStart, mParsed - 2 - mLineStart);
+            if (line.empty()) {
+              // empty line, done
+              mState = eDone;
+              return eParsed;
+              }
+            else {
+              mState = eLine;
+              addLine (line);
+              }
+            }
+          else {
+            // not newline after return
+            mState = eError;
+            cLog::log (LOGERROR, "not newline after return %c", ch);
+            }
+          break;
+        }
+      }
+
+    return mUsed == kBufferSize ? eTooLarge : eNeedMore;
     }
   //}}}
   //{{{
-  string getClientAddressString() {
+  void next() {
+  // forget parsed request, move any pipelined bytes after it to front of mBuffer
+
+    int pending = (mState == eDone) ? mUsed - mParsed : 0;
+    if (pending)
+      memmove (mBuffer, mBuffer + mParsed, pending);
+    mUsed = pending;
+    mParsed = 0;
+    mLineStart = 0;
+    mState = eNone;
+
+    mNumLines = 0;
+    mNumRequestParts = 0;
+    mNumHeaders = 0;
+    for (auto& knownHeader : mKnownHeaders)
+      knownHeader = std::string_view();
+    for (auto& knownHeaderCount : mKnownHeaderCounts)
+      knownHeaderCount = 0;
+    }
+  //}}}
 
-    char* str = inet_ntoa (mSockAddrIn.sin_addr);
-    return str ? string (str) : string("no clientAddr");
+  //{{{
+  static bool equalsNoCase (std::string_view a, std::string_view b) {
+
+    if (a.size() != b.size())
+      return false;
+
+    for (size_t i = 0; i < a.size(); i++)
+      if (toLower (a[i]) != toLower (b[i]))
+        return false;
+
+    return true;
     }
   //}}}
+  //{{{
+  static bool containsNoCase (std::string_view str, std::string_view token) {
+
+    for (size_t i = 0; i + token.size() <= str.size(); i++)
+      if (equalsNoCase (str.substr (i, token.size()), token))
+        return true;
 
+    return false;
+    }
+  //}}}
   //{{{
-  bool receive() {
-  // crude http request parser
+  static std::string_view trim (std::string_view str) {
 
-    constexpr int kRecvBufferSize = 1024;
-    uint8_t buffer[kRecvBufferSize];
+    size_t first = str.find_first_not_of (" \t");
+    if (first == std::string_view::npos)
+      return std::string_view();
+    return str.substr (first, str.find_last_not_of (" \t") - first + 1);
+    }
+  //}}}
 
-    bool needMoreData = true;
-    while (needMoreData) {
-      auto bufferPtr = buffer;
-      auto bufferBytesReceived =  recv (mSocket, (char*)buffer, kRecvBufferSize, 0);;
-      if (bufferBytesReceived <= 0) {
-        cLog::log (LOGERROR, "recv terminated with no bytes %d", bufferBytesReceived);
-        break;
-        }
-      while (needMoreData && (bufferBytesReceived > 0)) {
-        int bytesReceived;
-        needMoreData = parseData (bufferPtr, bufferBytesReceived, bytesReceived);
-        bufferBytesReceived -= bytesReceived;
-        bufferPtr += bytesReceived;
+private:
+  static char toLower (char ch) { return ((ch >= 'A') && (ch <= 'Z')) ? ch + ('a' - 'A') : ch; }
+
+  //{{{
+  void addLine (std::string_view line) {
+
+    if (!mNumLines++) {
+      // request line, method uri version
+      size_t previous = 0;
+      size_t current = line.find (' ');
+      while (mNumRequestParts < 4) {
+        mRequestParts[mNumRequestParts++] = line.substr (previous, current - previous);
+        if (current == std::string_view::npos)
+          break;
+        previous = current + 1;
+        current = line.find (' ', previous);
         }
+      return;
       }
 
-    if (!mStrings.empty())
-      mRequestStrings = split (mStrings[0], ' ');
+    size_t colon = line.find (':');
+    if (colon == std::string_view::npos)
+      return;
 
-    if (mStrings.size() > 1) {
-      for (size_t i = 1; i < mStrings.size(); i++) {
-        vector <string> strings = splitHeader (mStrings[i]);
-        if (strings.size() == 2)
-          mHeaders.push_back (cHeader (strings[0], strings[1]));
-        }
+    if (mNumHeaders == kMaxHeaders) {
+      cLog::log (LOGINFO1, "too many headers, ignored");
+      return;
       }
 
-    if (mDebug)
-      report (true);
-
-    return !mStrings.empty() && (mRequestStrings.size() == 3);
+    cHeader& header = mHeaders[mNumHeaders++];
+    header.mTag = line.substr (0, colon);
+    header.mValue = trim (line.substr (colon + 1));
+
+    // classify known headers once, by length then tag
+    int knownHeader = eNumKnownHeaders;
+    switch (header.mTag.size()) {
+      case 5:  if (equalsNoCase (header.mTag, "Range")) knownHeader = eRange; break;
+      case 8:  if (equalsNoCase (header.mTag, "If-Range")) knownHeader = eIfRange; break;
+      case 10: if (equalsNoCase (header.mTag, "Connection")) knownHeader = eConnection; break;
+      case 13: if (equalsNoCase (header.mTag, "If-None-Match")) knownHeader = eIfNoneMatch; break;
+      case 14: if (equalsNoCase (header.mTag, "Content-Length")) knownHeader = eContentLength; break;
+      case 17:
+        if (equalsNoCase (header.mTag, "If-Modified-Since"))
+          knownHeader = eIfModifiedSince;
+        else if (equalsNoCase (header.mTag, "Transfer-Encoding"))
+          knownHeader = eTransferEncoding;
+        break;
+      }
+    if (knownHeader != eNumKnownHeaders) {
+      mKnownHeaders[knownHeader] = header.mValue;
+      mKnownHeaderCounts[knownHeader]++;
+      }
     }
   //}}}
 
+  enum eState { eNone, eChar, eReturn, eLine, eDone, eError };
+  eState mState = eNone;
+
+  char mBuffer[kBufferSize];
+  int mUsed = 0;
+  int mParsed = 0;
+  int mLineStart = 0;
+
+  int mNumLines = 0;
+  int mNumRequestParts = 0;
+  std::string_view mRequestParts[4]; // 4th only marks too many parts
+
   //{{{
-  bool respondFile() {
+  class cHeader {
+  public:
+    std::string_view mTag;
+    std::string_view mValue;
+    };
+  //}}}
+  int mNumHeaders = 0;
+  cHeader mHeaders[kMaxHeaders];
+  std::string_view mKnownHeaders[eNumKnownHeaders];
+  int mKnownHeaderCounts[eNumKnownHeaders] = {};
 
-    #ifdef __linux__
-      string uri = "." + getUri();
-    #else
-      string uri = "E:/piccies" + getUri();
-    #endif
+  int64_t mBodyLeft = 0;
+  };
+//}}}
+//{{{
+class cHttpRequest {
+public:
+  //{{{
+  cHttpRequest (SOCKET socket, const struct sockaddr_in& clientAddr, bool debug = false, bool persistent = true)
+  // persistent - allow keep-alive, only when an event loop can park the idle connection
+      : mSocket(socket), mSockAddrIn(clientAddr), mDebug(debug), mPersistent(persistent) {
 
-    int fileSize = getFileSize (uri);
-    if (fileSize) {
-      sendResponseOK (uri, fileSize);
+    gStats.mAccepted++;
+    gStats.mOpen++;
+    }
+  //}}}
+  //{{{
+  ~cHttpRequest() {
 
-      // read file into fileBuffer
-      FILE* file = fopen (uri.c_str(), "rb");
-      uint8_t* fileBuffer = (uint8_t*)malloc (fileSize);
-      fread (fileBuffer, 1, fileSize, file);
-      fclose (file);
+    closeFile();
+    closeSocket();
 
-      // send file from fileBuffer
-      if (send (mSocket, (const char*)fileBuffer, (int)fileSize, 0) < 0)
-        cLog::log (LOGERROR, "send failed");
-      free (fileBuffer);
+    gStats.closed (mNumRequests);
+    if (mNumRequests > 1)
+      cLog::log (LOGINFO1, format ("client {} closed after {} requests", getClientAddressString(), mNumRequests));
+    }
+  //}}}
 
-      cLog::log (LOGINFO, format ("file {} sent", uri));
+  std::string_view getMethod() { return mParser.getMethod(); }
+  std::string_view getUri() { return mParser.getUri(); }
+  std::string_view getVersion() { return mParser.getVersion(); }
+  int getNumRequests() { return mNumRequests; }
+  //{{{
+  bool isIdle (chrono::steady_clock::time_point now) {
+    return now - mLastActive > chrono::milliseconds (kIdleTimeoutMs);
+    }
+  //}}}
+  //{{{
+  string getClientName() {
+  // determine who sent the message
 
-      closeSocket();
-      return true;
-      }
+    struct hostent* hostEnt = gethostbyaddr ((const char*)&mSockAddrIn.sin_addr.s_addr,
+                                             sizeof(mSockAddrIn.sin_addr.s_addr), AF_INET);
+    // other hostent fields
+    // char** h_aliases;
+    // short h_addrtype;
+    // short h_length;
+    // char** h_addr_list;
 
-    return false;
+    return hostEnt ? string(hostEnt->h_name) : string ("no clientName");
     }
   //}}}
   //{{{
-  void respondNotOk() {
+  string getClientAddressString() {
 
-    string response = format ("HTTP/1.1 404 notFound\n"
-                              "Content-type: text/html\n"
-                              "\n"
-                              "<html><title>Tiny Error</title>"
-                              "<body bgcolor=""ffffff"">\n"
-                              "404: notFound\n"
-                              "<p>Tiny couldn't find this file: {}\n"
-                              "<hr><em>Colin web server</em>\n",
-                              getUri());
+    char str[INET_ADDRSTRLEN];
+    return inet_ntop (AF_INET, (void*)&mSockAddrIn.sin_addr, str, sizeof(str)) ? string (str) : string("no clientAddr");
+    }
+  //}}}
 
-    if (send (mSocket, response.c_str(), (int)response.size(), 0) < 0)
-      cLog::log (LOGERROR, "sendResponseNotOk send failed");
+  //{{{
+  bool serve() {
+  // run connection as far as its socket allows, false when finished and can be deleted
+  // - nonBlocking socket, call again on every readiness event
+  // - blocking socket, one call runs to completion
+  // - pipelined requests already received are answered in turn, without waiting for the socket
+
+    while (true) {
+      if (mConnectionState == eReceiving) {
+        switch (receiveSome()) {
+          case eIoAgain:
+            return true;
+
+          case eIoClosed:
+            mConnectionState = eFinished;
+            return false;
+
+          case eIoDone: {
+            bool valid = parseRequest();
+            mKeepAlive = valid && mPersistent && wantsKeepAlive() && skipBody();
+            if (!valid || (getMethod() != "GET") || !(queueStats() || queueFile()))
+              queueNotOk();
+            mConnectionState = eSending;
+            break;
+            }
+          }
+        }
 
-    closeSocket();
+      if (mConnectionState == eSending) {
+        switch (sendSome()) {
+          case eIoAgain:
+            return true;
+
+          case eIoClosed:
+            mConnectionState = eFinished;
+            return false;
+
+          case eIoDone:
+            if (mStatus == 200)
+              cLog::log (LOGINFO, format ("file {} sent", mFilename));
+            else if (mStatus == 404)
+              cLog::log (LOGINFO, format ("404 - file {} not found", getUri()));
+            else if (!mStats)
+              cLog::log (LOGINFO, format ("{} - file {}", mStatus, mFilename));
+            mNumRequests++;
+            gStats.mRequests++;
+            break;
+          }
+
+        if (!mKeepAlive) {
+          mConnectionState = eFinished;
+          return false;
+          }
+
+        nextRequest();
+        }
 
-    cLog::log (LOGINFO, format ("404 - file {} not found", getUri()));
+      if (mConnectionState == eFinished)
+        return false;
+      }
     }
   //}}}
 
@@ -224,17 +569,21 @@ public:
   void report (bool showHeaders) {
 
     cLog::log (LOGINFO1, format ("{} {} {} numLines:{} numHeaders:{}",
-                                 getMethod(), getUri(), getVersion(), mStrings.size(), mHeaders.size()));
+                                 getMethod(), getUri(), getVersion(), mParser.getNumLines(), mParser.getNumHeaders()));
 
     if (showHeaders)
-      for (auto& header : mHeaders)
-        cLog::log (LOGINFO1, format ("tag:{} value:{}", header.mTag, header.mValue));
+      for (int i = 0; i < mParser.getNumHeaders(); i++)
+        cLog::log (LOGINFO1, format ("tag:{} value:{}", mParser.getTag (i), mParser.getValue (i)));
     }
   //}}}
 
 private:
+  enum eIoResult { eIoAgain, eIoDone, eIoClosed };
+  static constexpr int64_t kChunkSize = 0x100000; // sendfile call and mapped chunk size, power of 2
+  static constexpr int64_t kMaxSkipBody = 0x10000;
+
   //{{{
-  static int getFileSize (const string& filename) {
+  static int64_t getFileSize (const string& filename, time_t& fileTime) {
 
   #ifdef _WIN32
     struct _stati64 st;
@@ -244,123 +593,618 @@ private:
     if (stat (filename.c_str(), &st) == -1)
   #endif
       return 0;
+
+    fileTime = st.st_mtime;
+    return (int64_t)st.st_size;
+    }
+  //}}}
+  //{{{
+  static string getFileType (const string& filename) {
+
+    if (filename.find (".html") != string::npos)
+      return "text/html";
+    else if (filename.find (".jpg") != string::npos)
+      return "image/jpg";
+    else if (filename.find (".m3u8") != string::npos)
+      return "application/vnd.apple.mpegurl";
+    else if (filename.find (".ts") != string::npos)
+      return "video/mp2t";
     else
-      return (int)st.st_size;
+      return "text/plain";
+    }
+  //}}}
+  //{{{
+  static string getHttpDate (time_t time) {
+  // IMF-fixdate, Sun, 06 Nov 1994 08:49:37 GMT
+
+    static const char* kDays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+    static const char* kMonths[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    struct tm tm;
+    #ifdef _WIN32
+      gmtime_s (&tm, &time);
+    #else
+      gmtime_r (&time, &tm);
+    #endif
+
+    return format ("{}, {:02d} {} {:04d} {:02d}:{:02d}:{:02d} GMT",
+                   kDays[tm.tm_wday], tm.tm_mday, kMonths[tm.tm_mon], tm.tm_year + 1900,
+                   tm.tm_hour, tm.tm_min, tm.tm_sec);
+    }
+  //}}}
+  //{{{
+  static bool parseHttpDate (std::string_view str, time_t& time) {
+  // IMF-fixdate only, what we send in Last-Modified and so what clients send back
+
+    static const char* kMonths = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    char date[64];
+    if (str.size() >= sizeof(date))
+      return false;
+    memcpy (date, str.data(), str.size());
+    date[str.size()] = 0;
+
+    char month[4];
+    struct tm tm;
+    memset (&tm, 0, sizeof(tm));
+    if (sscanf (date, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT",
+                &tm.tm_mday, month, &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+      return false;
+
+    const char* found = strstr (kMonths, month);
+    if (!found || (strlen (month) != 3) || ((found - kMonths) % 3))
+      return false;
+    tm.tm_mon = (int)(found - kMonths) / 3;
+    tm.tm_year -= 1900;
+
+    #ifdef _WIN32
+      time = _mkgmtime (&tm);
+    #else
+      time = timegm (&tm);
+    #endif
+    return time != (time_t)-1;
     }
   //}}}
   //{{{
-  static vector<string> split (const string& lineString, char delimiter = ' ') {
+  eIoResult receiveSome() {
+  // parse bytes left over from the previous request, then recv straight into parser until socket drained
+  // - eIoDone at end of request headers, bytes after them kept by parser
+
+    eIoResult result = parseReceived();
+    if (result != eIoAgain)
+      return result;
+
+    while (true) {
+      auto bytesReceived = recv (mSocket, mParser.getFree(), mParser.getFreeSize(), 0);
+      if (bytesReceived < 0) {
+        if (interrupted())
+          continue;
+        if (wouldBlock())
+          return eIoAgain;
+        cLog::log (LOGERROR, "recv failed");
+        return eIoClosed;
+        }
+      if (bytesReceived == 0) {
+        if (mParser.getSize() || !mNumRequests)
+          cLog::log (LOGINFO1, "recv terminated with no request");
+        return eIoClosed;
+        }
+
+      mLastActive = chrono::steady_clock::now();
+
+      mParser.received ((int)bytesReceived);
+      result = parseReceived();
+      if (result != eIoAgain)
+        return result;
+      }
+    }
+  //}}}
+  //{{{
+  eIoResult parseReceived() {
 
-    vector <string> strings;
+    switch (mParser.parse()) {
+      case cHttpParser::eParsed:
+        return eIoDone;
 
-    size_t previous = 0;
-    size_t current = lineString.find (delimiter);
-    while (current != string::npos) {
-      strings.push_back (lineString.substr (previous, current - previous));
-      previous = current + 1;
-      current = lineString.find (delimiter, previous);
+      case cHttpParser::eTooLarge:
+        cLog::log (LOGERROR, "request too large %d", mParser.getSize());
+        return eIoClosed;
+
+      default:
+        return eIoAgain;
       }
+    }
+  //}}}
+  //{{{
+  bool parseRequest() {
 
-    strings.push_back (lineString.substr (previous, current - previous));
+    if (mDebug)
+      report (true);
 
-    return strings;
+    return mParser.isValid();
     }
   //}}}
   //{{{
-  static vector<string> splitHeader (const string& lineString) {
+  bool wantsKeepAlive() {
+  // HTTP/1.1 persistent unless Connection: close, HTTP/1.0 only with Connection: keep-alive
 
-    vector <string> strings;
+    std::string_view connection = mParser.getHeader (cHttpParser::eConnection);
+    if (cHttpParser::containsNoCase (connection, "close"))
+      return false;
+    if (cHttpParser::containsNoCase (connection, "keep-alive"))
+      return true;
+    return getVersion() == "HTTP/1.1";
+    }
+  //}}}
+  //{{{
+  bool skipBody() {
+  // false if the request body can't be delimited and skipped, connection must close after response
+  // - only GET, HEAD are answered, anything else is refused and closes
+  // - chunked or other Transfer-Encoding is not decoded, closes
+  // - single valid Content-Length body, up to kMaxSkipBody, dropped by parser before next request
+
+    if ((getMethod() != "GET") && (getMethod() != "HEAD"))
+      return false;
+
+    if (mParser.getHeaderCount (cHttpParser::eTransferEncoding))
+      return false;
+
+    switch (mParser.getHeaderCount (cHttpParser::eContentLength)) {
+      case 0:
+        return true;
+
+      case 1: {
+        int64_t bodySize;
+        if (!parseNumber (mParser.getHeader (cHttpParser::eContentLength), bodySize) || (bodySize > kMaxSkipBody))
+          return false;
+        mParser.skipBody (bodySize);
+        return true;
+        }
 
-    size_t current = lineString.find (':');
-    if (current != string::npos) {
-      strings.push_back (lineString.substr (0, current));
-      strings.push_back (lineString.substr (current+2, string::npos));
+      default:
+        return false;
       }
+    }
+  //}}}
+  //{{{
+  void nextRequest() {
+  // reset for next request on same connection, keeps pipelined bytes
+
+    closeFile();
+
+    mConnectionState = eReceiving;
+    mParser.next();
 
-    return strings;
+    mFilename.clear();
+    mSegments.clear();
+    mSegment = 0;
+    mSent = 0;
+    mRangeSent = 0;
+    mStatus = 0;
+    mStats = false;
     }
   //}}}
 
   //{{{
-  bool parseData (const uint8_t* data, int length, int& bytesParsed) {
-  // crude http line parser
+  bool queueFile() {
+  // open file as response body, streamed by sendSome as socket allows
+  // - 304 from ETag/Last-Modified, 206 for satisfiable Range, 416 when none are
 
-    int initialLength = length;
+    #ifdef __linux__
+      string uri = "." + string (getUri());
+    #else
+      string uri = "E:/piccies" + string (getUri());
+    #endif
 
-    while (length) {
-      char ch = *data;
-      switch (mState) {
-        case eDone:
-        case eNone:
-        case eLine:
-        case eError:
-          mString = "";
-        case eChar:
-          if (ch =='\r') // return, expect newline
-            mState = eReturn;
-          else if (ch =='\n') {
-            // newline before return, error
-            cLog::log (LOGERROR, "newline before return");
-            mState = eError;
-            }
-          else {// add to string
-            mString += ch;
-            mState = eChar;
-            }
-          break;
+    time_t fileTime = 0;
+    int64_t fileSize = getFileSize (uri, fileTime);
+    if (!fileSize)
+      return false;
 
-        case eReturn:
-          if (ch == '\n') {
-            // newline after return
-            if (mString.empty()) {
-              // empty line, done
-              mState = eDone;
-              bytesParsed = initialLength - length;
-              return false;
-              }
-            else {
-              mState = eLine;
-              mStrings.push_back (mString);
-              if (mDebug)
-                cLog::log (LOGINFO, mString);
-              }
-            }
-          else {
-            // not newline after return
-            mState = eError;
-            cLog::log (LOGERROR, "not newline after return %c", ch);
+    mFilename = uri;
+    string eTag = format ("\"{:x}-{:x}\"", (int64_t)fileTime, fileSize);
+    string validators = format ("ETag: {}\n"
+                                "Last-Modified: {}\n",
+                                eTag, getHttpDate (fileTime));
+
+    if (isNotModified (eTag, fileTime)) {
+      mStatus = 304;
+      mSegments.push_back (cSegment (getResponse ("304 Not Modified", validators), 0, 0));
+      return true;
+      }
+
+    vector <pair <int64_t,int64_t>> ranges;
+    bool useRanges = isIfRange (eTag, fileTime) && parseRanges (mParser.getHeader (cHttpParser::eRange), fileSize, ranges);
+    if (useRanges && ranges.empty()) {
+      mStatus = 416;
+      mSegments.push_back (cSegment (
+        getResponse ("416 Range Not Satisfiable", format ("Content-Range: bytes */{}\n"
+                                                          "Content-length: 0\n", fileSize)), 0, 0));
+      return true;
+      }
+
+    #ifdef __linux__
+      mFile = open (uri.c_str(), O_RDONLY | O_CLOEXEC);
+      if (mFile < 0)
+        return false;
+    #else
+      mFile = fopen (uri.c_str(), "rb");
+      if (!mFile)
+        return false;
+    #endif
+    mFileSize = fileSize;
+
+    string fileType = getFileType (uri);
+    if (!useRanges) {
+      mStatus = 200;
+      mSegments.push_back (cSegment (
+        getResponse ("200 OK", validators + format ("Accept-Ranges: bytes\n"
+                                                    "Content-length: {}\n"
+                                                    "Content-type: {}\n", fileSize, fileType)),
+        0, fileSize));
+      }
+
+    else if (ranges.size() == 1) {
+      mStatus = 206;
+      int64_t first = ranges[0].first;
+      int64_t last = ranges[0].second;
+      mSegments.push_back (cSegment (
+        getResponse ("206 Partial Content", validators + format ("Content-Range: bytes {}-{}/{}\n"
+                                                                 "Content-length: {}\n"
+                                                                 "Content-type: {}\n",
+                                                                 first, last, fileSize, last - first + 1, fileType)),
+        first, last - first + 1));
+      }
+
+    else {
+      // multipart/byteranges, each part header segment followed by its range of the file
+      mStatus = 206;
+      string boundary = format ("{:016x}", (uint64_t)chrono::steady_clock::now().time_since_epoch().count() ^ (uint64_t)(uintptr_t)this);
+
+      int64_t contentLength = 0;
+      for (auto& range : ranges) {
+        mSegments.push_back (cSegment (format ("\r\n--{}\r\n"
+                                               "Content-type: {}\r\n"
+                                               "Content-Range: bytes {}-{}/{}\r\n"
+                                               "\r\n",
+                                               boundary, fileType, range.first, range.second, fileSize),
+                                       range.first, range.second - range.first + 1));
+        contentLength += mSegments.back().mText.size() + mSegments.back().mSize;
+        }
+      mSegments.push_back (cSegment (format ("\r\n--{}--\r\n", boundary), 0, 0));
+      contentLength += mSegments.back().mText.size();
+
+      mSegments[0].mText = getResponse ("206 Partial Content",
+                                        validators + format ("Content-length: {}\n"
+                                                             "Content-type: multipart/byteranges; boundary={}\n",
+                                                             contentLength, boundary)) + mSegments[0].mText;
+      }
+
+    return true;
+    }
+  //}}}
+  //{{{
+  bool isNotModified (const string& eTag, time_t fileTime) {
+  // If-None-Match wins over If-Modified-Since
+
+    std::string_view ifNoneMatch = mParser.getHeader (cHttpParser::eIfNoneMatch);
+    if (!ifNoneMatch.empty()) {
+      if (ifNoneMatch.find ('*') != std::string_view::npos)
+        return true;
+      // weak comparison, W/ prefix doesn't matter
+      while (!ifNoneMatch.empty()) {
+        size_t comma = min (ifNoneMatch.find (','), ifNoneMatch.size());
+        std::string_view tag = cHttpParser::trim (ifNoneMatch.substr (0, comma));
+        if ((tag.substr (0, 2) == "W/") ? (tag.substr (2) == eTag) : (tag == eTag))
+          return true;
+        ifNoneMatch.remove_prefix (min (comma + 1, ifNoneMatch.size()));
+        }
+      return false;
+      }
+
+    time_t time;
+    std::string_view ifModifiedSince = mParser.getHeader (cHttpParser::eIfModifiedSince);
+    return !ifModifiedSince.empty() && parseHttpDate (ifModifiedSince, time) && (fileTime <= time);
+    }
+  //}}}
+  //{{{
+  bool isIfRange (const string& eTag, time_t fileTime) {
+  // Range only applies if If-Range, when present, still matches, strong comparison
+
+    std::string_view ifRange = mParser.getHeader (cHttpParser::eIfRange);
+    if (ifRange.empty())
+      return true;
+    if (ifRange[0] == '"')
+      return ifRange == eTag;
+
+    time_t time;
+    return parseHttpDate (ifRange, time) && (time == fileTime);
+    }
+  //}}}
+  //{{{
+  static bool parseRanges (std::string_view header, int64_t fileSize, vector <pair <int64_t,int64_t>>& ranges) {
+  // bytes=first-last,first-,-suffix into inclusive ranges clipped to fileSize
+  // - false if no Range or it is malformed, serve whole file
+  // - true with empty ranges if none are satisfiable
+
+    constexpr size_t kMaxRanges = 16;
+
+    if (!cHttpParser::equalsNoCase (header.substr (0, 6), "bytes="))
+      return false;
+    header.remove_prefix (6);
+    if (header.empty())
+      return false;
+
+    while (!header.empty()) {
+      size_t comma = min (header.find (','), header.size());
+      std::string_view rangeSpec = cHttpParser::trim (header.substr (0, comma));
+      header.remove_prefix (min (comma + 1, header.size()));
+
+      size_t dash = rangeSpec.find ('-');
+      if (dash == std::string_view::npos)
+        return false;
+
+      int64_t first;
+      int64_t last;
+      if (dash == 0) {
+        // suffix, last n bytes
+        int64_t suffix;
+        if (!parseNumber (rangeSpec.substr (1), suffix))
+          return false;
+        if (!suffix || !fileSize)
+          continue;
+        first = max ((int64_t)0, fileSize - suffix);
+        last = fileSize - 1;
+        }
+      else {
+        if (!parseNumber (rangeSpec.substr (0, dash), first))
+          return false;
+        if (dash + 1 == rangeSpec.size())
+          last = fileSize - 1;
+        else if (!parseNumber (rangeSpec.substr (dash + 1), last) || (last < first))
+          return false;
+        if (first >= fileSize)
+          continue;
+        last = min (last, fileSize - 1);
+        }
+
+      if (ranges.size() == kMaxRanges)
+        return false;
+      ranges.push_back (make_pair (first, last));
+      }
+
+    return true;
+    }
+  //}}}
+  //{{{
+  static bool parseNumber (std::string_view str, int64_t& value) {
+
+    if (str.empty() || (str.size() > 18))
+      return false;
+
+    value = 0;
+    for (char ch : str) {
+      if ((ch < '0') || (ch > '9'))
+        return false;
+      value = (value * 10) + (ch - '0');
+      }
+
+    return true;
+    }
+  //}}}
+  //{{{
+  bool queueStats() {
+
+    if (getUri() != "/stats")
+      return false;
+
+    string body = gStats.getString() + format ("this connection requests:{}\n", mNumRequests + 1);
+    mSegments.push_back (cSegment (getResponse ("200 OK", format ("Content-length: {}\n"
+                                                                 "Content-type: text/plain\n", body.size())) + body, 0, 0));
+    mStatus = 200;
+    mStats = true;
+    return true;
+    }
+  //}}}
+  //{{{
+  void queueNotOk() {
+
+    string body = format ("<html><title>Tiny Error</title>"
+                          "<body bgcolor=""ffffff"">\n"
+                          "404: notFound\n"
+                          "<p>Tiny couldn't find this file: {}\n"
+                          "<hr><em>Colin web server</em>\n",
+                          getUri());
+
+    mSegments.clear();
+    mSegments.push_back (cSegment (format ("HTTP/1.1 404 notFound\n"
+                                           "Content-type: text/html\n"
+                                           "Content-length: {}\n"
+                                           "Connection: {}\n"
+                                           "\n",
+                                           body.size(), mKeepAlive ? "keep-alive" : "close") + body, 0, 0));
+    mStatus = 404;
+    }
+  //}}}
+  //{{{
+  eIoResult sendSome() {
+  // send mSegments, each text then its file range, from mSegment, mSent, mRangeSent, until done or socket full
+  // - file range by sendfile, file pages go straight to socket
+  // - else by mapped chunk, sent with text in one sendmsg
+
+    if (mFileSize && !mCorked)
+      setCork (true);
+
+    while (mSegment < mSegments.size()) {
+      cSegment& segment = mSegments[mSegment];
+      size_t textLeft = segment.mText.size() - mSent;
+      int64_t rangeLeft = segment.mSize - mRangeSent;
+      if (!textLeft && !rangeLeft) {
+        mSegment++;
+        mSent = 0;
+        mRangeSent = 0;
+        continue;
+        }
+
+      int64_t fileOffset = segment.mOffset + mRangeSent;
+      int64_t bytesSent;
+      #ifdef __linux__
+        if (!textLeft && mUseSendfile) {
+          off_t offset = fileOffset;
+          bytesSent = sendfile (mSocket, mFile, &offset, (size_t)min (rangeLeft, kChunkSize));
+          if ((bytesSent < 0) && ((errno == EINVAL) || (errno == ENOSYS))) {
+            cLog::log (LOGINFO1, format ("sendfile {} unsupported, mapping chunks", mFilename));
+            mUseSendfile = false;
+            continue;
             }
-          break;
+          }
+        else
+      #endif
+        {
+        const uint8_t* body = nullptr;
+        size_t bodySize = 0;
+        if (rangeLeft && !mUseSendfile) {
+          if (!loadChunk (fileOffset, rangeLeft))
+            return eIoClosed;
+          body = mChunk + (fileOffset - mChunkOffset);
+          bodySize = (size_t)min (rangeLeft, mChunkOffset + (int64_t)mChunkSize - fileOffset);
+          }
+        bytesSent = sendParts (segment.mText.data() + mSent, textLeft, body, bodySize);
+        }
+
+      if (bytesSent < 0) {
+        if (interrupted())
+          continue;
+        if (wouldBlock())
+          return eIoAgain;
+        cLog::log (LOGERROR, "send failed");
+        return eIoClosed;
+        }
+      if (bytesSent == 0) {
+        cLog::log (LOGERROR, format ("file {} truncated while sending", mFilename));
+        return eIoClosed;
         }
 
-      data++;
-      length--;
+      mLastActive = chrono::steady_clock::now();
+
+      size_t textSent = (size_t)min ((int64_t)textLeft, bytesSent);
+      mSent += textSent;
+      mRangeSent += bytesSent - textSent;
       }
 
-    bytesParsed = initialLength - length;
+    if (mCorked)
+      setCork (false);
+
+    return eIoDone;
+    }
+  //}}}
+  //{{{
+  int64_t sendParts (const char* response, size_t responseSize, const uint8_t* body, size_t bodySize) {
+
+    #ifdef __linux__
+      struct iovec iov[2];
+      int numIov = 0;
+      if (responseSize)
+        iov[numIov++] = { (void*)response, responseSize };
+      if (bodySize)
+        iov[numIov++] = { (void*)body, bodySize };
+
+      struct msghdr msg;
+      memset (&msg, 0, sizeof(msg));
+      msg.msg_iov = iov;
+      msg.msg_iovlen = numIov;
+      return sendmsg (mSocket, &msg, kSendFlags);
+    #else
+      if (responseSize)
+        return send (mSocket, response, (int)responseSize, kSendFlags);
+      return send (mSocket, (const char*)body, (int)bodySize, kSendFlags);
+    #endif
+    }
+  //}}}
+  //{{{
+  bool loadChunk (int64_t offset, int64_t size) {
+  // make chunk holding offset current, memory bounded by kChunkSize
+  // - mapped kChunkSize aligned, pages outside the range are never touched
+  // - read from offset, no further than size
+
+    if (mChunk && (offset >= mChunkOffset) && (offset < mChunkOffset + (int64_t)mChunkSize))
+      return true;
+
+    #ifdef __linux__
+      if (mChunk)
+        munmap ((void*)mChunk, mChunkSize);
+    #endif
+
+    #ifdef __linux__
+      mChunkOffset = offset & ~(kChunkSize - 1);
+      mChunkSize = (size_t)min (kChunkSize, mFileSize - mChunkOffset);
+      void* map = mmap (nullptr, mChunkSize, PROT_READ, MAP_SHARED, mFile, mChunkOffset);
+      if (map == MAP_FAILED) {
+        mChunk = nullptr;
+        cLog::log (LOGERROR, format ("mmap {} failed", mFilename));
+        return false;
+        }
+      mChunk = (const uint8_t*)map;
+    #else
+      mChunkOffset = offset;
+      mChunkSize = (size_t)min (kChunkSize, size);
+      if (!mChunk)
+        mChunk = (uint8_t*)malloc (kChunkSize);
+      _fseeki64 (mFile, mChunkOffset, SEEK_SET);
+      if (fread ((void*)mChunk, 1, mChunkSize, mFile) != mChunkSize) {
+        cLog::log (LOGERROR, format ("read {} failed", mFilename));
+        return false;
+        }
+    #endif
+
     return true;
     }
   //}}}
   //{{{
-  void sendResponseOK (const string& filename, int fileSize) {
+  void setCork (bool cork) {
+  // hold back partial frames while corked, response and start of body leave together
 
-    string fileType;
-    if (filename.find (".html") != string::npos)
-      fileType = "text/html";
-    else if (filename.find (".jpg") != string::npos)
-      fileType = "image/jpg";
-    else
-      fileType = "text/plain";
+    mCorked = cork;
+    #ifdef __linux__
+      int optval = cork ? 1 : 0;
+      setsockopt (mSocket, IPPROTO_TCP, TCP_CORK, &optval, sizeof(int));
+    #endif
+    }
+  //}}}
+
+  //{{{
+  string getResponse (const string& status, const string& headers) {
+
+    return format ("HTTP/1.1 {}\n"
+                   "Server: Colin web server\n"
+                   "{}"
+                   "Connection: {}\n"
+                   "\r\n",
+                   status, headers, mKeepAlive ? "keep-alive" : "close");
+    }
+  //}}}
+  //{{{
+  void closeFile() {
 
-    string response = format ("HTTP/1.1 200 OK\n"
-                              "Server: Colin web server\n"
-                              "Content-length: {}\n"
-                              "Content-type: {}\n"
-                              "\r\n",
-                              fileSize, fileType);
+    #ifdef __linux__
+      if (mChunk)
+        munmap ((void*)mChunk, mChunkSize);
+      if (mFile >= 0)
+        close (mFile);
+      mFile = -1;
+      mUseSendfile = true;
+    #else
+      free ((void*)mChunk);
+      if (mFile)
+        fclose (mFile);
+      mFile = nullptr;
+    #endif
+
+    mChunk = nullptr;
+    mChunkOffset = 0;
+    mChunkSize = 0;
 
-    if (send (mSocket, response.c_str(), (int)response.size(), 0) < 0)
-      cLog::log (LOGERROR, "sendResponseOK send failed");
+    mFileSize = 0;
     }
   //}}}
   //{{{
@@ -376,31 +1220,265 @@ private:
     }
   //}}}
 
-  enum eState { eNone, eChar, eReturn, eLine, eDone, eError };
+  enum eConnectionState { eReceiving, eSending, eFinished };
 
   const SOCKET mSocket;
   const struct sockaddr_in mSockAddrIn;
   const bool mDebug;
 
-  eState mState = eNone;
-  string mString;
+  const bool mPersistent;
+
+  eConnectionState mConnectionState = eReceiving;
+  chrono::steady_clock::time_point mLastActive = chrono::steady_clock::now();
+  cHttpParser mParser;
+  bool mKeepAlive = false;
+  bool mStats = false;
+  int mNumRequests = 0;
 
-  vector <string> mStrings;
-  vector <string> mRequestStrings;
+  int mStatus = 0;
+  string mFilename;
 
   //{{{
-  class cHeader {
+  class cSegment {
+  // response text, then mSize bytes of file from mOffset
   public:
-    cHeader (const string& tag, const string& value) : mTag(tag), mValue(value) {}
-    ~cHeader() {}
+    cSegment (const string& text, int64_t offset, int64_t size) : mText(text), mOffset(offset), mSize(size) {}
 
-    const string mTag;
-    const string mValue;
+    string mText;
+    int64_t mOffset;
+    int64_t mSize;
     };
   //}}}
-  vector <cHeader> mHeaders;
+  vector <cSegment> mSegments;
+  size_t mSegment = 0;
+  size_t mSent = 0;
+  int64_t mRangeSent = 0;
+
+  #ifdef __linux__
+    int mFile = -1;
+    bool mUseSendfile = true;
+  #else
+    FILE* mFile = nullptr;
+    bool mUseSendfile = false;
+  #endif
+  int64_t mFileSize = 0;
+  bool mCorked = false;
+
+  // fallback when no sendfile
+  const uint8_t* mChunk = nullptr;
+  int64_t mChunkOffset = 0;
+  size_t mChunkSize = 0;
   };
 //}}}
+#ifdef __linux__
+//{{{
+class cHttpEngine {
+// one thread's event loop, own SO_REUSEPORT listener, edge triggered clients
+public:
+  cHttpEngine (uint16_t portNumber, bool debug) : mServer(portNumber), mDebug(debug) {}
+  //{{{
+  ~cHttpEngine() {
+
+    for (auto request : mRequests)
+      delete request;
+
+    if (mEpoll >= 0)
+      close (mEpoll);
+    }
+  //}}}
+
+  //{{{
+  void run() {
+
+    mServer.start (true);
+
+    mEpoll = epoll_create1 (EPOLL_CLOEXEC);
+    if (mEpoll < 0) {
+      cLog::log (LOGERROR, "epoll_create failed");
+      return;
+      }
+
+    // listener level triggered, data.ptr nullptr marks it
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if (epoll_ctl (mEpoll, EPOLL_CTL_ADD, mServer.getSocket(), &event) < 0) {
+      cLog::log (LOGERROR, "epoll_ctl listener failed");
+      return;
+      }
+
+    constexpr int kMaxEvents = 256;
+    struct epoll_event events[kMaxEvents];
+
+    while (true) {
+      int numEvents = epoll_wait (mEpoll, events, kMaxEvents, 1000);
+      if (numEvents < 0) {
+        if (errno == EINTR)
+          continue;
+        cLog::log (LOGERROR, "epoll_wait failed");
+        return;
+        }
+
+      for (int i = 0; i < numEvents; i++) {
+        auto request = (cHttpRequest*)events[i].data.ptr;
+        if (!request)
+          acceptClients();
+        else if ((events[i].events & EPOLLERR) || !request->serve())
+          closeClient (request);
+        }
+
+      auto now = chrono::steady_clock::now();
+      if (now - mLastSweep > chrono::seconds (1)) {
+        //{{{  close connections idle past kIdleTimeoutMs
+        mLastSweep = now;
+        for (auto it = mRequests.begin(); it != mRequests.end();) {
+          auto request = *it;
+          if (request->isIdle (now)) {
+            cLog::log (LOGINFO1, format ("client {} idle timeout", request->getClientAddressString()));
+            it = mRequests.erase (it);
+            delete request;
+            }
+          else
+            ++it;
+          }
+        }
+        //}}}
+      }
+    }
+  //}}}
+
+private:
+  //{{{
+  void acceptClients() {
+
+    while (true) {
+      struct sockaddr_in addr;
+      SOCKET socket = mServer.client (addr);
+      if (socket < 0) {
+        if ((errno == EINTR) || (errno == ECONNABORTED))
+          continue;
+        if (!wouldBlock())
+          cLog::log (LOGERROR, "client accept failed");
+        return;
+        }
+
+      auto request = new cHttpRequest (socket, addr, mDebug);
+      cLog::log (LOGINFO1, "accepted client " + request->getClientAddressString());
+
+      // edge triggered, registering reports current readiness, first serve comes from epoll_wait
+      struct epoll_event event;
+      event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+      event.data.ptr = request;
+      if (epoll_ctl (mEpoll, EPOLL_CTL_ADD, socket, &event) < 0) {
+        cLog::log (LOGERROR, "epoll_ctl client failed");
+        delete request;
+        }
+      else
+        mRequests.insert (request);
+      }
+    }
+  //}}}
+  //{{{
+  void closeClient (cHttpRequest* request) {
+
+    mRequests.erase (request);
+    delete request; // closes socket, removes it from mEpoll
+    }
+  //}}}
+
+  cHttpServer mServer;
+  const bool mDebug;
+  int mEpoll = -1;
+
+  unordered_set <cHttpRequest*> mRequests;
+  chrono::steady_clock::time_point mLastSweep = chrono::steady_clock::now();
+  };
+//}}}
+#endif
+//{{{
+static int legacyParse (const string& request) {
+// previous parser, line by line into strings, split into request strings and headers, for bench only
+
+  string line;
+  vector <string> lines;
+  for (size_t i = 0; i < request.size(); i++) {
+    char ch = request[i];
+    if (ch == '\r')
+      continue;
+    if (ch != '\n')
+      line += ch;
+    else if (line.empty())
+      break;
+    else {
+      lines.push_back (line);
+      line = "";
+      }
+    }
+
+  vector <string> requestStrings;
+  size_t previous = 0;
+  size_t current = lines[0].find (' ');
+  while (current != string::npos) {
+    requestStrings.push_back (lines[0].substr (previous, current - previous));
+    previous = current + 1;
+    current = lines[0].find (' ', previous);
+    }
+  requestStrings.push_back (lines[0].substr (previous, current - previous));
+
+  vector <pair <string,string>> headers;
+  for (size_t i = 1; i < lines.size(); i++) {
+    size_t colon = lines[i].find (':');
+    if (colon != string::npos)
+      headers.push_back (make_pair (lines[i].substr (0, colon), lines[i].substr (colon+2, string::npos)));
+    }
+
+  for (auto& header : headers) {
+    string tag = header.first;
+    transform (tag.begin(), tag.end(), tag.begin(), [](unsigned char ch) { return (char)tolower (ch); });
+    if (tag == "range")
+      return (int)(requestStrings.size() + header.second.size());
+    }
+  return (int)requestStrings.size();
+  }
+//}}}
+//{{{
+static void bench() {
+// requests/s parsing a typical player request, previous parser against cHttpParser
+
+  const string request = "GET /tv/recording.ts HTTP/1.1\r\n"
+                         "Host: 192.168.1.2\r\n"
+                         "User-Agent: Lavf/58.76.100\r\n"
+                         "Accept: */*\r\n"
+                         "Range: bytes=1048576-\r\n"
+                         "Connection: keep-alive\r\n"
+                         "Icy-MetaData: 1\r\n"
+                         "If-None-Match: \"6ad42c60-1312d00\"\r\n"
+                         "\r\n";
+  constexpr int kIterations = 1000000;
+
+  auto time = chrono::steady_clock::now();
+  int check = 0;
+  for (int i = 0; i < kIterations; i++)
+    check += legacyParse (request);
+  double legacySeconds = chrono::duration<double>(chrono::steady_clock::now() - time).count();
+
+  auto parser = new cHttpParser();
+  time = chrono::steady_clock::now();
+  for (int i = 0; i < kIterations; i++) {
+    memcpy (parser->getFree(), request.data(), request.size());
+    parser->received ((int)request.size());
+    parser->parse();
+    check -= 3 + (int)parser->getHeader (cHttpParser::eRange).size();
+    parser->next();
+    }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - time).count();
+  delete parser;
+
+  cLog::log (LOGNOTICE, format ("previous parser {:.0f} requests/s", kIterations / legacySeconds));
+  cLog::log (LOGNOTICE, format ("cHttpParser {:.0f} requests/s, {:.1f}x{}",
+                                kIterations / seconds, legacySeconds / seconds, check ? " mismatch" : ""));
+  }
+//}}}
 
 int main (int numArgs, char* args[]) {
   //{{{  args to params
@@ -410,37 +1488,70 @@ int main (int numArgs, char* args[]) {
   //}}}
   eLogLevel logLevel = LOGINFO;
   bool http = true;
+  bool runBench = false;
+  int numThreads = max (1, (int)thread::hardware_concurrency());
+  string threadsParam;
+  bool threadsSet = false;
   //{{{  parse params
   for (auto it = params.begin(); it < params.end(); ++it) {
     if (*it == "log1") { logLevel = LOGINFO1; params.erase (it); }
     else if (*it == "log2") { logLevel = LOGINFO2; params.erase (it); }
     else if (*it == "log3") { logLevel = LOGINFO3; params.erase (it); }
     else if (*it == "rtsp") { http = false; params.erase (it); }
+    else if (*it == "bench") { runBench = true; params.erase (it); }
+    else if (it->find ("threads=") == 0) { threadsParam = it->substr (8); threadsSet = true; params.erase (it); }
     }
   //}}}
 
   cLog::init (logLevel);
   cLog::log (LOGNOTICE, "minimal http/rtsp server");
 
-  // start server listening on well known port for clients
-  cHttpServer server (http ? kHttpPortNumber : kRtspPortNumber);
-  server.start();
+  if (threadsSet) {
+    // threads=n, bad values are logged and ignored
+    char* end;
+    long threads = strtol (threadsParam.c_str(), &end, 10);
+    if ((end == threadsParam.c_str()) || *end || (threads < 1) || (threads > kMaxThreads))
+      cLog::log (LOGERROR, format ("threads= invalid count {}, using {}", threadsParam, numThreads));
+    else
+      numThreads = (int)threads;
+    }
 
-  while (true) {
-    struct sockaddr_in addr;
-    SOCKET socket = server.client (addr);
-    if (socket < 0) {
-      cLog::log (LOGERROR, "client accept failed");
-      continue;
-      }
+  if (runBench) {
+    bench();
+    return 0;
+    }
 
-    cHttpRequest request (socket, addr, !http);
-    cLog::log (LOGINFO, "accepted client " + request.getClientName() + " "  + request.getClientAddressString());
-    if (request.receive()) {
-      if (request.getMethod() == "GET")
-        if (request.respondFile())
-          continue;
+  uint16_t portNumber = http ? kHttpPortNumber : kRtspPortNumber;
+
+  #ifdef __linux__
+    // an engine per thread, each accepting on its own SO_REUSEPORT listener
+    cLog::log (LOGNOTICE, format ("{} threads", numThreads));
+    vector <thread> threads;
+    for (int i = 1; i < numThreads; i++)
+      threads.push_back (thread ([=]() { cHttpEngine engine (portNumber, !http); engine.run(); }));
+
+    cHttpEngine engine (portNumber, !http);
+    engine.run();
+
+    for (auto& thread : threads)
+      thread.join();
+  #else
+    // start server listening on well known port for clients
+    cHttpServer server (portNumber);
+    server.start();
+
+    while (true) {
+      struct sockaddr_in addr;
+      SOCKET socket = server.client (addr);
+      if (socket < 0) {
+        cLog::log (LOGERROR, "client accept failed");
+        continue;
+        }
+
+      // blocking socket, serve runs to completion, no keep-alive to hold up the next client
+      cHttpRequest request (socket, addr, !http, false);
+      cLog::log (LOGINFO, "accepted client " + request.getClientName() + " "  + request.getClientAddressString());
+      while (request.serve()) {}
       }
-    request.respondNotOk();
-    }
+  #endif
   }